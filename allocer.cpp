@@ -1250,6 +1250,90 @@ int choose( int arg )
         *(int*)ptr = 5;
       }
       break;
+
+    case 66:
+      // repeated double free
+      {
+        char *twice = (char*)malloc( 16 );
+        do_nothing( twice );
+        free( twice );
+        for( int i=0; i<3; i++ )
+          free( twice );
+      }
+      break;
+
+    case 67:
+      // leak recording of allocation id ranges
+      {
+        if( heob_control(HEOB_LEAK_RECORDING_STATE)!=HEOB_NOT_FOUND )
+        {
+          heob_control( HEOB_LEAK_RECORDING_STOP );
+          char *leakNo = (char*)malloc( 16 );
+          do_nothing( leakNo );
+          mem[1] = leakNo[0];
+
+          heob_control( HEOB_LEAK_RECORDING_START );
+          char *leakFreed = (char*)malloc( 24 );
+          do_nothing( leakFreed );
+
+          // stop and start without allocations in between
+          heob_control( HEOB_LEAK_RECORDING_STOP );
+          heob_control( HEOB_LEAK_RECORDING_START );
+          char *leakYes = (char*)malloc( 32 );
+          do_nothing( leakYes );
+          mem[2] = leakYes[0];
+
+          heob_control( HEOB_LEAK_RECORDING_STOP );
+          leakNo = (char*)malloc( 40 );
+          do_nothing( leakNo );
+          mem[3] = leakNo[0];
+          heob_control( HEOB_LEAK_RECORDING_START );
+
+          printf( "leak count: %d\n",heob_control(HEOB_LEAK_COUNT) );
+          free( leakFreed );
+          printf( "leak count: %d\n",heob_control(HEOB_LEAK_COUNT) );
+          fflush( NULL );
+        }
+        else
+          printf( "heob.exe is not running\n" );
+      }
+      break;
+
+    case 68:
+      // some time for the sampling profiler
+      Sleep( 100 );
+      break;
+
+    case 69:
+    case 70:
+      // allocation profile and heap timeline
+      {
+        // not constant, so all allocations have the same stack
+        volatile int count = 10;
+        char *allocs[10];
+        for( int i=0; i<count; i++ )
+          allocs[i] = (char*)malloc( 16 );
+        if( arg==70 )
+          Sleep( 200 );
+        for( int i=0; i<count; i++ )
+        {
+          do_nothing( allocs[i] );
+          free( allocs[i] );
+        }
+      }
+      break;
+
+    case 71:
+      // leaks allocated after the first second
+      {
+        char *early = (char*)malloc( 24 );
+        do_nothing( early );
+        Sleep( 1500 );
+        char *late = (char*)malloc( 32 );
+        do_nothing( late );
+        mem[1] = early[0] + late[0];
+      }
+      break;
   }
 
   mem = (char*)realloc( mem,30 );
@@ -15,6 +15,12 @@
 
 #define SPLIT_MASK 0x3fff
 
+#define PROFILE_SPLIT_BITS 10
+#define PROFILE_SPLIT_MASK 0x3ff
+#define PROFILE_HASH_BUCKETS 64
+
+#define ERROR_HASH_BUCKETS 64
+
 #define CAPTURE_STACK_TRACE( skip,capture,frames,caller,maxFrames ) \
   do { \
     void **frames_ = frames; \
@@ -59,6 +65,17 @@ typedef struct
 }
 splitFreed;
 
+typedef struct
+{
+  CRITICAL_SECTION cs;
+  allocProfile *prof_a;
+  int prof_q;
+  int prof_s;
+  // index+1 of the first allocProfile with this hash
+  int hash_a[PROFILE_HASH_BUCKETS];
+}
+splitProfile;
+
 typedef struct
 {
   const void **start;
@@ -147,6 +164,14 @@ typedef struct localData
 
   splitFreed *freeds;
 
+  splitProfile *profiles;
+  // shortLifetime*frequency of the performance counter
+  UINT64 shortLifetimeFreq;
+  // allocation time is needed for -g4, -j or the profiler
+  int allocTimestamps;
+  // sum of all allocations tracked by the profiler, updated atomically
+  size_t liveSum;
+
   HANDLE heap;
   DWORD pageSize;
   size_t pageAdd;
@@ -186,6 +211,12 @@ typedef struct localData
 #ifndef NO_THREADS
   CRITICAL_SECTION csThreadNum;
 #endif
+  CRITICAL_SECTION csTimeline;
+  CRITICAL_SECTION csErrorRepeat;
+
+  // incremented for each loaded or unloaded module
+  volatile LONG modGeneration;
+  void *modNotifyCookie;
 
   // protected by csMod {{{
 
@@ -209,11 +240,26 @@ typedef struct localData
   size_t raise_id;
   size_t *raise_alloc_a;
 
+  // ids where leak recording was started/stopped,
+  // even indices start and odd indices stop a range
+  size_t *rec_id_a;
+  int rec_id_q;
+  int rec_id_s;
+  int recordingRange;
+
+  // leaks allocated before this performance counter are not shown
+  UINT64 leakAfterCounter;
+
   // }}}
   // protected by csWrite {{{
 
   HANDLE master;
 
+  // module list of the last WRITE_MODS
+  modInfo *sent_mod_a;
+  int sent_mod_q;
+  LONG sent_mod_gen;
+
   // }}}
   // protected by csFreedMod {{{
 
@@ -222,6 +268,23 @@ typedef struct localData
   int freed_mod_s;
   int inExit;
 
+  // }}}
+  // protected by csTimeline {{{
+
+  size_t *timeline_a;
+  int timeline_q;
+  int timeline_s;
+  int timelinePeak;
+
+  // }}}
+  // protected by csErrorRepeat {{{
+
+  errorRepeat *errorRepeat_a;
+  int errorRepeat_q;
+  int errorRepeat_s;
+  // index+1 of the first errorRepeat with this hash
+  int errorRepeatHash_a[ERROR_HASH_BUCKETS];
+
   // }}}
   // protected by csThreadNum {{{
 
@@ -362,6 +425,63 @@ static void *add_realloc( void *ptr,int *count_p,int add,size_t blockSize,
   return( ptr_n );
 }
 
+// the allocation id ranges of leak recording are only updated when the
+// recording state changed, this way start, stop and clear don't have to
+// touch the allocation records
+static NOINLINE void updateRecordingRange( void )
+{
+  GET_REMOTEDATA( rd );
+
+  EnterCriticalSection( &rd->csAllocId );
+
+  int recording = rd->recording>0;
+  if( recording!=rd->recordingRange )
+  {
+    if( rd->rec_id_q>=rd->rec_id_s )
+      rd->rec_id_a = add_realloc( rd->rec_id_a,&rd->rec_id_s,
+          64,sizeof(size_t),&rd->csAllocId );
+    rd->rec_id_a[rd->rec_id_q++] = rd->cur_id + 1;
+    rd->recordingRange = recording;
+  }
+
+  LeaveCriticalSection( &rd->csAllocId );
+}
+
+static void clearRecordingRange( void )
+{
+  GET_REMOTEDATA( rd );
+
+  EnterCriticalSection( &rd->csAllocId );
+
+  rd->rec_id_q = 0;
+  if( rd->recordingRange )
+    rd->rec_id_a[rd->rec_id_q++] = rd->cur_id + 1;
+
+  LeaveCriticalSection( &rd->csAllocId );
+}
+
+// needs csAllocId
+static int isRecorded( const allocation *a )
+{
+  GET_REMOTEDATA( rd );
+
+  if( a->timestamp<rd->leakAfterCounter ) return( 0 );
+
+  size_t id = a->id;
+  const size_t *rec_id_a = rd->rec_id_a;
+  int s = 0;
+  int e = rd->rec_id_q;
+  while( e>s )
+  {
+    int i = ( s+e )/2;
+    if( rec_id_a[i]<=id )
+      s = i + 1;
+    else
+      e = i;
+  }
+  return( s&1 );
+}
+
 static inline void set_errno( int e )
 {
   GET_REMOTEDATA( rd );
@@ -380,10 +500,21 @@ static wchar_t *wdup( const wchar_t *w,HANDLE heap )
 // }}}
 // send module information {{{
 
-static void writeModsFind( modInfo **p_mi_a,int *p_mi_q )
+// the module list only needs to be searched again if the loader
+// reported a change since the last WRITE_MODS
+static LONG writeModsFind( modInfo **p_mi_a,int *p_mi_q )
 {
   GET_REMOTEDATA( rd );
 
+  LONG modGen = rd->modGeneration;
+  if( rd->modNotifyCookie && modGen==rd->sent_mod_gen )
+  {
+#ifndef NO_THREADS
+    writeThreadDescs();
+#endif
+    return( modGen );
+  }
+
   HMODULE ntdll = GetModuleHandle( "ntdll.dll" );
   typedef LONG NTAPI func_LdrLockLoaderLock( ULONG,PULONG,PULONG_PTR );
   typedef LONG NTAPI func_LdrUnlockLoaderLock( ULONG,ULONG_PTR );
@@ -414,7 +545,7 @@ static void writeModsFind( modInfo **p_mi_a,int *p_mi_q )
   if( !mi_a )
   {
     fLdrUnlockLoaderLock( 0,ldrLockCookie );
-    return;
+    return( modGen );
   }
 
   mi_q = 0;
@@ -473,20 +604,107 @@ static void writeModsFind( modInfo **p_mi_a,int *p_mi_q )
 #ifndef NO_THREADS
   writeThreadDescs();
 #endif
+
+  return( modGen );
 }
 
-static void writeModsSend( modInfo *mi_a,int mi_q )
+static VOID CALLBACK dllNotification(
+    ULONG reason,const void *data,PVOID context )
 {
   GET_REMOTEDATA( rd );
 
-  int type = WRITE_MODS;
-  DWORD written;
-  WriteFile( rd->master,&type,sizeof(int),&written,NULL );
-  WriteFile( rd->master,&mi_q,sizeof(int),&written,NULL );
-  if( mi_q )
-    WriteFile( rd->master,mi_a,mi_q*sizeof(modInfo),&written,NULL );
-  if( mi_a )
-    HeapFree( rd->heap,0,mi_a );
+  (void)reason;
+  (void)data;
+  (void)context;
+
+  InterlockedIncrement( &rd->modGeneration );
+}
+
+static int modInfoEqual( const modInfo *a,const modInfo *b )
+{
+  return( a->base==b->base && a->size==b->size &&
+      a->timestamp==b->timestamp &&
+      a->versionMS==b->versionMS && a->versionLS==b->versionLS &&
+      !lstrcmpW(a->path,b->path) );
+}
+
+// only the modules loaded or unloaded since the last call are sent,
+// the full list only the first time (or if no memory is available)
+static void writeModsSend( modInfo *mi_a,int mi_q,LONG modGen )
+{
+  GET_REMOTEDATA( rd );
+
+  // keep the last sent list if it's unchanged or writeModsFind failed
+  if( !mi_a ) return;
+
+  modInfo *sent_a = rd->sent_mod_a;
+  int sent_q = rd->sent_mod_q;
+  modInfo *add_a = NULL;
+  int add_q = 0;
+  size_t *rem_a = NULL;
+  int rem_q = -1;
+  if( sent_a )
+  {
+    add_a = HeapAlloc( rd->heap,0,(mi_q+1)*sizeof(modInfo) );
+    rem_a = HeapAlloc( rd->heap,0,sent_q*(sizeof(size_t)+1)+1 );
+    if( add_a && rem_a )
+    {
+      char *kept = (char*)( rem_a+sent_q );
+      RtlZeroMemory( kept,sent_q );
+      int i,j = 0;
+      for( i=0; i<mi_q; i++ )
+      {
+        // the module order rarely changes,
+        // so the search continues after the last match
+        int k;
+        for( k=0; k<sent_q; k++ )
+        {
+          if( !kept[j] && modInfoEqual(mi_a+i,sent_a+j) ) break;
+          if( ++j==sent_q ) j = 0;
+        }
+        if( k<sent_q )
+        {
+          kept[j] = 1;
+          if( ++j==sent_q ) j = 0;
+        }
+        else
+          add_a[add_q++] = mi_a[i];
+      }
+
+      rem_q = 0;
+      for( i=0; i<sent_q; i++ )
+        if( !kept[i] ) rem_a[rem_q++] = sent_a[i].base;
+    }
+  }
+  if( rem_q<0 )
+  {
+    if( add_a ) HeapFree( rd->heap,0,add_a );
+    add_a = mi_a;
+    add_q = mi_q;
+  }
+
+  if( add_q || rem_q )
+  {
+    int type = WRITE_MODS;
+    DWORD written;
+    WriteFile( rd->master,&type,sizeof(int),&written,NULL );
+    WriteFile( rd->master,&add_q,sizeof(int),&written,NULL );
+    WriteFile( rd->master,&rem_q,sizeof(int),&written,NULL );
+    if( rem_q>0 )
+      WriteFile( rd->master,rem_a,rem_q*sizeof(size_t),&written,NULL );
+    if( add_q )
+      WriteFile( rd->master,add_a,add_q*sizeof(modInfo),&written,NULL );
+  }
+
+  if( add_a && add_a!=mi_a )
+    HeapFree( rd->heap,0,add_a );
+  if( rem_a )
+    HeapFree( rd->heap,0,rem_a );
+  if( sent_a )
+    HeapFree( rd->heap,0,sent_a );
+  rd->sent_mod_a = mi_a;
+  rd->sent_mod_q = mi_q;
+  rd->sent_mod_gen = modGen;
 }
 
 static void writeAllocs( allocation *alloc_a,int alloc_q,int type )
@@ -495,11 +713,11 @@ static void writeAllocs( allocation *alloc_a,int alloc_q,int type )
 
   int mi_q = 0;
   modInfo *mi_a = NULL;
-  writeModsFind( &mi_a,&mi_q );
+  LONG modGen = writeModsFind( &mi_a,&mi_q );
 
   EnterCriticalSection( &rd->csWrite );
 
-  writeModsSend( mi_a,mi_q );
+  writeModsSend( mi_a,mi_q,modGen );
 
   DWORD written;
   WriteFile( rd->master,&type,sizeof(int),&written,NULL );
@@ -508,6 +726,324 @@ static void writeAllocs( allocation *alloc_a,int alloc_q,int type )
   LeaveCriticalSection( &rd->csWrite );
 }
 
+// }}}
+// allocation profiler {{{
+
+static unsigned profileHash( void **frames,funcType ft )
+{
+  // FNV-1a
+  unsigned hash = 2166136261U;
+  int i;
+  for( i=0; i<PTRS && frames[i]; i++ )
+  {
+    uintptr_t frame = (uintptr_t)frames[i];
+    hash = ( hash^(unsigned)frame )*16777619U;
+#ifdef _WIN64
+    hash = ( hash^(unsigned)(frame>>32) )*16777619U;
+#endif
+  }
+  return( (hash^ft)*16777619U );
+}
+
+static int sameFrames( void **frames1,void **frames2 )
+{
+  int i;
+  for( i=0; i<PTRS && frames1[i]==frames2[i] && frames1[i]; i++ );
+  return( i==PTRS || frames1[i]==frames2[i] );
+}
+
+static int lifetimeBucket( UINT64 ticks )
+{
+  DWORD low = (DWORD)ticks;
+  DWORD high = (DWORD)( ticks>>32 );
+  int bucket = 0;
+  if( high )
+  {
+    bucket = 32;
+    low = high;
+  }
+  if( low )
+  {
+#ifndef _MSC_VER
+    bucket += 32 - __builtin_clz( low );
+#else
+    DWORD index;
+    _BitScanReverse( &index,low );
+    bucket += index + 1;
+#endif
+  }
+  return( bucket<LIFETIME_BUCKETS ? bucket : LIFETIME_BUCKETS-1 );
+}
+
+static NOINLINE void profileAlloc( allocation *a )
+{
+  GET_REMOTEDATA( rd );
+
+  unsigned hash = profileHash( a->frames,a->ft );
+  int splitIdx = hash&PROFILE_SPLIT_MASK;
+  splitProfile *sp = rd->profiles + splitIdx;
+  int *bucket = sp->hash_a + ( hash>>PROFILE_SPLIT_BITS )%PROFILE_HASH_BUCKETS;
+
+  EnterCriticalSection( &sp->cs );
+
+  int i;
+  for( i=*bucket-1; i>=0; i=sp->prof_a[i].next-1 )
+  {
+    allocProfile *ap = sp->prof_a + i;
+    if( ap->hash==hash && ap->ft==a->ft && sameFrames(ap->frames,a->frames) )
+      break;
+  }
+  if( i<0 )
+  {
+    if( sp->prof_q>=sp->prof_s )
+      sp->prof_a = add_realloc(
+          sp->prof_a,&sp->prof_s,64,sizeof(allocProfile),&sp->cs );
+    i = sp->prof_q++;
+    allocProfile *ap = sp->prof_a + i;
+    RtlZeroMemory( ap,sizeof(allocProfile) );
+    RtlMoveMemory( ap->frames,a->frames,PTRS*sizeof(void*) );
+    ap->ft = a->ft;
+    ap->hash = hash;
+    ap->next = *bucket;
+    *bucket = i + 1;
+  }
+
+  allocProfile *ap = sp->prof_a + i;
+  ap->allocCount++;
+  ap->allocSum += a->size;
+  ap->liveSum += a->size;
+  if( ap->liveSum>ap->peakSum )
+    ap->peakSum = ap->liveSum;
+
+  LeaveCriticalSection( &sp->cs );
+
+  a->profileIdx = ( i<<PROFILE_SPLIT_BITS )|splitIdx;
+
+  IL_ADD( (IL_INT*)&rd->liveSum,(IL_INT)a->size );
+}
+
+static NOINLINE void profileFree( const allocation *a,int threadNum )
+{
+  GET_REMOTEDATA( rd );
+
+  LARGE_INTEGER ticks;
+  QueryPerformanceCounter( &ticks );
+  UINT64 lifetime = ticks.QuadPart - a->timestamp;
+  int bucket = lifetimeBucket( lifetime );
+
+  // lifetime/frequency < shortLifetime/1000000,
+  // but without 64bit division
+  int shortLived = rd->shortLifetimeFreq &&
+    lifetime<=(UINT64)-1/1000000 &&
+    lifetime*1000000<rd->shortLifetimeFreq;
+#ifndef NO_THREADS
+  int sameThread = shortLived && threadNum==a->threadNum;
+#else
+  int sameThread = 0;
+  (void)threadNum;
+#endif
+
+  splitProfile *sp = rd->profiles + ( a->profileIdx&PROFILE_SPLIT_MASK );
+
+  EnterCriticalSection( &sp->cs );
+
+  allocProfile *ap = sp->prof_a + ( a->profileIdx>>PROFILE_SPLIT_BITS );
+  ap->freeCount++;
+  ap->freeSum += a->size;
+  ap->liveSum -= a->size;
+  ap->lifetimes[bucket]++;
+  if( shortLived )
+  {
+    ap->shortCount++;
+    ap->shortSum += a->size;
+    ap->shortSameThread += sameThread;
+  }
+
+  LeaveCriticalSection( &sp->cs );
+
+  IL_ADD( (IL_INT*)&rd->liveSum,-(IL_INT)a->size );
+}
+
+// the heap usage is sampled in fixed intervals,
+// and at each new maximum the live allocations of all stacks are saved
+static CODE_SEG(".text$5") DWORD WINAPI heapTimelineThread( LPVOID arg )
+{
+  GET_REMOTEDATA( rd );
+
+  DWORD interval = (DWORD)(uintptr_t)arg;
+  while( 1 )
+  {
+    Sleep( interval );
+
+    size_t liveSum = rd->liveSum;
+
+    EnterCriticalSection( &rd->csTimeline );
+
+    if( rd->timeline_q>=rd->timeline_s )
+      rd->timeline_a = add_realloc( rd->timeline_a,&rd->timeline_s,
+          1024,sizeof(size_t),&rd->csTimeline );
+    rd->timeline_a[rd->timeline_q] = liveSum;
+
+    if( !rd->timeline_q || liveSum>rd->timeline_a[rd->timelinePeak] )
+    {
+      rd->timelinePeak = rd->timeline_q;
+
+      int i;
+      for( i=0; i<=PROFILE_SPLIT_MASK; i++ )
+      {
+        splitProfile *sp = rd->profiles + i;
+
+        EnterCriticalSection( &sp->cs );
+
+        int j;
+        for( j=0; j<sp->prof_q; j++ )
+        {
+          allocProfile *ap = sp->prof_a + j;
+          ap->heapPeakSum = ap->liveSum;
+          ap->heapPeakCount = ap->allocCount - ap->freeCount;
+        }
+
+        LeaveCriticalSection( &sp->cs );
+      }
+    }
+
+    rd->timeline_q++;
+
+    LeaveCriticalSection( &rd->csTimeline );
+  }
+
+  return( 0 );
+}
+
+// needs csTimeline
+static void writeTimelineData( void )
+{
+  GET_REMOTEDATA( rd );
+
+  if( !rd->profiles || rd->opt.heapTimeline<=0 ) return;
+
+  int type = WRITE_HEAP_TIMELINE;
+  DWORD written;
+  WriteFile( rd->master,&type,sizeof(int),&written,NULL );
+  WriteFile( rd->master,&rd->timeline_q,sizeof(int),&written,NULL );
+  WriteFile( rd->master,&rd->timelinePeak,sizeof(int),&written,NULL );
+  if( rd->timeline_q )
+    WriteFile( rd->master,rd->timeline_a,
+        rd->timeline_q*sizeof(size_t),&written,NULL );
+}
+
+static void writeProfileData( void )
+{
+  GET_REMOTEDATA( rd );
+
+  if( !rd->profiles ) return;
+
+  int i;
+  int prof_q = 0;
+  for( i=0; i<=PROFILE_SPLIT_MASK; i++ )
+  {
+    splitProfile *sp = rd->profiles + i;
+    EnterCriticalSection( &sp->cs );
+    prof_q += sp->prof_q;
+  }
+
+  int type = WRITE_ALLOC_PROFILE;
+  DWORD written;
+  WriteFile( rd->master,&type,sizeof(int),&written,NULL );
+  WriteFile( rd->master,&prof_q,sizeof(int),&written,NULL );
+  for( i=0; i<=PROFILE_SPLIT_MASK; i++ )
+  {
+    splitProfile *sp = rd->profiles + i;
+    if( sp->prof_q )
+      WriteFile( rd->master,sp->prof_a,
+          sp->prof_q*sizeof(allocProfile),&written,NULL );
+    LeaveCriticalSection( &sp->cs );
+  }
+}
+
+// }}}
+// repeated errors {{{
+
+// returns 1 if the same error was already reported often enough
+static NOINLINE int errorRepeated(
+    allocation *offending,allocation *alloc,int type )
+{
+  GET_REMOTEDATA( rd );
+
+  int limit = rd->opt.errorLimit;
+  if( limit<=0 ) return( 0 );
+
+  unsigned hash = profileHash( offending->frames,type );
+  hash = ( hash^profileHash(alloc->frames,0) )*16777619U;
+  int *bucket = rd->errorRepeatHash_a + hash%ERROR_HASH_BUCKETS;
+
+  EnterCriticalSection( &rd->csErrorRepeat );
+
+  int i;
+  for( i=*bucket-1; i>=0; i=rd->errorRepeat_a[i].next-1 )
+  {
+    errorRepeat *er = rd->errorRepeat_a + i;
+    if( er->hash==hash && er->type==type &&
+        sameFrames(er->aa[0].frames,offending->frames) &&
+        sameFrames(er->aa[1].frames,alloc->frames) )
+      break;
+  }
+  if( i<0 )
+  {
+    if( rd->errorRepeat_q>=rd->errorRepeat_s )
+      rd->errorRepeat_a = add_realloc( rd->errorRepeat_a,
+          &rd->errorRepeat_s,16,sizeof(errorRepeat),&rd->csErrorRepeat );
+    i = rd->errorRepeat_q++;
+    errorRepeat *er = rd->errorRepeat_a + i;
+    RtlMoveMemory( er->aa,offending,sizeof(allocation) );
+    RtlMoveMemory( er->aa+1,alloc,sizeof(allocation) );
+    er->hash = hash;
+    er->next = *bucket;
+    er->type = type;
+    er->count = 0;
+    *bucket = i + 1;
+  }
+
+  int count = ++rd->errorRepeat_a[i].count;
+
+  LeaveCriticalSection( &rd->csErrorRepeat );
+
+  return( count>limit );
+}
+
+// needs csWrite
+static void writeErrorRepeats( void )
+{
+  GET_REMOTEDATA( rd );
+
+  int limit = rd->opt.errorLimit;
+  if( limit<=0 ) return;
+
+  EnterCriticalSection( &rd->csErrorRepeat );
+
+  int i;
+  int repeat_q = 0;
+  for( i=0; i<rd->errorRepeat_q; i++ )
+    if( rd->errorRepeat_a[i].count>limit ) repeat_q++;
+
+  if( repeat_q )
+  {
+    int type = WRITE_ERROR_REPEATS;
+    DWORD written;
+    WriteFile( rd->master,&type,sizeof(int),&written,NULL );
+    WriteFile( rd->master,&repeat_q,sizeof(int),&written,NULL );
+    WriteFile( rd->master,&limit,sizeof(int),&written,NULL );
+    for( i=0; i<rd->errorRepeat_q; i++ )
+    {
+      errorRepeat *er = rd->errorRepeat_a + i;
+      if( er->count>limit )
+        WriteFile( rd->master,er,sizeof(errorRepeat),&written,NULL );
+    }
+  }
+
+  LeaveCriticalSection( &rd->csErrorRepeat );
+}
+
 // }}}
 // memory allocation tracking {{{
 
@@ -659,6 +1195,15 @@ static NOINLINE int trackFree(
 
       freeSize = fa.size;
 
+      if( rd->profiles && !failed_realloc )
+      {
+#ifndef NO_THREADS
+        profileFree( &fa,threadNum );
+#else
+        profileFree( &fa,0 );
+#endif
+      }
+
       if( UNLIKELY(fa.ftFreed==FT_BLOCKED) )
       {
         allocation *aa = HeapAlloc( rd->heap,0,2*sizeof(allocation) );
@@ -732,7 +1277,8 @@ static NOINLINE int trackFree(
         aa[1].threadNum = threadNum;
 #endif
 
-        writeAllocs( aa,2,WRITE_WRONG_DEALLOC );
+        if( !errorRepeated(aa+1,aa,WRITE_WRONG_DEALLOC) )
+          writeAllocs( aa,2,WRITE_WRONG_DEALLOC );
 
         HeapFree( rd->heap,0,aa );
 
@@ -778,7 +1324,8 @@ static NOINLINE int trackFree(
 
         aa[2].ft = fa.ftFreed;
 
-        writeAllocs( aa,3,WRITE_DOUBLE_FREE );
+        if( !errorRepeated(aa,aa+1,WRITE_DOUBLE_FREE) )
+          writeAllocs( aa,3,WRITE_DOUBLE_FREE );
 
         if( rd->opt.raiseException )
           DebugBreak();
@@ -811,7 +1358,8 @@ static NOINLINE int trackFree(
 
           aa[2].ft = aa[1].ftFreed;
 
-          writeAllocs( aa,3,WRITE_DOUBLE_FREE );
+          if( !errorRepeated(aa,aa+1,WRITE_DOUBLE_FREE) )
+            writeAllocs( aa,3,WRITE_DOUBLE_FREE );
 
           if( rd->opt.raiseException )
             DebugBreak();
@@ -1081,7 +1629,8 @@ static NOINLINE int trackFree(
         }
         // }}}
 
-        writeAllocs( aa,4,WRITE_FREE_FAIL );
+        if( !errorRepeated(aa,aa+1,WRITE_FREE_FAIL) )
+          writeAllocs( aa,4,WRITE_FREE_FAIL );
 
         if( rd->opt.raiseException )
           DebugBreak();
@@ -1119,11 +1668,19 @@ static NOINLINE void trackAllocSuccess(
     a.ptr = alloc_ptr;
     a.size = alloc_size;
     a.at = at;
-    a.recording = rd->recording;
     a.raiseFree = 0;
     a.lt = LT_LOST;
     a.ft = ft;
     a.ftFreed = FT_COUNT; // is < FT_COUNT while realloc() is called
+    a.timestamp = 0;
+    if( rd->allocTimestamps )
+    {
+      LARGE_INTEGER ticks;
+      QueryPerformanceCounter( &ticks );
+      a.timestamp = ticks.QuadPart;
+    }
+    if( UNLIKELY((rd->recording>0)!=rd->recordingRange) )
+      updateRecordingRange();
     a.id = IL_INC( (IL_INT*)&rd->cur_id );
 #ifndef NO_THREADS
     a.threadNum = threadNum;
@@ -1131,6 +1688,9 @@ static NOINLINE void trackAllocSuccess(
 
     CAPTURE_STACK_TRACE( 2,PTRS,a.frames,caller,rd->maxStackFrames );
 
+    if( rd->profiles )
+      profileAlloc( &a );
+
     int is_next_raise = 0;
     if( rd->raise_id )
     {
@@ -1217,11 +1777,11 @@ static NOINLINE void trackAllocFailure(
 
     int mi_q = 0;
     modInfo *mi_a = NULL;
-    writeModsFind( &mi_a,&mi_q );
+    LONG modGen = writeModsFind( &mi_a,&mi_q );
 
     EnterCriticalSection( &rd->csWrite );
 
-    writeModsSend( mi_a,mi_q );
+    writeModsSend( mi_a,mi_q,modGen );
 
     DWORD written;
     int type = WRITE_ALLOC_FAIL;
@@ -1755,6 +2315,8 @@ static void writeLeakData( void )
   }
   // }}}
 
+  EnterCriticalSection( &rd->csAllocId );
+
   // leak count {{{
   int i;
   int alloc_q = 0;
@@ -1772,7 +2334,7 @@ static void writeLeakData( void )
     for( j=0; j<part_q; j++ )
     {
       allocation *a = sa->alloc_a + j;
-      if( a->recording && a->ftFreed==FT_COUNT )
+      if( a->ftFreed==FT_COUNT && isRecorded(a) )
       {
         if( a->lt<lDetails )
           alloc_q++;
@@ -1815,7 +2377,7 @@ static void writeLeakData( void )
     for( j=0; j<alloc_q; j++ )
     {
       allocation *a = sa->alloc_a + j;
-      if( a->recording && a->ftFreed==FT_COUNT && a->lt<lDetails )
+      if( a->ftFreed==FT_COUNT && a->lt<lDetails && isRecorded(a) )
       {
         a_send_size += sizeof(allocation);
         if( a_send!=a || a_send_size>=0x10000000 )
@@ -1840,7 +2402,7 @@ static void writeLeakData( void )
       for( j=0; j<alloc_q; j++ )
       {
         allocation *a = sa->alloc_a + j;
-        if( !a->recording || a->ftFreed!=FT_COUNT || a->lt>=lDetails )
+        if( a->ftFreed!=FT_COUNT || a->lt>=lDetails || !isRecorded(a) )
           continue;
         size_t s = a->size;
         alloc_mem_sum += s<leakContents ? s : leakContents;
@@ -1861,7 +2423,7 @@ static void writeLeakData( void )
       for( j=0; j<alloc_q; j++ )
       {
         allocation *a = sa->alloc_a + j;
-        if( !a->recording || a->ftFreed!=FT_COUNT || a->lt>=lDetails )
+        if( a->ftFreed!=FT_COUNT || a->lt>=lDetails || !isRecorded(a) )
           continue;
         size_t s = a->size;
         if( leakContents<s ) s = leakContents;
@@ -1871,6 +2433,8 @@ static void writeLeakData( void )
     }
   }
   // }}}
+
+  LeaveCriticalSection( &rd->csAllocId );
 }
 
 // }}}
@@ -2159,8 +2723,16 @@ static void writeExitData( void )
 {
   GET_REMOTEDATA( rd );
 
+  writeErrorRepeats();
+
   writeLeakData();
 
+  // the peak snapshot of the profile has to match the timeline
+  EnterCriticalSection( &rd->csTimeline );
+  writeTimelineData();
+  writeProfileData();
+  LeaveCriticalSection( &rd->csTimeline );
+
   if( rd->exitTrace )
   {
     int type = WRITE_EXIT_TRACE;
@@ -2214,11 +2786,11 @@ static VOID WINAPI new_ExitProcess( UINT c )
 
   int mi_q = 0;
   modInfo *mi_a = NULL;
-  writeModsFind( &mi_a,&mi_q );
+  LONG modGen = writeModsFind( &mi_a,&mi_q );
 
   EnterCriticalSection( &rd->csWrite );
 
-  writeModsSend( mi_a,mi_q );
+  writeModsSend( mi_a,mi_q,modGen );
 
 #if USE_STACKWALK
   writeSamplingData();
@@ -2605,6 +3177,13 @@ int heobSubProcess(
 #endif
       ADD_OPTION( " -w",forwardStartupInfo,0 );
       ADD_OPTION( " -T",disableParallelLoading,0 );
+      ADD_OPTION( " -u",allocProfile,0 );
+      ADD_OPTION( " -U",shortLifetime,0 );
+      ADD_OPTION( " -t",heapTimeline,0 );
+      ADD_OPTION( " -j",leakAfter,0 );
+      ADD_OPTION( " -N",topGroups,0 );
+      ADD_OPTION( " -W",svgMinWidth,1 );
+      ADD_OPTION( " -Q",errorLimit,0 );
 #undef ADD_OPTION
       int i;
       for( i=0; i<raise_alloc_q; i++ )
@@ -2730,6 +3309,8 @@ static void addLoadedModule( HMODULE mod )
 {
   GET_REMOTEDATA( rd );
 
+  InterlockedIncrement( &rd->modGeneration );
+
   EnterCriticalSection( &rd->csMod );
   addModule( mod );
   replaceModFuncs();
@@ -2740,11 +3321,11 @@ static void addLoadedModule( HMODULE mod )
   {
     int mi_q = 0;
     modInfo *mi_a = NULL;
-    writeModsFind( &mi_a,&mi_q );
+    LONG modGen = writeModsFind( &mi_a,&mi_q );
 
     EnterCriticalSection( &rd->csWrite );
 
-    writeModsSend( mi_a,mi_q );
+    writeModsSend( mi_a,mi_q,modGen );
 
     LeaveCriticalSection( &rd->csWrite );
   }
@@ -2810,7 +3391,12 @@ static BOOL WINAPI new_FreeLibrary( HMODULE mod )
 
   LeaveCriticalSection( &rd->csMod );
 
-  if( m<0 ) return( rd->fFreeLibrary(mod) );
+  if( m<0 )
+  {
+    BOOL ret = rd->fFreeLibrary( mod );
+    InterlockedIncrement( &rd->modGeneration );
+    return( ret );
+  }
 
   if( rd->opt.dlls!=3 ) return( TRUE );
 
@@ -2956,7 +3542,8 @@ static NOINLINE void protect_free_m( void *b,funcType ft )
         aa[1].threadNum = (int)(uintptr_t)TlsGetValue( rd->threadNumTls );
 #endif
 
-        writeAllocs( aa,2,WRITE_SLACK );
+        if( !errorRepeated(aa+1,aa,WRITE_SLACK) )
+          writeAllocs( aa,2,WRITE_SLACK );
 
         if( rd->opt.raiseException )
           DebugBreak();
@@ -3728,6 +4315,14 @@ static void replaceModFuncs( void )
           HeapFree( rd->heap,0,rd->freeds );
           rd->freeds = NULL;
         }
+        if( rd->profiles )
+        {
+          int i;
+          for( i=0; i<=PROFILE_SPLIT_MASK; i++ )
+            DeleteCriticalSection( &rd->profiles[i].cs );
+          HeapFree( rd->heap,0,rd->profiles );
+          rd->profiles = NULL;
+        }
       }
 
       if( dll_msvcrt && rd->opt.protect )
@@ -4271,11 +4866,11 @@ static LONG WINAPI exceptionWalker( PEXCEPTION_POINTERS ep )
 
   int mi_q = 0;
   modInfo *mi_a = NULL;
-  writeModsFind( &mi_a,&mi_q );
+  LONG modGen = writeModsFind( &mi_a,&mi_q );
 
   EnterCriticalSection( &rd->csWrite );
 
-  writeModsSend( mi_a,mi_q );
+  writeModsSend( mi_a,mi_q,modGen );
 
   int type = WRITE_EXCEPTION;
   DWORD written;
@@ -4407,6 +5002,8 @@ DLLEXPORT int heob_control( int cmd )
     case HEOB_LEAK_RECORDING_STOP:
     case HEOB_LEAK_RECORDING_START:
       rd->recording = cmd;
+      if( rd->splits )
+        updateRecordingRange();
       break;
       // }}}
 
@@ -4418,21 +5015,7 @@ DLLEXPORT int heob_control( int cmd )
           break;
 #endif
 
-        int i;
-        for( i=0; i<=SPLIT_MASK; i++ )
-        {
-          int j;
-          splitAllocation *sa = rd->splits + i;
-
-          EnterCriticalSection( &sa->cs );
-
-          int alloc_q = sa->alloc_q;
-          allocation *alloc_a = sa->alloc_a;
-          for( j=0; j<alloc_q; j++ )
-            alloc_a[j].recording = 0;
-
-          LeaveCriticalSection( &sa->cs );
-        }
+        clearRecordingRange();
       }
       break;
       // }}}
@@ -4445,11 +5028,11 @@ DLLEXPORT int heob_control( int cmd )
         {
           int mi_q = 0;
           modInfo *mi_a = NULL;
-          writeModsFind( &mi_a,&mi_q );
+          LONG modGen = writeModsFind( &mi_a,&mi_q );
 
           EnterCriticalSection( &rd->csWrite );
 
-          writeModsSend( mi_a,mi_q );
+          writeModsSend( mi_a,mi_q,modGen );
 
           writeSamplingData();
 
@@ -4460,29 +5043,21 @@ DLLEXPORT int heob_control( int cmd )
 
         int mi_q = 0;
         modInfo *mi_a = NULL;
-        writeModsFind( &mi_a,&mi_q );
+        LONG modGen = writeModsFind( &mi_a,&mi_q );
 
         int i;
         EnterCriticalSection( &rd->csWrite );
         for( i=0; i<=SPLIT_MASK; i++ )
           EnterCriticalSection( &rd->splits[i].cs );
 
-        writeModsSend( mi_a,mi_q );
+        writeModsSend( mi_a,mi_q,modGen );
         writeLeakData();
+        clearRecordingRange();
 
         LeaveCriticalSection( &rd->csWrite );
 
         for( i=0; i<=SPLIT_MASK; i++ )
-        {
-          int j;
-          splitAllocation *sa = rd->splits + i;
-          int alloc_q = sa->alloc_q;
-          allocation *alloc_a = sa->alloc_a;
-          for( j=0; j<alloc_q; j++ )
-            alloc_a[j].recording = 0;
-
           LeaveCriticalSection( &rd->splits[i].cs );
-        }
       }
       break;
       // }}}
@@ -4505,13 +5080,15 @@ DLLEXPORT int heob_control( int cmd )
         for( i=0; i<=SPLIT_MASK; i++ )
         {
           EnterCriticalSection( &rd->splits[i].cs );
+          EnterCriticalSection( &rd->csAllocId );
 
           splitAllocation *sa = rd->splits + i;
           int alloc_q = sa->alloc_q;
           allocation *alloc_a = sa->alloc_a;
           for( j=0; j<alloc_q; j++ )
-            if( alloc_a[j].recording ) count++;
+            if( isRecorded(alloc_a+j) ) count++;
 
+          LeaveCriticalSection( &rd->csAllocId );
           LeaveCriticalSection( &rd->splits[i].cs );
         }
         return( count );
@@ -4984,6 +5561,21 @@ VOID CALLBACK heob( ULONG_PTR arg )
   if( rd->opt.protectFree )
     ld->freeds = HeapAlloc( heap,HEAP_ZERO_MEMORY,
         (SPLIT_MASK+1)*sizeof(splitFreed) );
+  if( (rd->opt.allocProfile || rd->opt.shortLifetime>0 ||
+        rd->opt.heapTimeline>0) && ld->splits )
+    ld->profiles = HeapAlloc( heap,HEAP_ZERO_MEMORY,
+        (PROFILE_SPLIT_MASK+1)*sizeof(splitProfile) );
+  ld->allocTimestamps = ld->profiles ||
+    rd->opt.groupLeaks==4 || rd->opt.leakAfter>0;
+  LARGE_INTEGER freq;
+  if( QueryPerformanceFrequency(&freq) )
+  {
+    if( ld->profiles && rd->opt.shortLifetime>0 )
+      ld->shortLifetimeFreq = (UINT64)rd->opt.shortLifetime*freq.QuadPart;
+    if( rd->opt.leakAfter>0 )
+      ld->leakAfterCounter =
+        rd->startCounter + (UINT64)rd->opt.leakAfter*freq.QuadPart;
+  }
 
   // initialize critical sections {{{
   func_InitializeCriticalSectionEx *fInitCritSecEx =
@@ -5005,10 +5597,18 @@ VOID CALLBACK heob( ULONG_PTR arg )
           fInitCritSecEx( &ld->freeds[i].cs,
               4000,CRITICAL_SECTION_NO_DEBUG_INFO );
       }
+      if( ld->profiles )
+      {
+        for( i=0; i<=PROFILE_SPLIT_MASK; i++ )
+          fInitCritSecEx( &ld->profiles[i].cs,
+              4000,CRITICAL_SECTION_NO_DEBUG_INFO );
+      }
     }
 #ifndef NO_THREADS
     fInitCritSecEx( &ld->csThreadNum,4000,CRITICAL_SECTION_NO_DEBUG_INFO );
 #endif
+    fInitCritSecEx( &ld->csTimeline,4000,CRITICAL_SECTION_NO_DEBUG_INFO );
+    fInitCritSecEx( &ld->csErrorRepeat,4000,CRITICAL_SECTION_NO_DEBUG_INFO );
   }
   else
   {
@@ -5025,10 +5625,17 @@ VOID CALLBACK heob( ULONG_PTR arg )
         if( rd->opt.protectFree )
           InitializeCriticalSection( &ld->freeds[i].cs );
       }
+      if( ld->profiles )
+      {
+        for( i=0; i<=PROFILE_SPLIT_MASK; i++ )
+          InitializeCriticalSection( &ld->profiles[i].cs );
+      }
     }
 #ifndef NO_THREADS
     InitializeCriticalSection( &ld->csThreadNum );
 #endif
+    InitializeCriticalSection( &ld->csTimeline );
+    InitializeCriticalSection( &ld->csErrorRepeat );
   }
   // }}}
 
@@ -5128,6 +5735,18 @@ VOID CALLBACK heob( ULONG_PTR arg )
   }
   // }}}
 
+  // invalidate the cached module list for any (un)loaded module,
+  // not just the ones loaded with the replaced LoadLibrary functions
+  typedef LONG NTAPI func_LdrRegisterDllNotification(
+      ULONG,void*,PVOID,PVOID* );
+  func_LdrRegisterDllNotification *fLdrRegisterDllNotification = ntdll ?
+    rd->fGetProcAddress( ntdll,"LdrRegisterDllNotification" ) : NULL;
+  ld->modGeneration = 1;
+  if( fLdrRegisterDllNotification &&
+      fLdrRegisterDllNotification(0,&dllNotification,NULL,
+        &ld->modNotifyCookie)<0 )
+    ld->modNotifyCookie = NULL;
+
   HMODULE appMod = GetModuleHandle( NULL );
   if( appMod==rd->heobMod && ld->opt.children )
     ld->opt.children = -1;
@@ -5302,6 +5921,13 @@ VOID CALLBACK heob( ULONG_PTR arg )
     CloseHandle( thread );
   }
 
+  if( ld->profiles && ld->opt.heapTimeline>0 )
+  {
+    HANDLE thread = CreateThread( NULL,0,&heapTimelineThread,
+        (LPVOID)(uintptr_t)ld->opt.heapTimeline,0,NULL );
+    CloseHandle( thread );
+  }
+
   // setup loaded heob executable as dll with proper DllMain() {{{
   if( !ld->noCRT
 #if USE_STACKWALK
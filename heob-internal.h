@@ -64,12 +64,14 @@
 #ifndef _WIN64
 #define IL_INT LONG
 #define IL_INC(var) InterlockedIncrement(var)
+#define IL_ADD(var,val) InterlockedExchangeAdd(var,val)
 #define READ_TEB_PTR(o) __readfsdword(o)
 #define READ_TEB_DWORD(o) __readfsdword(o)
 #define WRITE_TEB_DWORD(o,v) __writefsdword(o,v)
 #else
 #define IL_INT LONGLONG
 #define IL_INC(var) InterlockedIncrement64(var)
+#define IL_ADD(var,val) InterlockedExchangeAdd64(var,val)
 #ifndef __aarch64__
 #define READ_TEB_PTR(o) __readgsqword(o)
 #define READ_TEB_DWORD(o) __readgsdword(o)
@@ -240,6 +242,7 @@ typedef BOOL WINAPI func_SymGetModuleInfo64(
     HANDLE,DWORD64,PIMAGEHLP_MODULE64 );
 typedef DWORD64 WINAPI func_SymLoadModule64(
     HANDLE,HANDLE,PCSTR,PCSTR,DWORD64,DWORD );
+typedef BOOL WINAPI func_SymUnloadModule64( HANDLE,DWORD64 );
 typedef DWORD64 WINAPI func_SymLoadModuleExW(
     HANDLE,HANDLE,PCWSTR,PCWSTR,DWORD64,DWORD,PMODLOAD_DATA,DWORD );
 typedef DWORD WINAPI func_UnDecorateSymbolName( PCSTR,PSTR,DWORD,DWORD );
@@ -518,9 +521,8 @@ typedef struct
   union {
     struct {
       allocType at : 4;
-      unsigned recording : 1;
       unsigned raiseFree : 1;
-      unsigned unusedBits : 2;
+      unsigned unusedBits : 3;
       leakType lt : 8;
       funcType ft : 8;
       funcType ftFreed : 8;
@@ -533,9 +535,52 @@ typedef struct
 #ifndef NO_THREADS
   int threadNum;
 #endif
+  // performance counter at allocation time,
+  // only set for -g4, -j or the allocation profiler
+  // (together with profileIdx small compared to the frames)
+  UINT64 timestamp;
+  // only used by the allocation profiler
+  int profileIdx;
 }
 allocation;
 
+#define LIFETIME_BUCKETS 48
+
+typedef struct
+{
+  void *frames[PTRS];
+  funcType ft;
+  unsigned hash;
+  int next;
+  size_t allocCount;
+  size_t allocSum;
+  size_t freeCount;
+  size_t freeSum;
+  size_t liveSum;
+  size_t peakSum;
+  // freed within the short-lived allocation lifetime
+  size_t shortCount;
+  size_t shortSum;
+  size_t shortSameThread;
+  // live at the peak of the heap timeline
+  size_t heapPeakSum;
+  size_t heapPeakCount;
+  // log2 of the lifetime in performance counter ticks
+  size_t lifetimes[LIFETIME_BUCKETS];
+}
+allocProfile;
+
+typedef struct
+{
+  // offending access, and the allocation it refers to
+  allocation aa[2];
+  unsigned hash;
+  int next;
+  int type;
+  int count;
+}
+errorRepeat;
+
 typedef struct
 {
   int protect;
@@ -569,6 +614,13 @@ typedef struct
 #endif
   int forwardStartupInfo;
   int disableParallelLoading;
+  int allocProfile;
+  int shortLifetime;
+  int heapTimeline;
+  int leakAfter;
+  int topGroups;
+  int svgMinWidth;
+  int errorLimit;
 }
 options;
 
@@ -627,6 +679,7 @@ typedef struct remoteData
   options globalopt;
   wchar_t *specificOptions;
   DWORD appCounterID;
+  UINT64 startCounter;
 
   int recording;
   int *recordingRemote;
@@ -671,6 +724,8 @@ enum
   WRITE_EXIT_TRACE,
   WRITE_EXIT,
   WRITE_RECORDING,
+  WRITE_ALLOC_PROFILE,
+  WRITE_HEAP_TIMELINE,
 #if USE_STACKWALK
   WRITE_SAMPLING,
   WRITE_ADD_SAMPLING_THREAD,
@@ -680,6 +735,7 @@ enum
   WRITE_CRASHDUMP,
 #endif
   WRITE_REFERENCE,
+  WRITE_ERROR_REPEATS,
 };
 
 typedef struct
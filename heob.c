@@ -38,6 +38,7 @@ typedef enum
 textColorAtt;
 
 struct textColor;
+struct gzipStream;
 typedef void func_WriteText( struct textColor*,const char*,size_t );
 typedef void func_WriteTextW( struct textColor*,const wchar_t*,size_t );
 typedef void func_TextColor( struct textColor*,textColorAtt );
@@ -55,9 +56,16 @@ typedef struct textColor
     const char *styles[ATT_COUNT];
   };
   textColorAtt color;
+  // output buffer for disk files, written with flushText()
+  char *buf;
+  size_t buf_q;
+  // compressed output of .gz files
+  struct gzipStream *gz;
 }
 textColor;
 
+#define TEXT_BUFFER_SIZE 0x40000
+
 // }}}
 // CRT replacements {{{
 
@@ -709,15 +717,496 @@ static inline DWORD div64( DWORD lowPart,DWORD highPart,DWORD divisor )
   return( li.LowPart );
 }
 
+// }}}
+// gzip compression {{{
+
+// deflate with only fixed huffman codes and greedy matching,
+// the (very repetitive) output is compressed well enough by LZ77 alone
+#define GZIP_WSIZE 0x8000
+#define GZIP_HASH_SIZE 0x8000
+#define GZIP_MIN_MATCH 3
+#define GZIP_MAX_MATCH 258
+#define GZIP_MAX_CHAIN 64
+#define GZIP_OUT_SIZE 0x10000
+#define GZIP_HASH( p ) \
+  ( ((p)[0]<<10 ^ (p)[1]<<5 ^ (p)[2])&(GZIP_HASH_SIZE-1) )
+
+typedef struct gzipStream
+{
+  HANDLE out;
+  int started;
+
+  // GZIP_WSIZE bytes of history, followed by the not yet compressed input
+  unsigned char *win;
+  int win_pos;
+  int win_end;
+
+  // most recent position of each hash value, and the previous position
+  // with the same hash value for each position, -1 if none
+  int *head;
+  int *prev;
+
+  uint32_t crc;
+  uint32_t size;
+  uint32_t crc_a[256];
+
+  // bit-reversed fixed huffman codes
+  uint16_t lit_a[288];
+  unsigned char litBits_a[288];
+
+  uint32_t bits;
+  int bit_q;
+  unsigned char *out_a;
+  int out_q;
+}
+gzipStream;
+
+static void gzipFree( gzipStream *gz )
+{
+  if( !gz ) return;
+
+  HANDLE heap = GetProcessHeap();
+  if( gz->win ) HeapFree( heap,0,gz->win );
+  if( gz->head ) HeapFree( heap,0,gz->head );
+  if( gz->prev ) HeapFree( heap,0,gz->prev );
+  if( gz->out_a ) HeapFree( heap,0,gz->out_a );
+  HeapFree( heap,0,gz );
+}
+
+static gzipStream *gzipInit( HANDLE out )
+{
+  HANDLE heap = GetProcessHeap();
+  gzipStream *gz = HeapAlloc( heap,HEAP_ZERO_MEMORY,sizeof(gzipStream) );
+  if( !gz ) return( NULL );
+
+  gz->out = out;
+  gz->win = HeapAlloc( heap,0,2*GZIP_WSIZE );
+  gz->head = HeapAlloc( heap,0,GZIP_HASH_SIZE*sizeof(int) );
+  gz->prev = HeapAlloc( heap,0,GZIP_WSIZE*sizeof(int) );
+  gz->out_a = HeapAlloc( heap,0,GZIP_OUT_SIZE );
+  if( !gz->win || !gz->head || !gz->prev || !gz->out_a )
+  {
+    gzipFree( gz );
+    return( NULL );
+  }
+
+  uint32_t i;
+  for( i=0; i<256; i++ )
+  {
+    uint32_t c = i;
+    int k;
+    for( k=0; k<8; k++ )
+      c = c&1 ? 0xedb88320 ^ (c>>1) : c>>1;
+    gz->crc_a[i] = c;
+  }
+
+  for( i=0; i<288; i++ )
+  {
+    uint32_t code,bits;
+    if( i<144 )
+      code = 0x30 + i, bits = 8;
+    else if( i<256 )
+      code = 0x190 + ( i-144 ), bits = 9;
+    else if( i<280 )
+      code = i - 256, bits = 7;
+    else
+      code = 0xc0 + ( i-280 ), bits = 8;
+    uint32_t rev = 0;
+    uint32_t b;
+    for( b=0; b<bits; b++ )
+      rev |= ( (code>>b)&1 )<<( bits-1-b );
+    gz->lit_a[i] = rev;
+    gz->litBits_a[i] = bits;
+  }
+
+  return( gz );
+}
+
+static void gzipFlushOut( gzipStream *gz )
+{
+  if( !gz->out_q ) return;
+
+  DWORD written;
+  WriteFile( gz->out,gz->out_a,gz->out_q,&written,NULL );
+  gz->out_q = 0;
+}
+
+static inline void gzipBits( gzipStream *gz,uint32_t v,int count )
+{
+  gz->bits |= v<<gz->bit_q;
+  gz->bit_q += count;
+  while( gz->bit_q>=8 )
+  {
+    gz->out_a[gz->out_q++] = gz->bits;
+    gz->bits >>= 8;
+    gz->bit_q -= 8;
+  }
+}
+
+static inline void gzipLit( gzipStream *gz,int v )
+{
+  gzipBits( gz,gz->lit_a[v],gz->litBits_a[v] );
+}
+
+static void gzipMatch( gzipStream *gz,int len,int dist )
+{
+  static const uint16_t lenBase[29] = {
+    3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,
+    35,43,51,59,67,83,99,115,131,163,195,227,258 };
+  static const unsigned char lenExtra[29] = {
+    0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0 };
+  static const uint16_t distBase[30] = {
+    1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,
+    257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577 };
+  static const unsigned char distExtra[30] = {
+    0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+
+  int l = 0,r = 28;
+  while( l<r )
+  {
+    int m = ( l+r+1 )/2;
+    if( lenBase[m]<=len ) l = m;
+    else r = m - 1;
+  }
+  gzipLit( gz,257+l );
+  if( lenExtra[l] )
+    gzipBits( gz,len-lenBase[l],lenExtra[l] );
+
+  int d = 0;
+  r = 29;
+  while( d<r )
+  {
+    int m = ( d+r+1 )/2;
+    if( distBase[m]<=dist ) d = m;
+    else r = m - 1;
+  }
+  // the 5 bit distance codes, bit-reversed
+  uint32_t rev = ( (d&1)<<4 ) | ( (d&2)<<2 ) | ( d&4 ) |
+    ( (d&8)>>2 ) | ( (d&16)>>4 );
+  gzipBits( gz,rev,5 );
+  if( distExtra[d] )
+    gzipBits( gz,dist-distBase[d],distExtra[d] );
+}
+
+static void gzipStart( gzipStream *gz )
+{
+  static const unsigned char header[10] = {
+    0x1f,0x8b,8,0,0,0,0,0,0,11 };
+  RtlMoveMemory( gz->out_a+gz->out_q,header,sizeof(header) );
+  gz->out_q += sizeof(header);
+
+  // not final block with fixed huffman codes
+  gzipBits( gz,2,3 );
+
+  gz->crc = 0xffffffff;
+  gz->size = 0;
+  gz->win_pos = gz->win_end = 0;
+  int i;
+  for( i=0; i<GZIP_HASH_SIZE; i++ )
+    gz->head[i] = -1;
+  gz->started = 1;
+}
+
+static void gzipCompress( gzipStream *gz,int flush )
+{
+  unsigned char *win = gz->win;
+  int *head = gz->head;
+  int *prev = gz->prev;
+  int pos = gz->win_pos;
+  int end = gz->win_end;
+  while( pos<end )
+  {
+    int avail = end - pos;
+    // keep enough data for the longest match
+    if( avail<GZIP_MAX_MATCH && !flush ) break;
+
+    if( gz->out_q>GZIP_OUT_SIZE-16 ) gzipFlushOut( gz );
+
+    int bestLen = 0;
+    int bestDist = 0;
+    if( avail>=GZIP_MIN_MATCH )
+    {
+      int maxLen = avail<GZIP_MAX_MATCH ? avail : GZIP_MAX_MATCH;
+      int h = GZIP_HASH( win+pos );
+      int cand = head[h];
+      prev[pos&(GZIP_WSIZE-1)] = cand;
+      head[h] = pos;
+
+      int chain = GZIP_MAX_CHAIN;
+      while( cand>=0 && pos-cand<GZIP_WSIZE && chain-- )
+      {
+        if( win[cand+bestLen]==win[pos+bestLen] )
+        {
+          int len = 0;
+          while( len<maxLen && win[cand+len]==win[pos+len] ) len++;
+          if( len>bestLen )
+          {
+            bestLen = len;
+            bestDist = pos - cand;
+            if( len==maxLen ) break;
+          }
+        }
+        int next = prev[cand&(GZIP_WSIZE-1)];
+        if( next>=cand ) break;
+        cand = next;
+      }
+    }
+
+    if( bestLen>=GZIP_MIN_MATCH )
+    {
+      gzipMatch( gz,bestLen,bestDist );
+
+      int i;
+      for( i=1; i<bestLen && end-(pos+i)>=GZIP_MIN_MATCH; i++ )
+      {
+        int h = GZIP_HASH( win+pos+i );
+        prev[(pos+i)&(GZIP_WSIZE-1)] = head[h];
+        head[h] = pos + i;
+      }
+      pos += bestLen;
+    }
+    else
+      gzipLit( gz,win[pos++] );
+  }
+  gz->win_pos = pos;
+}
+
+static void gzipSlide( gzipStream *gz )
+{
+  RtlMoveMemory( gz->win,gz->win+GZIP_WSIZE,GZIP_WSIZE );
+  gz->win_pos -= GZIP_WSIZE;
+  gz->win_end -= GZIP_WSIZE;
+
+  int i;
+  for( i=0; i<GZIP_HASH_SIZE; i++ )
+  {
+    int v = gz->head[i] - GZIP_WSIZE;
+    gz->head[i] = v<0 ? -1 : v;
+  }
+  for( i=0; i<GZIP_WSIZE; i++ )
+  {
+    int v = gz->prev[i] - GZIP_WSIZE;
+    gz->prev[i] = v<0 ? -1 : v;
+  }
+}
+
+static void gzipWrite( gzipStream *gz,const void *data,size_t l )
+{
+  if( !gz->started ) gzipStart( gz );
+
+  const unsigned char *d = data;
+  uint32_t crc = gz->crc;
+  size_t i;
+  for( i=0; i<l; i++ )
+    crc = gz->crc_a[(crc^d[i])&0xff] ^ ( crc>>8 );
+  gz->crc = crc;
+  gz->size += (uint32_t)l;
+
+  while( l )
+  {
+    if( gz->win_end==2*GZIP_WSIZE )
+    {
+      gzipCompress( gz,0 );
+      gzipSlide( gz );
+    }
+
+    size_t n = 2*GZIP_WSIZE - gz->win_end;
+    if( n>l ) n = l;
+    RtlMoveMemory( gz->win+gz->win_end,d,n );
+    gz->win_end += (int)n;
+    d += n;
+    l -= n;
+  }
+}
+
+// ends the current gzip member, further data starts a new one
+static void gzipEnd( gzipStream *gz )
+{
+  if( !gz->started ) gzipStart( gz );
+
+  gzipCompress( gz,1 );
+
+  if( gz->out_q>GZIP_OUT_SIZE-32 ) gzipFlushOut( gz );
+
+  // end of block, and an empty final block
+  gzipLit( gz,256 );
+  gzipBits( gz,3,3 );
+  gzipLit( gz,256 );
+  if( gz->bit_q )
+    gzipBits( gz,0,8-gz->bit_q );
+
+  gzipBits( gz,~gz->crc&0xffff,16 );
+  gzipBits( gz,~gz->crc>>16,16 );
+  gzipBits( gz,gz->size&0xffff,16 );
+  gzipBits( gz,gz->size>>16,16 );
+  gzipFlushOut( gz );
+
+  gz->started = 0;
+}
+
+// }}}
+// protobuf encoding {{{
+
+// a message is built in the buffer, nested messages and packed fields
+// get their length inserted when they are complete
+typedef struct
+{
+  unsigned char *buf;
+  size_t q;
+  size_t s;
+  int failed;
+}
+pbBuffer;
+
+static int pbReserve( pbBuffer *pb,size_t l )
+{
+  if( pb->q+l<=pb->s ) return( 1 );
+
+  size_t s = pb->s ? pb->s*2 : 4096;
+  while( s<pb->q+l ) s *= 2;
+  HANDLE heap = GetProcessHeap();
+  unsigned char *buf = pb->buf ?
+    HeapReAlloc( heap,0,pb->buf,s ) : HeapAlloc( heap,0,s );
+  if( !buf )
+  {
+    pb->failed = 1;
+    return( 0 );
+  }
+  pb->buf = buf;
+  pb->s = s;
+  return( 1 );
+}
+
+static void pbFree( pbBuffer *pb )
+{
+  if( pb->buf ) HeapFree( GetProcessHeap(),0,pb->buf );
+  RtlZeroMemory( pb,sizeof(pbBuffer) );
+}
+
+static int pbEncodeVarint( unsigned char *p,UINT64 v )
+{
+  int l = 0;
+  while( v>=0x80 )
+  {
+    p[l++] = (unsigned char)( v|0x80 );
+    v >>= 7;
+  }
+  p[l++] = (unsigned char)v;
+  return( l );
+}
+
+static void pbVarint( pbBuffer *pb,UINT64 v )
+{
+  if( !pbReserve(pb,10) ) return;
+  pb->q += pbEncodeVarint( pb->buf+pb->q,v );
+}
+
+// wire type 0 = varint, 2 = length-delimited
+static void pbTag( pbBuffer *pb,int field,int wireType )
+{
+  pbVarint( pb,(UINT64)(field<<3|wireType) );
+}
+
+// zero is the default, and not written
+static void pbUint( pbBuffer *pb,int field,UINT64 v )
+{
+  if( !v ) return;
+  pbTag( pb,field,0 );
+  pbVarint( pb,v );
+}
+
+static size_t pbBegin( pbBuffer *pb,int field )
+{
+  pbTag( pb,field,2 );
+  return( pb->q );
+}
+
+static void pbEnd( pbBuffer *pb,size_t start )
+{
+  if( pb->failed ) return;
+
+  unsigned char len_a[10];
+  size_t l = pb->q - start;
+  int len_q = pbEncodeVarint( len_a,l );
+  if( !pbReserve(pb,len_q) ) return;
+  unsigned char *p = pb->buf + start;
+  RtlMoveMemory( p+len_q,p,l );
+  RtlMoveMemory( p,len_a,len_q );
+  pb->q += len_q;
+}
+
 // }}}
 // output variants {{{
 
-static void WriteText( textColor *tc,const char *t,size_t l )
+static void writeRaw( textColor *tc,const void *t,size_t l )
 {
+  if( tc->gz )
+  {
+    gzipWrite( tc->gz,t,l );
+    return;
+  }
+
   DWORD written;
   WriteFile( tc->out,t,(DWORD)l,&written,NULL );
 }
 
+static void flushText( textColor *tc )
+{
+  if( !tc || !tc->buf_q ) return;
+
+  writeRaw( tc,tc->buf,tc->buf_q );
+  tc->buf_q = 0;
+}
+
+// also finishes the compressed stream
+static void freeTextBuffer( textColor *tc )
+{
+  if( !tc ) return;
+
+  if( tc->buf )
+  {
+    flushText( tc );
+    HeapFree( GetProcessHeap(),0,tc->buf );
+    tc->buf = NULL;
+  }
+
+  if( tc->gz )
+  {
+    gzipEnd( tc->gz );
+    // remove what's left of a longer temporary footer
+    SetEndOfFile( tc->out );
+    gzipFree( tc->gz );
+    tc->gz = NULL;
+  }
+}
+
+static void writeOut( textColor *tc,const void *t,size_t l )
+{
+  if( tc->buf )
+  {
+    if( tc->buf_q+l<=TEXT_BUFFER_SIZE )
+    {
+      RtlMoveMemory( tc->buf+tc->buf_q,t,l );
+      tc->buf_q += l;
+      return;
+    }
+    flushText( tc );
+    if( l<TEXT_BUFFER_SIZE )
+    {
+      RtlMoveMemory( tc->buf,t,l );
+      tc->buf_q = l;
+      return;
+    }
+  }
+
+  writeRaw( tc,t,l );
+}
+
+static void WriteText( textColor *tc,const char *t,size_t l )
+{
+  writeOut( tc,t,l );
+}
+
 static int UTF16toUTF32( const uint16_t *u16,size_t l,uint32_t *c32 )
 {
   uint16_t c16_1 = u16[0];
@@ -747,7 +1236,8 @@ static void WriteTextW( textColor *tc,const wchar_t *t,size_t l )
 {
   const uint16_t *u16 = t;
   uint32_t c32;
-  DWORD written;
+  uint8_t c8_a[256];
+  int c8_q = 0;
   size_t i;
   for( i=0; i<l; i++ )
   {
@@ -757,10 +1247,17 @@ static void WriteTextW( textColor *tc,const wchar_t *t,size_t l )
     uint8_t c8 = c32;
     if( c32>=0x80 )
       c8 = '?';
-    WriteFile( tc->out,&c8,1,&written,NULL );
+    c8_a[c8_q++] = c8;
+    if( c8_q==sizeof(c8_a) )
+    {
+      writeOut( tc,c8_a,c8_q );
+      c8_q = 0;
+    }
 
     if( chars>1 ) i++;
   }
+  if( c8_q )
+    writeOut( tc,c8_a,c8_q );
 }
 
 static void WriteTextConsoleW( textColor *tc,const wchar_t *t,size_t l )
@@ -785,113 +1282,219 @@ static void TextColorTerminal( textColor *tc,textColorAtt color )
   int c = tc->colors[color];
   char text[] = { 27,'[',(c/10000)%10+'0',(c/1000)%10+'0',(c/100)%10+'0',';',
     (c/10)%10+'0',c%10+'0','m' };
-  DWORD written;
-  WriteFile( tc->out,text,sizeof(text),&written,NULL );
+  writeOut( tc,text,sizeof(text) );
 
   tc->color = color;
 }
 
+static inline int htmlEscapeChar( uint32_t c )
+{
+  return( c<0x09 || (c>=0x0b && c<=0x0c) || (c>=0x0e && c<=0x1f) ||
+      c>=0x7f || c=='<' || c=='>' || c=='&' || c=='"' );
+}
+
+#if !defined(_MSC_VER) || defined(__clang__)
+typedef size_t __attribute__((may_alias)) size_t_a;
+#else
+typedef size_t size_t_a;
+#endif
+#define BYTES_1 ( (size_t)-1/0xff )
+#define BYTES_80 ( BYTES_1*0x80 )
+#define HAS_ZERO_BYTE( v ) ( ((v)-BYTES_1) & ~(v) & BYTES_80 )
+
+// may find some bytes which don't need escaping (tab, newline),
+// but never misses one which does
+static inline size_t htmlEscapeWord( size_t v )
+{
+  return( ((v-BYTES_1*0x20)&~v&BYTES_80) | (v&BYTES_80) |
+      HAS_ZERO_BYTE(v^(BYTES_1*0x7f)) |
+      HAS_ZERO_BYTE(v^(BYTES_1*'<')) | HAS_ZERO_BYTE(v^(BYTES_1*'>')) |
+      HAS_ZERO_BYTE(v^(BYTES_1*'&')) | HAS_ZERO_BYTE(v^(BYTES_1*'"')) );
+}
+
+// find the next byte which needs escaping, a word at a time
+static const unsigned char *htmlEscapeFind(
+    const unsigned char *t,const unsigned char *end )
+{
+  for( ; t<end && ((uintptr_t)t&(sizeof(size_t)-1)); t++ )
+    if( htmlEscapeChar(t[0]) ) return( t );
+
+  while( t<end )
+  {
+    while( (size_t)(end-t)>=sizeof(size_t) &&
+        !htmlEscapeWord(*(const size_t_a*)t) )
+      t += sizeof(size_t);
+
+    const unsigned char *wordEnd =
+      (size_t)(end-t)>=sizeof(size_t) ? t+sizeof(size_t) : end;
+    for( ; t<wordEnd; t++ )
+      if( htmlEscapeChar(t[0]) ) return( t );
+  }
+
+  return( end );
+}
+
 static void WriteTextHtml( textColor *tc,const char *ts,size_t l )
 {
   const unsigned char *t = (const unsigned char*)ts;
   const unsigned char *end = t + l;
-  const unsigned char *next;
   char lt[] = "&lt;";
   char gt[] = "&gt;";
   char amp[] = "&amp;";
   char quot[] = "&quot;";
-  DWORD written;
-  for( next=t; next<end; next++ )
+  while( t<end )
   {
-    unsigned char c = next[0];
-    if( c<0x09 || (c>=0x0b && c<=0x0c) || (c>=0x0e && c<=0x1f) || c>=0x7f )
-    {
-      if( next>t )
-        WriteFile( tc->out,t,(DWORD)(next-t),&written,NULL );
-      char hex[] = "&#x00;";
-      num2hexstr( hex+3,c,2 );
-      WriteFile( tc->out,hex,sizeof(hex)-1,&written,NULL );
-      t = next + 1;
-      continue;
-    }
-    if( c!='<' && c!='>' && c!='&' && c!='"' ) continue;
-
+    const unsigned char *next = htmlEscapeFind( t,end );
     if( next>t )
-      WriteFile( tc->out,t,(DWORD)(next-t),&written,NULL );
+      writeOut( tc,t,next-t );
+    if( next==end ) break;
+
+    unsigned char c = next[0];
     if( c=='<' )
-      WriteFile( tc->out,lt,sizeof(lt)-1,&written,NULL );
+      writeOut( tc,lt,sizeof(lt)-1 );
     else if( c=='>' )
-      WriteFile( tc->out,gt,sizeof(gt)-1,&written,NULL );
+      writeOut( tc,gt,sizeof(gt)-1 );
     else if( c=='&' )
-      WriteFile( tc->out,amp,sizeof(amp)-1,&written,NULL );
+      writeOut( tc,amp,sizeof(amp)-1 );
+    else if( c=='"' )
+      writeOut( tc,quot,sizeof(quot)-1 );
     else
-      WriteFile( tc->out,quot,sizeof(quot)-1,&written,NULL );
+    {
+      char hex[] = "&#x00;";
+      num2hexstr( hex+3,c,2 );
+      writeOut( tc,hex,sizeof(hex)-1 );
+    }
     t = next + 1;
   }
-  if( next>t )
-    WriteFile( tc->out,t,(DWORD)(next-t),&written,NULL );
 }
 
 static void WriteTextHtmlW( textColor *tc,const wchar_t *ts,size_t l )
 {
   const uint16_t *u16 = ts;
   uint32_t c32;
-  char lt[] = "&lt;";
-  char gt[] = "&gt;";
-  char amp[] = "&amp;";
-  char quot[] = "&quot;";
-  DWORD written;
+  // converted in chunks, the longest escape sequence has 10 characters
+  char c8_a[512];
+  int c8_q = 0;
   size_t i;
   for( i=0; i<l; i++ )
   {
-    int chars = UTF16toUTF32( u16+i,l-i,&c32 );
-    if( !chars ) continue;
+    if( c8_q>(int)sizeof(c8_a)-10 )
+    {
+      writeOut( tc,c8_a,c8_q );
+      c8_q = 0;
+    }
 
-    if( c32<0x09 || (c32>=0x0b && c32<=0x0c) ||
-        (c32>=0x0e && c32<=0x1f) || c32>=0x7f )
+    c32 = u16[i];
+    if( !htmlEscapeChar(c32) )
     {
-      char hex[] = "&#x000000;";
-      int bytes = c32>=0x10000 ? 3 : ( c32>=0x100 ? 2 : 1 );
-      char *end = num2hexstr( hex+3,c32,bytes*2 );
-      end++[0] = ';';
-      WriteFile( tc->out,hex,(DWORD)(end-hex),&written,NULL );
+      c8_a[c8_q++] = c32;
+      continue;
     }
-    else if( c32=='<' )
-      WriteFile( tc->out,lt,sizeof(lt)-1,&written,NULL );
+
+    int chars = UTF16toUTF32( u16+i,l-i,&c32 );
+    if( !chars ) continue;
+
+    const char *esc = NULL;
+    if( c32=='<' )
+      esc = "&lt;";
     else if( c32=='>' )
-      WriteFile( tc->out,gt,sizeof(gt)-1,&written,NULL );
+      esc = "&gt;";
     else if( c32=='&' )
-      WriteFile( tc->out,amp,sizeof(amp)-1,&written,NULL );
+      esc = "&amp;";
     else if( c32=='"' )
-      WriteFile( tc->out,quot,sizeof(quot)-1,&written,NULL );
+      esc = "&quot;";
+    if( esc )
+    {
+      while( *esc ) c8_a[c8_q++] = *esc++;
+    }
     else
     {
-      uint8_t c8 = c32;
-      WriteFile( tc->out,&c8,1,&written,NULL );
+      int bytes = c32>=0x10000 ? 3 : ( c32>=0x100 ? 2 : 1 );
+      char *end = c8_a + c8_q;
+      end++[0] = '&';
+      end++[0] = '#';
+      end++[0] = 'x';
+      end = num2hexstr( end,c32,bytes*2 );
+      end++[0] = ';';
+      c8_q = (int)( end - c8_a );
     }
 
     if( chars>1 ) i++;
   }
+  if( c8_q )
+    writeOut( tc,c8_a,c8_q );
 }
 
-static void TextColorHtml( textColor *tc,textColorAtt color )
+// json strings, everything outside of printable ascii is escaped
+static void WriteTextJsonW( textColor *tc,const wchar_t *ts,size_t l )
 {
-  if( tc->color==color ) return;
-
-  DWORD written;
-  if( tc->color )
-  {
-    const char *spanEnd = "</span>";
-    WriteFile( tc->out,spanEnd,lstrlen(spanEnd),&written,NULL );
-  }
-  if( color )
+  const uint16_t *u16 = ts;
+  char c8_a[512];
+  int c8_q = 0;
+  size_t i;
+  for( i=0; i<l; i++ )
   {
-    const char *span1 = "<span class=\"";
+    if( c8_q>(int)sizeof(c8_a)-6 )
+    {
+      writeOut( tc,c8_a,c8_q );
+      c8_q = 0;
+    }
+
+    uint16_t c = u16[i];
+    if( c>=0x20 && c<0x7f && c!='"' && c!='\\' )
+      c8_a[c8_q++] = (char)c;
+    else if( c=='"' || c=='\\' )
+    {
+      c8_a[c8_q++] = '\\';
+      c8_a[c8_q++] = (char)c;
+    }
+    else
+    {
+      // surrogate pairs stay valid as 2 escaped code units
+      char *end = c8_a + c8_q;
+      end++[0] = '\\';
+      end++[0] = 'u';
+      end = num2hexstr( end,c,4 );
+      c8_q = (int)( end - c8_a );
+    }
+  }
+  if( c8_q )
+    writeOut( tc,c8_a,c8_q );
+}
+
+static void WriteTextJson( textColor *tc,const char *ts,size_t l )
+{
+  const unsigned char *t = (const unsigned char*)ts;
+  wchar_t w_a[256];
+  while( l )
+  {
+    size_t w_q = l<256 ? l : 256;
+    size_t i;
+    for( i=0; i<w_q; i++ )
+      w_a[i] = t[i];
+    WriteTextJsonW( tc,w_a,w_q );
+    t += w_q;
+    l -= w_q;
+  }
+}
+
+static void TextColorHtml( textColor *tc,textColorAtt color )
+{
+  if( tc->color==color ) return;
+
+  if( tc->color )
+  {
+    const char *spanEnd = "</span>";
+    writeOut( tc,spanEnd,lstrlen(spanEnd) );
+  }
+  if( color )
+  {
+    const char *span1 = "<span class=\"";
     const char *style = tc->styles[color];
     const char *span2 = "\">";
-    WriteFile( tc->out,span1,lstrlen(span1),&written,NULL );
-    WriteFile( tc->out,style,lstrlen(style),&written,NULL );
-    WriteFile( tc->out,span2,lstrlen(span2),&written,NULL );
+    writeOut( tc,span1,lstrlen(span1) );
+    writeOut( tc,style,lstrlen(style) );
+    writeOut( tc,span2,lstrlen(span2) );
   }
 
   tc->color = color;
@@ -920,9 +1523,27 @@ static void writeHeobInfo( textColor *tc,const char *t )
       t,HEOB_VER );
 }
 
+// the lower case extension is compared with the name up to len
+static int hasExtension( const wchar_t *name,int len,const char *ext )
+{
+  int extLen = lstrlen( ext );
+  if( len<=extLen ) return( 0 );
+  name += len - extLen;
+  int i;
+  for( i=0; i<extLen; i++ )
+  {
+    wchar_t c = name[i];
+    if( c>='A' && c<='Z' ) c += 'a' - 'A';
+    if( c!=ext[i] ) return( 0 );
+  }
+  return( 1 );
+}
+
 static void checkOutputVariant( textColor *tc,HANDLE out,
     const wchar_t *exeName )
 {
+  freeTextBuffer( tc );
+
   // default
   tc->fWriteText = &WriteText;
   tc->fWriteSubText = &WriteText;
@@ -966,6 +1587,10 @@ static void checkOutputVariant( textColor *tc,HANDLE out,
   }
   // }}}
 
+  // disk files are only written in big blocks
+  if( GetFileType(tc->out)==FILE_TYPE_DISK )
+    tc->buf = HeapAlloc( GetProcessHeap(),0,TEXT_BUFFER_SIZE );
+
   func_NtQueryObject *fNtQueryObject =
     (func_NtQueryObject*)GetProcAddress( ntdll,"NtQueryObject" );
   if( fNtQueryObject )
@@ -987,6 +1612,14 @@ static void checkOutputVariant( textColor *tc,HANDLE out,
       size_t hl = sizeof(html)/2 - 1;
       wchar_t deviceNull[] = L"\\Device\\Null";
       size_t dnl = sizeof(deviceNull)/2 - 1;
+      size_t nameLen = oni->Name.Length/2;
+      if( GetFileType(tc->out)==FILE_TYPE_DISK &&
+          hasExtension(oni->Name.Buffer,(int)nameLen,".gz") &&
+          (tc->gz=gzipInit(tc->out)) )
+      {
+        // compressed file, the extension before .gz decides the format
+        nameLen -= 3;
+      }
       if( (size_t)oni->Name.Length/2>l1+l2 &&
           !memcmp(oni->Name.Buffer,namedPipe,l1*2) &&
           (!memcmp(oni->Name.Buffer+(oni->Name.Length/2-l2),toMaster,l2*2) ||
@@ -1001,9 +1634,8 @@ static void checkOutputVariant( textColor *tc,HANDLE out,
         // null device
         tc->out = NULL;
       }
-      else if( GetFileType(tc->out)==FILE_TYPE_DISK &&
-          (size_t)oni->Name.Length/2>hl &&
-          !memcmp(oni->Name.Buffer+(oni->Name.Length/2-hl),html,hl*2) )
+      else if( GetFileType(tc->out)==FILE_TYPE_DISK && nameLen>hl &&
+          !memcmp(oni->Name.Buffer+(nameLen-hl),html,hl*2) )
       {
         // html file {{{
         tc->fWriteSubText = &WriteTextHtml;
@@ -1237,6 +1869,17 @@ enum
   HEOB_CONTROL_ATTACH,
 };
 
+// selected by the file extension of the -v output
+typedef enum
+{
+  FLAME_SVG,
+  FLAME_FOLDED,
+  FLAME_SPEEDSCOPE,
+  FLAME_TRACE,
+  FLAME_PPROF,
+}
+flameFormat;
+
 // }}}
 // main data {{{
 
@@ -1278,6 +1921,7 @@ typedef struct appData
   wchar_t *xmlName;
   wchar_t *svgName;
   wchar_t *symPath;
+  wchar_t *symCacheName;
   wchar_t *specificOptions;
   modInfo *mi_a;
   int mi_q;
@@ -1299,6 +1943,14 @@ typedef struct appData
   unsigned *heobExitData;
   int *recordingRemote;
   size_t svgSum;
+  flameFormat svgFormat;
+  // profiles or trace events already written
+  int flameCount;
+  size_t *timeline_a;
+  int timeline_q;
+  int timelinePeak;
+  UINT64 startCounter;
+  DWORD counterFreq;
   int appCounter;
   DWORD appCounterID;
   HANDLE appCounterMapping;
@@ -1342,6 +1994,11 @@ static appData *initHeob( HANDLE heap )
   ad->heap = heap;
   ad->errorPipe = openErrorPipe( &ad->writeProcessPid );
   ad->startTicks = GetTickCount();
+  LARGE_INTEGER counter;
+  if( QueryPerformanceFrequency(&counter) && !counter.HighPart )
+    ad->counterFreq = counter.LowPart;
+  QueryPerformanceCounter( &counter );
+  ad->startCounter = counter.QuadPart;
 #if USE_STACKWALK
   HMODULE kernel32 = GetModuleHandle( "kernel32.dll" );
   func_InitializeCriticalSectionEx *fInitCritSecEx =
@@ -1368,6 +2025,8 @@ static NORETURN void exitHeob( appData *ad,
   }
   if( ad->pi.hThread ) CloseHandle( ad->pi.hThread );
   if( ad->pi.hProcess ) CloseHandle( ad->pi.hProcess );
+  freeTextBuffer( ad->tcOut );
+  freeTextBuffer( ad->tcOutOrig );
   if( ad->tcOut ) HeapFree( heap,0,ad->tcOut );
   if( ad->tcOutOrig ) HeapFree( heap,0,ad->tcOutOrig );
   if( ad->raise_alloc_a ) HeapFree( heap,0,ad->raise_alloc_a );
@@ -1375,6 +2034,7 @@ static NORETURN void exitHeob( appData *ad,
   if( ad->xmlName ) HeapFree( heap,0,ad->xmlName );
   if( ad->svgName ) HeapFree( heap,0,ad->svgName );
   if( ad->symPath ) HeapFree( heap,0,ad->symPath );
+  if( ad->symCacheName ) HeapFree( heap,0,ad->symCacheName );
   if( ad->specificOptions ) HeapFree( heap,0,ad->specificOptions );
   if( ad->mi_a ) HeapFree( heap,0,ad->mi_a );
   if( ad->api ) HeapFree( heap,0,ad->api );
@@ -1615,6 +2275,7 @@ static CODE_SEG(".text$2") HANDLE inject(
   }
 
   data->appCounterID = ad->appCounterID;
+  data->startCounter = ad->startCounter;
   // }}}
 
   // injection {{{
@@ -1798,10 +2459,62 @@ typedef struct stackSourceLocation
 }
 stackSourceLocation;
 
+// source files shown with -C, and the offsets of their lines
+#define SOURCE_FILE_CACHE 16
+typedef struct
+{
+  wchar_t *filename;
+  const char *map;
+  // start of each line, followed by the file size
+  size_t *lineOfs_a;
+  int line_q;
+  int lastUse;
+}
+sourceFile;
+
 #ifdef NO_DBGHELP
 #define MAX_SYM_NAME 2000
 #endif
 
+typedef struct
+{
+  const char *str;
+  DWORD hash;
+  DWORD len;
+  // number of strings added before this one
+  int idx;
+}
+stringEntry;
+
+typedef struct
+{
+  stringEntry *hash_a;
+  int hash_s;
+  int hash_q;
+  char *block;
+  size_t blockUsed;
+  size_t blockSize;
+}
+stringTable;
+
+typedef struct
+{
+  const wchar_t *path;
+  UINT64 writeTime;
+  UINT64 fileSize;
+  DWORD flags;
+}
+symCacheModule;
+
+typedef struct
+{
+  int mod;
+  DWORD rva;
+  size_t offset;
+  const DWORD *rec;
+}
+symCacheEntry;
+
 #if USE_STACKWALK
 typedef struct
 {
@@ -1828,6 +2541,7 @@ typedef struct dbgsym
   func_SymGetModuleInfo64 *fSymGetModuleInfo64;
   func_SymLoadModule64 *fSymLoadModule64;
   func_SymLoadModuleExW *fSymLoadModuleExW;
+  func_SymUnloadModule64 *fSymUnloadModule64;
   func_UnDecorateSymbolName *fUnDecorateSymbolName;
   func_MiniDumpWriteDump *fMiniDumpWriteDump;
 #if USE_STACKWALK
@@ -1858,12 +2572,48 @@ typedef struct dbgsym
   stackSourceLocation *ssl;
   int sslCount;
   int sslIdx;
-  char **func_a;
-  int func_q;
-  wchar_t **file_a;
-  int file_q;
+  stringTable funcs;
+  stringTable files;
+  // attribute values already written to the svg file
+  stringTable svgStrings;
+  char *svgKey;
+  size_t svgKey_s;
+  // frames of the other flame graph formats, stored in svgStrings
+  const char **flameFrame_a;
+  int flameFrame_s;
+  int *flamePath_a;
+  int flamePath_s;
+  int flameLeaf_q;
+  // pprof messages, and the ids of mappings, functions and locations
+  pbBuffer pb;
+  stringTable pprofIds;
+  // least recently used one is replaced
+  sourceFile sourceFile_a[SOURCE_FILE_CACHE];
+  int sourceFileUse;
   modInfo *currentModule;
   HMODULE currentModuleLoaded;
+  HANDLE symCacheFile;
+  const char *symCacheMap;
+  size_t symCacheSize;
+  symCacheModule *symCacheMod_a;
+  int symCacheMod_q;
+  int symCacheMod_s;
+  symCacheEntry *symCacheEntry_a;
+  int symCacheEntry_q;
+  int symCacheEntry_s;
+  int *symCacheSorted;
+  // module of the last record in the file
+  int symCacheCurMod;
+  // nothing is appended after unknown data
+  int symCacheReadOnly;
+  // records appended after the file was mapped
+  char **symCacheAdded_a;
+  int symCacheAdded_q;
+  int symCacheAdded_s;
+  CRITICAL_SECTION *csSym;
+  modInfo *modSortedOf;
+  int modSorted_q;
+  int *modSorted_a;
 }
 dbgsym;
 
@@ -1928,49 +2678,114 @@ static void stackwalkDbghelp( stackwalkFunctions *swf,int useSp,
 }
 #endif
 
-#define sorted_add_func( name,type,cmp_fump,len_func,len_fact ) \
-static const type *name( const type *str, \
-    type ***str_a,int *str_q,HANDLE heap ) \
-{ \
-  if( !str || !str[0] ) return( NULL ); \
-  \
-  type **a = *str_a; \
-  int q = *str_q; \
-  \
-  int s = 0; \
-  int e = q; \
-  int i = q/2; \
-  while( e>s ) \
-  { \
-    int cmp = cmp_fump( str,a[i] ); \
-    if( !cmp ) return( a[i] ); \
-    if( cmp<0 ) e = i; \
-    else s = i + 1; \
-    i = ( s+e )/2; \
-  } \
-  \
-  if( !(q&63) ) \
-  { \
-    int c = q + 64; \
-    if( !q ) a = HeapAlloc( heap,0,c*sizeof(type*) ); \
-    else a = HeapReAlloc( heap,0,a,c*sizeof(type*) ); \
-  } \
-  \
-  if( i<q ) RtlMoveMemory( a+i+1,a+i,(q-i)*sizeof(type*) ); \
-  \
-  int l = ( len_fact )*( len_func(str) + 1 ); \
-  type *copy = HeapAlloc( heap,0,l ); \
-  RtlMoveMemory( copy,str,l ); \
-  a[i] = copy; \
-  q++; \
-  \
-  *str_a = a; \
-  *str_q = q; \
-  \
-  return( copy ); \
-}
-sorted_add_func( strings_add,char,lstrcmp,lstrlen,1 )
-sorted_add_func( strings_addW,wchar_t,lstrcmpW,lstrlenW,2 )
+// string interning {{{
+
+#define STRING_BLOCK_SIZE 0x10000
+
+// returns the stored copy of str, l is the size including the terminator
+static const void *strings_intern( const void *str,DWORD l,
+    stringTable *st,HANDLE heap,int *idx )
+{
+  const unsigned char *bytes = str;
+  DWORD hash = 2166136261U;
+  DWORD i;
+  for( i=0; i<l; i++ )
+    hash = ( hash^bytes[i] )*16777619U;
+
+  // keep the hash table at most half full {{{
+  if( st->hash_q*2>=st->hash_s )
+  {
+    int hash_s = st->hash_s ? st->hash_s*2 : 1024;
+    stringEntry *hash_a =
+      HeapAlloc( heap,HEAP_ZERO_MEMORY,hash_s*sizeof(stringEntry) );
+    if( !hash_a ) return( NULL );
+    int j;
+    for( j=0; j<st->hash_s; j++ )
+    {
+      stringEntry *se = st->hash_a + j;
+      if( !se->str ) continue;
+      int h = se->hash&( hash_s-1 );
+      while( hash_a[h].str ) h = ( h+1 )&( hash_s-1 );
+      hash_a[h] = *se;
+    }
+    if( st->hash_a ) HeapFree( heap,0,st->hash_a );
+    st->hash_a = hash_a;
+    st->hash_s = hash_s;
+  }
+  // }}}
+
+  int h = hash&( st->hash_s-1 );
+  while( st->hash_a[h].str )
+  {
+    stringEntry *se = st->hash_a + h;
+    if( se->hash==hash && se->len==l &&
+        RtlCompareMemory(se->str,str,l)==l )
+    {
+      if( idx ) *idx = se->idx;
+      return( se->str );
+    }
+    h = ( h+1 )&( st->hash_s-1 );
+  }
+
+  // copy into the current block {{{
+  DWORD size = ( l+1 )&~1;
+  if( st->blockUsed+size>st->blockSize )
+  {
+    size_t blockSize = STRING_BLOCK_SIZE;
+    if( blockSize<sizeof(char*)+size ) blockSize = sizeof(char*) + size;
+    char *block = HeapAlloc( heap,0,blockSize );
+    if( !block ) return( NULL );
+    // blocks are linked by their first pointer
+    *(char**)block = st->block;
+    st->block = block;
+    st->blockUsed = sizeof(char*);
+    st->blockSize = blockSize;
+  }
+  char *copy = st->block + st->blockUsed;
+  st->blockUsed += size;
+  RtlMoveMemory( copy,str,l );
+  // }}}
+
+  stringEntry *se = st->hash_a + h;
+  se->str = copy;
+  se->hash = hash;
+  se->len = l;
+  se->idx = st->hash_q++;
+  if( idx ) *idx = se->idx;
+
+  return( copy );
+}
+
+static const char *strings_add( const char *str,
+    stringTable *st,HANDLE heap )
+{
+  if( !str || !str[0] ) return( NULL );
+
+  return( strings_intern(str,lstrlen(str)+1,st,heap,NULL) );
+}
+
+static const wchar_t *strings_addW( const wchar_t *str,
+    stringTable *st,HANDLE heap )
+{
+  if( !str || !str[0] ) return( NULL );
+
+  return( strings_intern(str,(lstrlenW(str)+1)*2,st,heap,NULL) );
+}
+
+static void strings_free( stringTable *st,HANDLE heap )
+{
+  char *block = st->block;
+  while( block )
+  {
+    char *prev = *(char**)block;
+    HeapFree( heap,0,block );
+    block = prev;
+  }
+  if( st->hash_a ) HeapFree( heap,0,st->hash_a );
+  RtlZeroMemory( st,sizeof(stringTable) );
+}
+
+// }}}
 
 static void dbgsym_init( dbgsym *ds,HANDLE process,textColor *tc,options *opt,
     const char *const *funcnames,HANDLE heap,const wchar_t *dbgPath,
@@ -2027,6 +2842,9 @@ static void dbgsym_init( dbgsym *ds,HANDLE process,textColor *tc,options *opt,
       (func_SymLoadModule64*)GetProcAddress( ds->symMod,"SymLoadModule64" );
     ds->fSymLoadModuleExW =
       (func_SymLoadModuleExW*)GetProcAddress( ds->symMod,"SymLoadModuleExW" );
+    ds->fSymUnloadModule64 =
+      (func_SymUnloadModule64*)GetProcAddress(
+          ds->symMod,"SymUnloadModule64" );
     ds->fUnDecorateSymbolName =
       (func_UnDecorateSymbolName*)GetProcAddress(
           ds->symMod,"UnDecorateSymbolName" );
@@ -2125,26 +2943,11 @@ static void cacheClear( dbgsym *ds )
   }
   HeapFree( heap,0,ssl );
 
-  char **func_a = ds->func_a;
-  int func_q = ds->func_q;
-  for( i=0; i<func_q; i++ )
-    HeapFree( heap,0,func_a[i] );
-  if( func_a )
-    HeapFree( heap,0,func_a );
-
-  wchar_t **file_a = ds->file_a;
-  int file_q = ds->file_q;
-  for( i=0; i<file_q; i++ )
-    HeapFree( heap,0,file_a[i] );
-  if( file_a )
-    HeapFree( heap,0,file_a );
+  strings_free( &ds->funcs,heap );
+  strings_free( &ds->files,heap );
 
   ds->ssl = NULL;
   ds->sslCount = 0;
-  ds->func_a = NULL;
-  ds->func_q = 0;
-  ds->file_a = NULL;
-  ds->file_q = 0;
 }
 
 #ifndef NO_DBGHELP
@@ -2164,6 +2967,16 @@ static void dbgsym_loadmodule( dbgsym *ds,
 }
 #endif
 
+static void symCacheClose( dbgsym *ds );
+
+static void sourceFileClose( sourceFile *sf,HANDLE heap )
+{
+  if( sf->filename ) HeapFree( heap,0,sf->filename );
+  if( sf->map ) UnmapViewOfFile( sf->map );
+  if( sf->lineOfs_a ) HeapFree( heap,0,sf->lineOfs_a );
+  RtlZeroMemory( sf,sizeof(sourceFile) );
+}
+
 static void dbgsym_close( dbgsym *ds )
 {
   HANDLE heap = ds->heap;
@@ -2194,6 +3007,19 @@ static void dbgsym_close( dbgsym *ds )
   if( ds->ansiPath ) HeapFree( heap,0,ds->ansiPath );
 
   cacheClear( ds );
+
+  symCacheClose( ds );
+
+  if( ds->modSorted_a ) HeapFree( heap,0,ds->modSorted_a );
+  strings_free( &ds->svgStrings,heap );
+  if( ds->svgKey ) HeapFree( heap,0,ds->svgKey );
+  if( ds->flameFrame_a ) HeapFree( heap,0,ds->flameFrame_a );
+  if( ds->flamePath_a ) HeapFree( heap,0,ds->flamePath_a );
+  pbFree( &ds->pb );
+  strings_free( &ds->pprofIds,heap );
+  int i;
+  for( i=0; i<SOURCE_FILE_CACHE; i++ )
+    sourceFileClose( ds->sourceFile_a+i,heap );
 }
 
 #ifndef _WIN64
@@ -2204,6 +3030,7 @@ static void dbgsym_close( dbgsym *ds )
 
 static int *sort_allocations( void *base,int *idxs,int num,int size,
     HANDLE heap,int (*compar)(const void*,const void*) );
+static void sort_ptrs( uintptr_t *ptrs,int num,HANDLE heap );
 
 static int cmp_ptr( const void *av,const void *bv )
 {
@@ -2212,6 +3039,55 @@ static int cmp_ptr( const void *av,const void *bv )
   return( *a>*b ? 1 : ( *a<*b ? -1 : 0 ) );
 }
 
+// module lookup {{{
+
+static int cmp_module_base( const void *av,const void *bv )
+{
+  const modInfo *a = av;
+  const modInfo *b = bv;
+  return( a->base>b->base ? 1 : ( a->base<b->base ? -1 : 0 ) );
+}
+
+// index of the modules sorted by base address,
+// the order of the module list itself is kept for printing
+static void dbgsym_sortmodules( dbgsym *ds,modInfo *mi_a,int mi_q )
+{
+  if( ds->modSorted_a ) HeapFree( ds->heap,0,ds->modSorted_a );
+  ds->modSortedOf = mi_a;
+  ds->modSorted_q = mi_q;
+  ds->modSorted_a = mi_q>0 ? sort_allocations( mi_a,NULL,mi_q,
+      sizeof(modInfo),ds->heap,cmp_module_base ) : NULL;
+}
+
+static modInfo *findModule( dbgsym *ds,modInfo *mi_a,int mi_q,
+    uintptr_t addr )
+{
+  const int *sorted = ds->modSorted_a;
+  if( sorted && ds->modSortedOf==mi_a && ds->modSorted_q==mi_q )
+  {
+    int s = 0;
+    int e = mi_q;
+    while( e>s )
+    {
+      int i = ( s+e )/2;
+      if( mi_a[sorted[i]].base<=addr )
+        s = i + 1;
+      else
+        e = i;
+    }
+    if( !s ) return( NULL );
+    modInfo *mi = mi_a + sorted[s-1];
+    return( addr<mi->base+mi->size ? mi : NULL );
+  }
+
+  int k;
+  for( k=0; k<mi_q && (addr<mi_a[k].base ||
+        addr>=mi_a[k].base+mi_a[k].size); k++ );
+  return( k<mi_q ? mi_a+k : NULL );
+}
+
+// }}}
+
 const char *thunkedFunctionNameByAddress(
     HMODULE mod,uintptr_t base,uintptr_t addr,const char *funcname )
 {
@@ -2302,6 +3178,9 @@ static const char *demangleSymbol( dbgsym *ds,const char *symname )
   return( symname );
 }
 
+static void addSourceLocation( dbgsym *ds,uintptr_t printAddr,
+    const wchar_t *filename,int lineno,const char *funcname,int columnno );
+
 static void locFuncCache(
     uint64_t addr,const wchar_t *filename,int lineno,const char *funcname,
     void *context,int columnno )
@@ -2313,6 +3192,11 @@ static void locFuncCache(
 
   int checkExportTable = 1;
 
+  // dbghelp is not thread-safe,
+  // and its results are only valid until the next call
+  int locked = ds->csSym && lineno<=DWST_NO_DBG_SYM;
+  if( locked ) EnterCriticalSection( ds->csSym );
+
   // MSVC debug info {{{
 #ifndef NO_DBGHELP
   if( lineno==DWST_NO_DBG_SYM && ds->fSymGetLineFromAddr64 )
@@ -2428,6 +3312,14 @@ static void locFuncCache(
 #endif
   // }}}
 
+  addSourceLocation( ds,printAddr,filename,lineno,funcname,columnno );
+
+  if( locked ) LeaveCriticalSection( ds->csSym );
+}
+
+static void addSourceLocation( dbgsym *ds,uintptr_t printAddr,
+    const wchar_t *filename,int lineno,const char *funcname,int columnno )
+{
   stackSourceLocation *ssl = ds->ssl;
   int sslIdx = ds->sslIdx;
   if( printAddr )
@@ -2451,9 +3343,9 @@ static void locFuncCache(
     const wchar_t *absPath = filename;
     if( GetFullPathNameW(filename,MAX_PATH,ds->absPath,NULL) )
       absPath = ds->absPath;
-    sl->filename = strings_addW( absPath,&ds->file_a,&ds->file_q,ds->heap );
+    sl->filename = strings_addW( absPath,&ds->files,ds->heap );
   }
-  sl->funcname = strings_add( funcname,&ds->func_a,&ds->func_q,ds->heap );
+  sl->funcname = strings_add( funcname,&ds->funcs,ds->heap );
   sl->lineno = lineno;
   sl->columnno = columnno;
 }
@@ -2476,163 +3368,965 @@ static void locFuncCacheAnsi(
 }
 #endif
 
-static stackSourceLocation *findStackSourceLocation(
-    uintptr_t addr,stackSourceLocation *ssl_a,int ssl_q )
-{
-  int s = 0;
-  int e = ssl_q;
-  int i = ssl_q/2;
-  while( e>s )
-  {
-    uintptr_t curAddr = ssl_a[i].addr;
-    if( addr==curAddr ) return( ssl_a+i );
-    if( addr<curAddr )
-      e = i;
-    else
-      s = i + 1;
-    i = ( s+e )/2;
-  }
-  return( NULL );
-}
+// persistent symbol cache {{{
 
-static void cacheSymbolData(
-    allocation *alloc_a,const int *alloc_idxs,int alloc_q,
-    modInfo *mi_a,int mi_q,dbgsym *ds,int initFrames )
+// the cache file starts with SYMCACHE_MAGIC, followed by records
+// of DWORD aligned fields:
+//   module:   1, path length, write time, file size, flags, path
+//   location: 2, rva, location count, locations
+//   select:   3, module index
+// where each location is:
+//   line, column, function name length, file name length, names
+// all lengths include the terminating zero
+// location records belong to the preceding module or select record,
+// select continues a module by the order of its first module record
+#define SYMCACHE_MAGIC "heobsym1"
+#define SYMCACHE_MODULE 1
+#define SYMCACHE_LOCATION 2
+#define SYMCACHE_SELECT 3
+#define SYMCACHE_ALIGN(s) ( ((s)+3)&~(size_t)3 )
+
+static void symCacheUnload( dbgsym *ds )
 {
-  cacheClear( ds );
+  HANDLE heap = ds->heap;
 
-  // initialize frames {{{
+  if( ds->symCacheMap ) UnmapViewOfFile( ds->symCacheMap );
+  if( ds->symCacheMod_a ) HeapFree( heap,0,ds->symCacheMod_a );
+  if( ds->symCacheEntry_a ) HeapFree( heap,0,ds->symCacheEntry_a );
+  if( ds->symCacheSorted ) HeapFree( heap,0,ds->symCacheSorted );
   int i;
-  int fc = 0;
-  uintptr_t threadInitAddr = ds->threadInitAddr;
-  for( i=0; i<alloc_q; i++ )
-  {
-    int idx = alloc_idxs ? alloc_idxs[i] : i;
-    allocation *a = alloc_a + idx;
+  for( i=0; i<ds->symCacheAdded_q; i++ )
+    HeapFree( heap,0,ds->symCacheAdded_a[i] );
+  if( ds->symCacheAdded_a ) HeapFree( heap,0,ds->symCacheAdded_a );
 
-    if( initFrames )
-    {
-      uintptr_t *frames = (uintptr_t*)a->frames;
-      int c;
-      for( c=0; c<PTRS && frames[c] && frames[c]!=threadInitAddr; c++ )
-        frames[c]--;
-      a->frameCount = c;
-    }
+  ds->symCacheMap = NULL;
+  ds->symCacheSize = 0;
+  ds->symCacheMod_a = NULL;
+  ds->symCacheMod_q = 0;
+  ds->symCacheMod_s = 0;
+  ds->symCacheEntry_a = NULL;
+  ds->symCacheEntry_q = 0;
+  ds->symCacheEntry_s = 0;
+  ds->symCacheSorted = NULL;
+  ds->symCacheCurMod = -1;
+  ds->symCacheAdded_a = NULL;
+  ds->symCacheAdded_q = 0;
+  ds->symCacheAdded_s = 0;
+}
 
-    fc += a->frameCount;
-  }
-  if( !fc ) return;
-  uintptr_t *frame_a = HeapAlloc( ds->heap,0,fc*sizeof(uintptr_t) );
-  fc = 0;
-  for( i=0; i<alloc_q; i++ )
+static int symCacheAddModule( dbgsym *ds,const symCacheModule *scm )
+{
+  if( ds->symCacheMod_q>=ds->symCacheMod_s )
   {
-    int idx = alloc_idxs ? alloc_idxs[i] : i;
-    allocation *a = alloc_a + idx;
-    RtlMoveMemory( frame_a+fc,a->frames,a->frameCount*sizeof(void*) );
-    fc += a->frameCount;
+    int mod_s = ds->symCacheMod_s ? ds->symCacheMod_s*2 : 16;
+    symCacheModule *mod_a = ds->symCacheMod_a ?
+      HeapReAlloc( ds->heap,0,ds->symCacheMod_a,
+          mod_s*sizeof(symCacheModule) ) :
+      HeapAlloc( ds->heap,0,mod_s*sizeof(symCacheModule) );
+    if( !mod_a ) return( -1 );
+    ds->symCacheMod_a = mod_a;
+    ds->symCacheMod_s = mod_s;
   }
-  // }}}
+  ds->symCacheMod_a[ds->symCacheMod_q] = *scm;
+  return( ds->symCacheMod_q++ );
+}
 
-  // find unique frames {{{
-  int *frame_idxs = sort_allocations(
-      frame_a,NULL,fc,sizeof(uintptr_t),ds->heap,cmp_ptr );
-  int unique_frames = 0;
-  uintptr_t prev_frame = 0;
-  for( i=0; i<fc; i++ )
-  {
-    uintptr_t cur_frame = frame_a[frame_idxs[i]];
-    if( cur_frame==prev_frame ) continue;
-    prev_frame = cur_frame;
-    unique_frames++;
-  }
-  uint64_t *frames = HeapAlloc( ds->heap,0,unique_frames*sizeof(uint64_t) );
-  unique_frames = 0;
-  prev_frame = 0;
-  for( i=0; i<fc; i++ )
+static symCacheEntry *symCacheAddEntry( dbgsym *ds )
+{
+  if( ds->symCacheEntry_q>=ds->symCacheEntry_s )
   {
-    uintptr_t cur_frame = frame_a[frame_idxs[i]];
-    if( cur_frame==prev_frame ) continue;
-    prev_frame = cur_frame;
-    frames[unique_frames++] = cur_frame;
+    int entry_s = ds->symCacheEntry_s ? ds->symCacheEntry_s*2 : 1024;
+    symCacheEntry *entry_a = ds->symCacheEntry_a ?
+      HeapReAlloc( ds->heap,0,ds->symCacheEntry_a,
+          entry_s*sizeof(symCacheEntry) ) :
+      HeapAlloc( ds->heap,0,entry_s*sizeof(symCacheEntry) );
+    if( !entry_a ) return( NULL );
+    ds->symCacheEntry_a = entry_a;
+    ds->symCacheEntry_s = entry_s;
   }
-  HeapFree( ds->heap,0,frame_a );
-  HeapFree( ds->heap,0,frame_idxs );
-  fc = unique_frames;
-  // }}}
-
-  // get symbol data for frames {{{
-  ds->sslCount = fc;
-  ds->sslIdx = -1;
-  ds->ssl = HeapAlloc(
-      ds->heap,HEAP_ZERO_MEMORY,fc*sizeof(stackSourceLocation) );
-  int j;
-  for( j=0; j<fc; j++ )
-  {
-    int k;
-    uintptr_t frame = (uintptr_t)frames[j];
-    for( k=0; k<mi_q && (frame<mi_a[k].base ||
-          frame>=mi_a[k].base+mi_a[k].size); k++ );
-    if( k>=mi_q ) continue;
-    modInfo *mi = mi_a + k;
+  return( ds->symCacheEntry_a + ds->symCacheEntry_q++ );
+}
 
-    int l;
-    for( l=j+1; l<fc && frames[l]>=mi->base &&
-        frames[l]<mi->base+mi->size; l++ );
+static int cmp_sym_cache_entry( const void *av,const void *bv )
+{
+  const symCacheEntry *a = av;
+  const symCacheEntry *b = bv;
 
-    ds->currentModule = mi;
-    ds->currentModuleLoaded = NULL;
+  if( a->mod!=b->mod ) return( a->mod>b->mod ? 1 : -1 );
 
-    // GCC debug info {{{
-#ifndef NO_DWARFSTACK
-    if( ds->fdwstOfFileW )
-      ds->fdwstOfFileW( mi->path,mi->base,frames+j,l-j,locFuncCache,ds );
-    else if( ds->fdwstOfFile )
-    {
-      char *ansiPath = ds->ansiPath;
-      int count = WideCharToMultiByte( CP_ACP,0,
-          mi->path,-1,ansiPath,MAX_PATH,NULL,NULL );
-      if( count>0 && count<MAX_PATH )
-        ds->fdwstOfFile( ansiPath,mi->base,frames+j,l-j,locFuncCacheAnsi,ds );
-    }
-    else
-#endif
-    // }}}
-    {
-      for( i=j; i<l; i++ )
-        locFuncCache( frames[i],mi->path,DWST_NO_DBG_SYM,NULL,ds,0 );
-    }
+  if( a->rva!=b->rva ) return( a->rva>b->rva ? 1 : -1 );
 
-    ds->currentModule = NULL;
-    if( ds->currentModuleLoaded )
-      FreeLibrary( ds->currentModuleLoaded );
+  // newer entries first
+  return( a->offset<b->offset ? 1 : -1 );
+}
 
-    j = l - 1;
+// returns the size of the location record at pos, or 0 if it's incomplete
+static size_t symCacheLocationSize( const char *map,size_t pos,size_t size )
+{
+  size_t start = pos;
+  if( pos+12>size ) return( 0 );
+  DWORD count = ((const DWORD*)(map+pos))[2];
+  pos += 12;
+  DWORD i;
+  for( i=0; i<count; i++ )
+  {
+    if( pos+16>size ) return( 0 );
+    const DWORD *loc = (const DWORD*)( map+pos );
+    pos += 16;
+    if( loc[2]>size || loc[3]>size ) return( 0 );
+    pos += SYMCACHE_ALIGN( loc[2] ) + SYMCACHE_ALIGN( loc[3]*2 );
+    if( pos>size ) return( 0 );
   }
-  ds->sslCount = ds->sslIdx + 1;
-  // }}}
-
-  HeapFree( ds->heap,0,frames );
+  return( pos - start );
 }
 
-static const char *mapOfFile( const wchar_t *name,size_t *size )
+// returns 0 if the file is not a symbol cache
+static int symCacheLoad( dbgsym *ds )
 {
-  HANDLE file = CreateFileW( name,GENERIC_READ,FILE_SHARE_READ,
-      NULL,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,0 );
-  if( file==INVALID_HANDLE_VALUE ) return( NULL );
+  symCacheUnload( ds );
+  ds->symCacheReadOnly = 1;
 
-  const char *map = NULL;
+  HANDLE file = ds->symCacheFile;
+  DWORD sizeHigh = 0;
+  DWORD size = GetFileSize( file,&sizeHigh );
+  if( size==INVALID_FILE_SIZE || sizeHigh ) return( 1 );
 
-  BY_HANDLE_FILE_INFORMATION bhfi;
-  if( GetFileInformationByHandle(file,&bhfi) && (
-#ifndef _WIN64
-        !bhfi.nFileSizeHigh &&
-#else
-        bhfi.nFileSizeHigh ||
-#endif
-        bhfi.nFileSizeLow) )
+  // only an empty file is made a new cache
+  int magicLen = sizeof(SYMCACHE_MAGIC) - 1;
+  if( !size )
   {
-    HANDLE mapping = CreateFileMapping( file,NULL,PAGE_READONLY,0,0,NULL );
-    if( mapping )
+    DWORD written;
+    SetFilePointer( file,0,NULL,FILE_BEGIN );
+    if( WriteFile(file,SYMCACHE_MAGIC,magicLen,&written,NULL) &&
+        written==(DWORD)magicLen )
+      ds->symCacheReadOnly = 0;
+    return( 1 );
+  }
+  char magic[sizeof(SYMCACHE_MAGIC)];
+  DWORD didread = 0;
+  SetFilePointer( file,0,NULL,FILE_BEGIN );
+  if( size<(DWORD)magicLen ||
+      !ReadFile(file,magic,magicLen,&didread,NULL) ||
+      didread!=(DWORD)magicLen ||
+      RtlCompareMemory(magic,SYMCACHE_MAGIC,magicLen)!=(SIZE_T)magicLen )
+    return( 0 );
+  if( size==(DWORD)magicLen )
+  {
+    ds->symCacheReadOnly = 0;
+    return( 1 );
+  }
+
+  HANDLE mapping = CreateFileMapping( file,NULL,PAGE_READONLY,0,0,NULL );
+  if( !mapping ) return( 1 );
+  const char *map = MapViewOfFile( mapping,FILE_MAP_READ,0,0,0 );
+  CloseHandle( mapping );
+  if( !map ) return( 1 );
+  ds->symCacheMap = map;
+  ds->symCacheSize = size;
+
+  int curMod = -1;
+  // the last record is incomplete (e.g. heob was killed while writing it)
+  int torn = 0;
+  size_t pos = magicLen;
+  while( pos<size )
+  {
+    if( pos+8>size )
+    {
+      torn = 1;
+      break;
+    }
+    const DWORD *rec = (const DWORD*)( map+pos );
+    if( rec[0]==SYMCACHE_MODULE )
+    {
+      size_t recSize = 28 + SYMCACHE_ALIGN( (size_t)rec[1]*2 );
+      if( rec[1]>size || pos+recSize>size )
+      {
+        torn = 1;
+        break;
+      }
+      const wchar_t *path = (const wchar_t*)( rec+7 );
+      if( !rec[1] || path[rec[1]-1] ) break;
+
+      symCacheModule scm;
+      scm.path = path;
+      scm.writeTime = rec[2] | ( (UINT64)rec[3]<<32 );
+      scm.fileSize = rec[4] | ( (UINT64)rec[5]<<32 );
+      scm.flags = rec[6];
+      int m;
+      for( m=0; m<ds->symCacheMod_q; m++ )
+      {
+        symCacheModule *cmp = ds->symCacheMod_a + m;
+        if( cmp->writeTime==scm.writeTime && cmp->fileSize==scm.fileSize &&
+            cmp->flags==scm.flags && !lstrcmpiW(cmp->path,scm.path) )
+          break;
+      }
+      if( m>=ds->symCacheMod_q && symCacheAddModule(ds,&scm)<0 ) break;
+      curMod = m;
+      pos += recSize;
+    }
+    else if( rec[0]==SYMCACHE_SELECT )
+    {
+      if( rec[1]>=(DWORD)ds->symCacheMod_q ) break;
+      curMod = rec[1];
+      pos += 8;
+    }
+    else if( rec[0]==SYMCACHE_LOCATION && curMod>=0 )
+    {
+      size_t recSize = symCacheLocationSize( map,pos,size );
+      if( !recSize )
+      {
+        torn = 1;
+        break;
+      }
+
+      symCacheEntry *sce = symCacheAddEntry( ds );
+      if( !sce ) break;
+      sce->mod = curMod;
+      sce->rva = rec[1];
+      sce->offset = pos;
+      sce->rec = rec;
+      pos += recSize;
+    }
+    else
+      break;
+  }
+
+  // remove the incomplete record, so new ones are appended after valid data
+  if( torn )
+  {
+    symCacheUnload( ds );
+    SetFilePointer( file,(LONG)pos,NULL,FILE_BEGIN );
+    SetEndOfFile( file );
+    return( symCacheLoad(ds) );
+  }
+
+  // unknown data or out of memory, the records read so far are used,
+  // but the file is left alone
+  ds->symCacheReadOnly = pos<size;
+
+  ds->symCacheCurMod = curMod;
+  if( ds->symCacheEntry_q )
+    ds->symCacheSorted = sort_allocations(
+        ds->symCacheEntry_a,NULL,ds->symCacheEntry_q,
+        sizeof(symCacheEntry),ds->heap,cmp_sym_cache_entry );
+  return( 1 );
+}
+
+static void symCacheOpen( dbgsym *ds,const wchar_t *name )
+{
+  if( !name ) return;
+
+  HANDLE file = CreateFileW( name,GENERIC_READ|GENERIC_WRITE,
+      FILE_SHARE_READ,NULL,OPEN_ALWAYS,FILE_ATTRIBUTE_NORMAL,NULL );
+  if( file==INVALID_HANDLE_VALUE ) return;
+
+  ds->symCacheFile = file;
+  if( !symCacheLoad(ds) )
+  {
+    CloseHandle( file );
+    ds->symCacheFile = NULL;
+  }
+}
+
+static void symCacheClose( dbgsym *ds )
+{
+  if( !ds->symCacheFile ) return;
+
+  symCacheUnload( ds );
+  CloseHandle( ds->symCacheFile );
+  ds->symCacheFile = NULL;
+}
+
+// identifies the module by path, write time and size,
+// and the available symbol readers
+static int symCacheModuleOf( dbgsym *ds,const modInfo *mi,
+    symCacheModule *scm )
+{
+  WIN32_FILE_ATTRIBUTE_DATA fad;
+  if( !GetFileAttributesExW(mi->path,GetFileExInfoStandard,&fad) )
+    return( 0 );
+
+  scm->path = mi->path;
+  scm->writeTime = fad.ftLastWriteTime.dwLowDateTime |
+    ( (UINT64)fad.ftLastWriteTime.dwHighDateTime<<32 );
+  scm->fileSize = fad.nFileSizeLow | ( (UINT64)fad.nFileSizeHigh<<32 );
+  scm->flags = 0;
+#ifndef NO_DWARFSTACK
+  if( ds->fdwstOfFileW || ds->fdwstOfFile ) scm->flags |= 1;
+#endif
+#ifndef NO_DBGHELP
+  if( ds->fSymGetLineFromAddr64 ) scm->flags |= 2;
+#endif
+#if defined(NO_DBGHELP) && defined(NO_DWARFSTACK)
+  (void)ds;
+#endif
+  return( 1 );
+}
+
+static int symCacheFindModule( dbgsym *ds,const symCacheModule *scm )
+{
+  int m;
+  for( m=0; m<ds->symCacheMod_q; m++ )
+  {
+    symCacheModule *cmp = ds->symCacheMod_a + m;
+    if( cmp->writeTime==scm->writeTime && cmp->fileSize==scm->fileSize &&
+        cmp->flags==scm->flags && !lstrcmpiW(cmp->path,scm->path) )
+      return( m );
+  }
+  return( -1 );
+}
+
+static const DWORD *symCacheFind( dbgsym *ds,int mod,DWORD rva )
+{
+  const symCacheEntry *entry_a = ds->symCacheEntry_a;
+  const int *sorted = ds->symCacheSorted;
+  if( !sorted ) return( NULL );
+
+  int s = 0;
+  int e = ds->symCacheEntry_q;
+  while( e>s )
+  {
+    int i = ( s+e )/2;
+    const symCacheEntry *sce = entry_a + sorted[i];
+    if( sce->mod<mod || (sce->mod==mod && sce->rva<rva) )
+      s = i + 1;
+    else
+      e = i;
+  }
+  if( s>=ds->symCacheEntry_q ) return( NULL );
+  const symCacheEntry *sce = entry_a + sorted[s];
+  if( sce->mod!=mod || sce->rva!=rva ) return( NULL );
+
+  return( sce->rec );
+}
+
+static void symCacheReplay( dbgsym *ds,uintptr_t addr,const DWORD *rec )
+{
+  DWORD count = rec[2];
+  const char *pos = (const char*)( rec+3 );
+  DWORD i;
+  for( i=0; i<count; i++ )
+  {
+    const DWORD *loc = (const DWORD*)pos;
+    pos += 16;
+    const char *funcname = loc[2] ? pos : NULL;
+    pos += SYMCACHE_ALIGN( loc[2] );
+    const wchar_t *filename = loc[3] ? (const wchar_t*)pos : NULL;
+    pos += SYMCACHE_ALIGN( loc[3]*2 );
+
+    addSourceLocation( ds,i?0:addr,filename,(int)loc[0],funcname,(int)loc[1] );
+  }
+}
+
+// merges the entries added from index first into the sorted index
+static int symCacheMerge( dbgsym *ds,int first )
+{
+  HANDLE heap = ds->heap;
+  int entry_q = ds->symCacheEntry_q;
+  int add_q = entry_q - first;
+  const symCacheEntry *entry_a = ds->symCacheEntry_a;
+
+  int *added = sort_allocations( ds->symCacheEntry_a+first,NULL,add_q,
+      sizeof(symCacheEntry),heap,cmp_sym_cache_entry );
+  int *sorted = HeapAlloc( heap,0,entry_q*sizeof(int) );
+  if( !added || !sorted )
+  {
+    if( added ) HeapFree( heap,0,added );
+    if( sorted ) HeapFree( heap,0,sorted );
+    return( 0 );
+  }
+
+  const int *old = ds->symCacheSorted;
+  int o = 0, a = 0, i = 0;
+  while( o<first && a<add_q )
+  {
+    if( cmp_sym_cache_entry(entry_a+first+added[a],entry_a+old[o])<0 )
+      sorted[i++] = first + added[a++];
+    else
+      sorted[i++] = old[o++];
+  }
+  while( o<first ) sorted[i++] = old[o++];
+  while( a<add_q ) sorted[i++] = first + added[a++];
+
+  HeapFree( heap,0,added );
+  if( ds->symCacheSorted ) HeapFree( heap,0,ds->symCacheSorted );
+  ds->symCacheSorted = sorted;
+  return( 1 );
+}
+
+// appends the locations ssl[sslStart..sslEnd] of the module,
+// and adds them to the loaded cache
+static void symCacheAppend( dbgsym *ds,const symCacheModule *scm,
+    uintptr_t base,const stackSourceLocation *ssl,int sslStart,int sslEnd )
+{
+  if( ds->symCacheReadOnly ) return;
+
+  HANDLE heap = ds->heap;
+
+  // the module record is only written the first time,
+  // later only a select record if another module was written in between
+  int m = symCacheFindModule( ds,scm );
+  DWORD pathLen = lstrlenW( scm->path ) + 1;
+  size_t headSize = 0;
+  if( m<0 )
+    headSize = 28 + SYMCACHE_ALIGN( pathLen*2 );
+  else if( m!=ds->symCacheCurMod )
+    headSize = 8;
+  size_t size = headSize;
+  int i;
+  for( i=sslStart; i<=sslEnd; i++ )
+  {
+    size += 12;
+    const sourceLocation *sl;
+    for( sl=&ssl[i].sl; sl; sl=sl->inlineLocation )
+    {
+      size += 16;
+      if( sl->funcname )
+        size += SYMCACHE_ALIGN( lstrlen(sl->funcname)+1 );
+      if( sl->filename )
+        size += SYMCACHE_ALIGN( (lstrlenW(sl->filename)+1)*2 );
+    }
+  }
+
+  if( ds->symCacheAdded_q>=ds->symCacheAdded_s )
+  {
+    int added_s = ds->symCacheAdded_s ? ds->symCacheAdded_s*2 : 16;
+    char **added_a = ds->symCacheAdded_a ?
+      HeapReAlloc( heap,0,ds->symCacheAdded_a,added_s*sizeof(char*) ) :
+      HeapAlloc( heap,0,added_s*sizeof(char*) );
+    if( !added_a ) return;
+    ds->symCacheAdded_a = added_a;
+    ds->symCacheAdded_s = added_s;
+  }
+
+  char *buf = HeapAlloc( heap,HEAP_ZERO_MEMORY,size );
+  if( !buf ) return;
+
+  DWORD *rec = (DWORD*)buf;
+  if( m<0 )
+  {
+    rec[0] = SYMCACHE_MODULE;
+    rec[1] = pathLen;
+    rec[2] = (DWORD)scm->writeTime;
+    rec[3] = (DWORD)( scm->writeTime>>32 );
+    rec[4] = (DWORD)scm->fileSize;
+    rec[5] = (DWORD)( scm->fileSize>>32 );
+    rec[6] = scm->flags;
+    RtlMoveMemory( rec+7,scm->path,pathLen*2 );
+  }
+  else if( headSize )
+  {
+    rec[0] = SYMCACHE_SELECT;
+    rec[1] = m;
+  }
+  char *pos = buf + headSize;
+  for( i=sslStart; i<=sslEnd; i++ )
+  {
+    rec = (DWORD*)pos;
+    rec[0] = SYMCACHE_LOCATION;
+    rec[1] = (DWORD)( ssl[i].addr-base );
+    rec[2] = 0;
+    pos += 12;
+    const sourceLocation *sl;
+    for( sl=&ssl[i].sl; sl; sl=sl->inlineLocation )
+    {
+      DWORD *loc = (DWORD*)pos;
+      loc[0] = sl->lineno;
+      loc[1] = sl->columnno;
+      loc[2] = sl->funcname ? lstrlen( sl->funcname ) + 1 : 0;
+      loc[3] = sl->filename ? lstrlenW( sl->filename ) + 1 : 0;
+      pos += 16;
+      if( sl->funcname )
+        RtlMoveMemory( pos,sl->funcname,loc[2] );
+      pos += SYMCACHE_ALIGN( loc[2] );
+      if( sl->filename )
+        RtlMoveMemory( pos,sl->filename,loc[3]*2 );
+      pos += SYMCACHE_ALIGN( loc[3]*2 );
+      rec[2]++;
+    }
+  }
+
+  DWORD written;
+  DWORD fileEnd = SetFilePointer( ds->symCacheFile,0,NULL,FILE_END );
+  if( fileEnd==INVALID_SET_FILE_POINTER ||
+      !WriteFile(ds->symCacheFile,buf,(DWORD)size,&written,NULL) ||
+      written!=size )
+  {
+    HeapFree( heap,0,buf );
+    // truncates an incomplete record
+    if( !symCacheLoad(ds) ) symCacheClose( ds );
+    return;
+  }
+  ds->symCacheAdded_a[ds->symCacheAdded_q++] = buf;
+
+  // add the new records to the loaded cache {{{
+  if( m<0 )
+  {
+    symCacheModule scmAdded = *scm;
+    scmAdded.path = (const wchar_t*)( buf+28 );
+    m = symCacheAddModule( ds,&scmAdded );
+  }
+  ds->symCacheCurMod = m;
+
+  int first = ds->symCacheEntry_q;
+  pos = buf + headSize;
+  for( i=sslStart; m>=0 && i<=sslEnd; i++ )
+  {
+    size_t recSize = symCacheLocationSize( buf,pos-buf,size );
+    symCacheEntry *sce = symCacheAddEntry( ds );
+    if( !sce ) break;
+    sce->mod = m;
+    sce->rva = ((const DWORD*)pos)[1];
+    sce->offset = fileEnd + ( pos-buf );
+    sce->rec = (const DWORD*)pos;
+    pos += recSize;
+  }
+  if( ( m<0 || i<=sslEnd || !symCacheMerge(ds,first) ) && !symCacheLoad(ds) )
+    symCacheClose( ds );
+  // }}}
+}
+
+static int cmp_ssl_addr( const void *av,const void *bv )
+{
+  const stackSourceLocation *a = av;
+  const stackSourceLocation *b = bv;
+
+  return( a->addr>b->addr ? 1 : ( a->addr<b->addr ? -1 : 0 ) );
+}
+
+// }}}
+
+static stackSourceLocation *findStackSourceLocation(
+    uintptr_t addr,stackSourceLocation *ssl_a,int ssl_q )
+{
+  int s = 0;
+  int e = ssl_q;
+  int i = ssl_q/2;
+  while( e>s )
+  {
+    uintptr_t curAddr = ssl_a[i].addr;
+    if( addr==curAddr ) return( ssl_a+i );
+    if( addr<curAddr )
+      e = i;
+    else
+      s = i + 1;
+    i = ( s+e )/2;
+  }
+  return( NULL );
+}
+
+// parallel symbolization {{{
+
+#define SYMBOLIZE_WORKERS_MAX 8
+
+typedef struct
+{
+  modInfo *mi;
+  uint64_t *frames;
+  int count;
+  int useCache;
+  symCacheModule scm;
+  stackSourceLocation *ssl;
+  int sslCount;
+  dbgsym *worker;
+}
+symbolizeJob;
+
+typedef struct
+{
+  dbgsym *ds;
+  dbgsym ds_s;
+  symbolizeJob *job_a;
+  int job_q;
+  LONG *nextJob;
+}
+symbolizeWorker;
+
+static void symbolizeModule( dbgsym *ds,modInfo *mi,
+    uint64_t *frames,int count )
+{
+  ds->currentModule = mi;
+  ds->currentModuleLoaded = NULL;
+
+  // GCC debug info {{{
+#ifndef NO_DWARFSTACK
+  if( ds->fdwstOfFileW )
+    ds->fdwstOfFileW( mi->path,mi->base,frames,count,locFuncCache,ds );
+  else if( ds->fdwstOfFile )
+  {
+    char *ansiPath = ds->ansiPath;
+    int len = WideCharToMultiByte( CP_ACP,0,
+        mi->path,-1,ansiPath,MAX_PATH,NULL,NULL );
+    if( len>0 && len<MAX_PATH )
+      ds->fdwstOfFile( ansiPath,mi->base,frames,count,locFuncCacheAnsi,ds );
+  }
+  else
+#endif
+  // }}}
+  {
+    int i;
+    for( i=0; i<count; i++ )
+      locFuncCache( frames[i],mi->path,DWST_NO_DBG_SYM,NULL,ds,0 );
+  }
+
+  ds->currentModule = NULL;
+  if( ds->currentModuleLoaded )
+    FreeLibrary( ds->currentModuleLoaded );
+}
+
+static DWORD WINAPI symbolizeThread( LPVOID arg )
+{
+  symbolizeWorker *sw = arg;
+  dbgsym *ds = sw->ds;
+
+  while( 1 )
+  {
+    int j = InterlockedIncrement( sw->nextJob ) - 1;
+    if( j>=sw->job_q ) break;
+
+    symbolizeJob *job = sw->job_a + j;
+    job->worker = ds;
+    if( !job->ssl ) continue;
+
+    ds->ssl = job->ssl;
+    ds->sslCount = job->count;
+    ds->sslIdx = -1;
+    symbolizeModule( ds,job->mi,job->frames,job->count );
+    job->sslCount = ds->sslIdx + 1;
+  }
+
+  return( 0 );
+}
+
+static void symbolizeWorkerFree( dbgsym *ds )
+{
+  HANDLE heap = ds->heap;
+
+  if( ds->absPath ) HeapFree( heap,0,ds->absPath );
+  if( ds->filenameWide ) HeapFree( heap,0,ds->filenameWide );
+  if( ds->ansiPath ) HeapFree( heap,0,ds->ansiPath );
+#if !defined(NO_DBGHELP) || !defined(NO_DWARFSTACK)
+  if( ds->undname ) HeapFree( heap,0,ds->undname );
+#endif
+
+  strings_free( &ds->funcs,heap );
+  strings_free( &ds->files,heap );
+}
+
+// copy of the symbol data with own buffers and string tables,
+// the symbol cache is only used by the main thread
+static dbgsym *symbolizeWorkerInit( dbgsym *wds,const dbgsym *ds )
+{
+  HANDLE heap = ds->heap;
+
+  RtlMoveMemory( wds,ds,sizeof(dbgsym) );
+  wds->ssl = NULL;
+  wds->sslCount = 0;
+  wds->sslIdx = -1;
+  RtlZeroMemory( &wds->funcs,sizeof(stringTable) );
+  RtlZeroMemory( &wds->files,sizeof(stringTable) );
+  RtlZeroMemory( &wds->svgStrings,sizeof(stringTable) );
+  wds->svgKey = NULL;
+  wds->svgKey_s = 0;
+  wds->flameFrame_a = NULL;
+  wds->flameFrame_s = 0;
+  wds->flamePath_a = NULL;
+  wds->flamePath_s = 0;
+  RtlZeroMemory( &wds->pb,sizeof(pbBuffer) );
+  RtlZeroMemory( &wds->pprofIds,sizeof(stringTable) );
+  RtlZeroMemory( wds->sourceFile_a,sizeof(wds->sourceFile_a) );
+  wds->currentModule = NULL;
+  wds->currentModuleLoaded = NULL;
+  wds->symCacheFile = NULL;
+  wds->symCacheMap = NULL;
+  wds->symCacheSize = 0;
+  wds->symCacheMod_a = NULL;
+  wds->symCacheMod_q = 0;
+  wds->symCacheMod_s = 0;
+  wds->symCacheEntry_a = NULL;
+  wds->symCacheEntry_q = 0;
+  wds->symCacheEntry_s = 0;
+  wds->symCacheSorted = NULL;
+  wds->symCacheCurMod = -1;
+  wds->symCacheReadOnly = 0;
+  wds->symCacheAdded_a = NULL;
+  wds->symCacheAdded_q = 0;
+  wds->symCacheAdded_s = 0;
+
+  wds->absPath = HeapAlloc( heap,0,2*MAX_PATH );
+  wds->filenameWide = HeapAlloc( heap,0,2*MAX_PATH );
+  wds->ansiPath = HeapAlloc( heap,0,MAX_PATH );
+#if !defined(NO_DBGHELP) || !defined(NO_DWARFSTACK)
+  wds->undname = HeapAlloc( heap,0,MAX_SYM_NAME+1 );
+  if( !wds->undname )
+  {
+    symbolizeWorkerFree( wds );
+    return( NULL );
+  }
+#endif
+  if( !wds->absPath || !wds->filenameWide || !wds->ansiPath )
+  {
+    symbolizeWorkerFree( wds );
+    return( NULL );
+  }
+
+  return( wds );
+}
+
+// }}}
+
+static void cacheSymbolData(
+    allocation *alloc_a,const int *alloc_idxs,int alloc_q,
+    modInfo *mi_a,int mi_q,dbgsym *ds,int initFrames )
+{
+  cacheClear( ds );
+
+  // initialize frames {{{
+  int i;
+  int fc = 0;
+  uintptr_t threadInitAddr = ds->threadInitAddr;
+  for( i=0; i<alloc_q; i++ )
+  {
+    int idx = alloc_idxs ? alloc_idxs[i] : i;
+    allocation *a = alloc_a + idx;
+
+    if( initFrames )
+    {
+      uintptr_t *frames = (uintptr_t*)a->frames;
+      int c;
+      for( c=0; c<PTRS && frames[c] && frames[c]!=threadInitAddr; c++ )
+        frames[c]--;
+      a->frameCount = c;
+    }
+
+    fc += a->frameCount;
+  }
+  if( !fc ) return;
+  uintptr_t *frame_a = HeapAlloc( ds->heap,0,fc*sizeof(uintptr_t) );
+  fc = 0;
+  for( i=0; i<alloc_q; i++ )
+  {
+    int idx = alloc_idxs ? alloc_idxs[i] : i;
+    allocation *a = alloc_a + idx;
+    RtlMoveMemory( frame_a+fc,a->frames,a->frameCount*sizeof(void*) );
+    fc += a->frameCount;
+  }
+  // }}}
+
+  // find unique frames {{{
+  sort_ptrs( frame_a,fc,ds->heap );
+  int unique_frames = 0;
+  uintptr_t prev_frame = 0;
+  for( i=0; i<fc; i++ )
+  {
+    uintptr_t cur_frame = frame_a[i];
+    if( cur_frame==prev_frame ) continue;
+    prev_frame = cur_frame;
+    unique_frames++;
+  }
+  uint64_t *frames = HeapAlloc( ds->heap,0,unique_frames*sizeof(uint64_t) );
+  unique_frames = 0;
+  prev_frame = 0;
+  for( i=0; i<fc; i++ )
+  {
+    uintptr_t cur_frame = frame_a[i];
+    if( cur_frame==prev_frame ) continue;
+    prev_frame = cur_frame;
+    frames[unique_frames++] = cur_frame;
+  }
+  HeapFree( ds->heap,0,frame_a );
+  fc = unique_frames;
+  // }}}
+
+  // get symbol data for frames {{{
+  ds->sslCount = fc;
+  ds->sslIdx = -1;
+  ds->ssl = HeapAlloc(
+      ds->heap,HEAP_ZERO_MEMORY,fc*sizeof(stackSourceLocation) );
+  uint64_t *missFrames = ds->symCacheFile ?
+    HeapAlloc( ds->heap,0,fc*sizeof(uint64_t) ) : NULL;
+  symbolizeJob *job_a = HeapAlloc( ds->heap,0,
+      ( mi_q?mi_q:1 )*sizeof(symbolizeJob) );
+  int job_q = 0;
+  int cacheHits = 0;
+  int j;
+  for( j=0; j<fc; j++ )
+  {
+    modInfo *mi = findModule( ds,mi_a,mi_q,(uintptr_t)frames[j] );
+    if( !mi ) continue;
+
+    int l;
+    for( l=j+1; l<fc && frames[l]>=mi->base &&
+        frames[l]<mi->base+mi->size; l++ );
+
+    symbolizeJob *job = job_a + job_q;
+    job->mi = mi;
+    job->frames = frames + j;
+    job->count = l - j;
+    job->ssl = NULL;
+    job->sslCount = 0;
+
+    // only symbolize frames which are not in the symbol cache {{{
+    job->useCache = missFrames && symCacheModuleOf( ds,mi,&job->scm );
+    if( job->useCache )
+    {
+      int m = symCacheFindModule( ds,&job->scm );
+      job->frames = missFrames + j;
+      job->count = 0;
+      for( i=j; i<l; i++ )
+      {
+        const DWORD *rec = m<0 ? NULL :
+          symCacheFind( ds,m,(DWORD)(frames[i]-mi->base) );
+        if( rec )
+        {
+          symCacheReplay( ds,(uintptr_t)frames[i],rec );
+          cacheHits++;
+        }
+        else
+          job->frames[job->count++] = frames[i];
+      }
+    }
+    // }}}
+
+    if( job->count ) job_q++;
+
+    j = l - 1;
+  }
+
+  // symbolize modules in parallel {{{
+  int workers = 1;
+  if( job_q>1 )
+  {
+    SYSTEM_INFO si;
+    GetSystemInfo( &si );
+    workers = si.dwNumberOfProcessors;
+    if( workers>job_q ) workers = job_q;
+    if( workers>SYMBOLIZE_WORKERS_MAX ) workers = SYMBOLIZE_WORKERS_MAX;
+  }
+  stackSourceLocation *sslMain = ds->ssl;
+  int sslMainIdx = ds->sslIdx;
+  for( j=0; j<job_q; j++ )
+  {
+    symbolizeJob *job = job_a + j;
+    job->ssl = HeapAlloc( ds->heap,HEAP_ZERO_MEMORY,
+        job->count*sizeof(stackSourceLocation) );
+  }
+  symbolizeWorker sw_a[SYMBOLIZE_WORKERS_MAX];
+  HANDLE threads[SYMBOLIZE_WORKERS_MAX];
+  CRITICAL_SECTION csSym;
+  LONG nextJob = 0;
+  if( workers>1 )
+  {
+    InitializeCriticalSection( &csSym );
+    ds->csSym = &csSym;
+  }
+  for( i=0; i<workers; i++ )
+  {
+    symbolizeWorker *sw = sw_a + i;
+    sw->job_a = job_a;
+    sw->job_q = job_q;
+    sw->nextJob = &nextJob;
+    sw->ds = i ? symbolizeWorkerInit( &sw->ds_s,ds ) : ds;
+    threads[i] = NULL;
+    if( i && sw->ds )
+      threads[i] = CreateThread( NULL,0,symbolizeThread,sw,0,NULL );
+  }
+  symbolizeThread( sw_a );
+  for( i=1; i<workers; i++ )
+  {
+    if( !threads[i] ) continue;
+    WaitForSingleObject( threads[i],INFINITE );
+    CloseHandle( threads[i] );
+  }
+  ds->csSym = NULL;
+  if( workers>1 )
+    DeleteCriticalSection( &csSym );
+  ds->ssl = sslMain;
+  ds->sslCount = fc;
+  ds->sslIdx = sslMainIdx;
+  // }}}
+
+  // collect results in module order {{{
+  for( j=0; j<job_q; j++ )
+  {
+    symbolizeJob *job = job_a + j;
+    int sslCount = job->sslCount;
+    stackSourceLocation *ssl = job->ssl;
+    if( job->worker!=ds )
+    {
+      for( i=0; i<sslCount; i++ )
+      {
+        sourceLocation *sl;
+        for( sl=&ssl[i].sl; sl; sl=sl->inlineLocation )
+        {
+          sl->funcname = strings_add( sl->funcname,&ds->funcs,ds->heap );
+          sl->filename = strings_addW( sl->filename,&ds->files,ds->heap );
+        }
+      }
+    }
+    RtlMoveMemory( ds->ssl+ds->sslIdx+1,ssl,
+        sslCount*sizeof(stackSourceLocation) );
+    ds->sslIdx += sslCount;
+
+    if( job->useCache && sslCount )
+      symCacheAppend( ds,&job->scm,job->mi->base,ssl,0,sslCount-1 );
+
+    if( ssl ) HeapFree( ds->heap,0,ssl );
+  }
+  for( i=1; i<workers; i++ )
+  {
+    if( sw_a[i].ds )
+      symbolizeWorkerFree( sw_a[i].ds );
+  }
+  HeapFree( ds->heap,0,job_a );
+  ds->sslCount = ds->sslIdx + 1;
+  // }}}
+  // }}}
+
+  // cached and symbolized frames are mixed {{{
+  if( cacheHits && ds->sslCount>1 )
+  {
+    int sslCount = ds->sslCount;
+    int *ssl_idxs = sort_allocations( ds->ssl,NULL,sslCount,
+        sizeof(stackSourceLocation),ds->heap,cmp_ssl_addr );
+    stackSourceLocation *ssl = HeapAlloc( ds->heap,0,
+        sslCount*sizeof(stackSourceLocation) );
+    if( ssl_idxs && ssl )
+    {
+      for( i=0; i<sslCount; i++ )
+        ssl[i] = ds->ssl[ssl_idxs[i]];
+      HeapFree( ds->heap,0,ds->ssl );
+      ds->ssl = ssl;
+    }
+    else if( ssl )
+      HeapFree( ds->heap,0,ssl );
+    if( ssl_idxs ) HeapFree( ds->heap,0,ssl_idxs );
+  }
+  // }}}
+
+  if( missFrames ) HeapFree( ds->heap,0,missFrames );
+  HeapFree( ds->heap,0,frames );
+}
+
+static const char *mapOfFile( const wchar_t *name,size_t *size )
+{
+  HANDLE file = CreateFileW( name,GENERIC_READ,FILE_SHARE_READ,
+      NULL,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,0 );
+  if( file==INVALID_HANDLE_VALUE ) return( NULL );
+
+  const char *map = NULL;
+
+  BY_HANDLE_FILE_INFORMATION bhfi;
+  if( GetFileInformationByHandle(file,&bhfi) && (
+#ifndef _WIN64
+        !bhfi.nFileSizeHigh &&
+#else
+        bhfi.nFileSizeHigh ||
+#endif
+        bhfi.nFileSizeLow) )
+  {
+    HANDLE mapping = CreateFileMapping( file,NULL,PAGE_READONLY,0,0,NULL );
+    if( mapping )
     {
       map = MapViewOfFile( mapping,FILE_MAP_READ,0,0,0 );
 
@@ -2655,10 +4349,70 @@ static const char *mapOfFile( const wchar_t *name,size_t *size )
   return( map );
 }
 
+// the mapped file with its line offsets, or NULL if it can't be read
+static sourceFile *sourceFileOf( dbgsym *ds,const wchar_t *filename )
+{
+  sourceFile *sf_a = ds->sourceFile_a;
+  int i;
+  int lru = 0;
+  for( i=0; i<SOURCE_FILE_CACHE; i++ )
+  {
+    sourceFile *sf = sf_a + i;
+    if( sf->filename && !lstrcmpW(sf->filename,filename) )
+    {
+      sf->lastUse = ++ds->sourceFileUse;
+      return( sf->map ? sf : NULL );
+    }
+    if( sf->lastUse<sf_a[lru].lastUse ) lru = i;
+  }
+
+  // files which can't be read are also kept, so they are not tried again
+  HANDLE heap = ds->heap;
+  sourceFile *sf = sf_a + lru;
+  sourceFileClose( sf,heap );
+  sf->lastUse = ++ds->sourceFileUse;
+  int len = lstrlenW( filename ) + 1;
+  sf->filename = HeapAlloc( heap,0,len*2 );
+  if( !sf->filename ) return( NULL );
+  RtlMoveMemory( sf->filename,filename,len*2 );
+
+  size_t size;
+  const char *map = mapOfFile( filename,&size );
+  if( !map ) return( NULL );
+
+  const char *eof = map + size;
+  const char *bol;
+  int line_q = 0;
+  for( bol=map; bol<eof; line_q++ )
+  {
+    const char *eol = memchr( bol,'\n',eof-bol );
+    bol = eol ? eol + 1 : eof;
+  }
+  size_t *lineOfs_a = HeapAlloc( heap,0,(line_q+1)*sizeof(size_t) );
+  if( !lineOfs_a )
+  {
+    UnmapViewOfFile( map );
+    return( NULL );
+  }
+  for( i=0,bol=map; bol<eof; i++ )
+  {
+    lineOfs_a[i] = bol - map;
+    const char *eol = memchr( bol,'\n',eof-bol );
+    bol = eol ? eol + 1 : eof;
+  }
+  lineOfs_a[line_q] = size;
+
+  sf->map = map;
+  sf->lineOfs_a = lineOfs_a;
+  sf->line_q = line_q;
+  return( sf );
+}
+
 static void locOut( textColor *tc,uintptr_t addr,
     const wchar_t *filename,int lineno,int columnno,const char *funcname,
-    options *opt,int indent )
+    dbgsym *ds,int indent )
 {
+  options *opt = ds->opt;
   const wchar_t *printFilename = NULL;
   if( filename )
   {
@@ -2703,57 +4457,49 @@ static void locOut( textColor *tc,uintptr_t addr,
       // show source code {{{
       if( opt->sourceCode )
       {
-        size_t filesize;
-        const char *map = mapOfFile( filename,&filesize );
-        if( map )
+        sourceFile *sf = sourceFileOf( ds,filename );
+        if( sf )
         {
-          const char *bol = map;
-          const char *eof = map + filesize;
+          const char *map = sf->map;
+          const size_t *lineOfs_a = sf->lineOfs_a;
           int firstLine = lineno + 1 - opt->sourceCode;
           if( firstLine<1 ) firstLine = 1;
           int lastLine = lineno - 1 + opt->sourceCode;
+          if( lastLine>sf->line_q ) lastLine = sf->line_q;
           if( firstLine>1 )
             printf( "%i      ...\n",indent );
           int i;
           if( columnno>0 ) columnno--;
-          for( i=1; i<=lastLine; i++ )
+          for( i=firstLine; i<=lastLine; i++ )
           {
-            const char *eol = memchr( bol,'\n',eof-bol );
-            if( !eol ) eol = eof;
-            else eol++;
+            const char *bol = map + lineOfs_a[i-1];
+            const char *eol = map + lineOfs_a[i];
 
-            if( i>=firstLine )
+            if( i==lineno )
             {
-              if( i==lineno )
+              printf( "%i$S  >   ",indent );
+              if( columnno>0 && columnno<eol-bol )
               {
-                printf( "%i$S  >   ",indent );
-                if( columnno>0 && columnno<eol-bol )
-                {
-                  printf( "$N" );
-                  tc->fWriteText( tc,bol,columnno );
-                  bol += columnno;
-                  printf( "$S" );
-                }
-                tc->fWriteText( tc,bol,eol-bol );
                 printf( "$N" );
+                tc->fWriteText( tc,bol,columnno );
+                bol += columnno;
+                printf( "$S" );
               }
-              else
-              {
-                printf( "%i      ",indent );
-                tc->fWriteText( tc,bol,eol-bol );
-              }
+              tc->fWriteText( tc,bol,eol-bol );
+              printf( "$N" );
+            }
+            else
+            {
+              printf( "%i      ",indent );
+              tc->fWriteText( tc,bol,eol-bol );
             }
-
-            bol = eol;
-            if( bol==eof ) break;
           }
-          if( bol>map && bol[-1]!='\n' )
+          const char *end = map + lineOfs_a[lastLine];
+          if( end>map && end[-1]!='\n' )
             printf( "\n" );
-          if( bol!=eof )
+          if( lastLine<sf->line_q )
             printf( "%i      ...\n",indent );
           printf( "%i\n",indent );
-
-          UnmapViewOfFile( map );
         }
       }
       // }}}
@@ -2762,14 +4508,14 @@ static void locOut( textColor *tc,uintptr_t addr,
 }
 
 static void sslOut( textColor *tc,
-    stackSourceLocation *ssl,options *opt,int indent )
+    stackSourceLocation *ssl,dbgsym *ds,int indent )
 {
   uintptr_t addr = ssl->addr;
   sourceLocation *sl = &ssl->sl;
   while( sl )
   {
     locOut( tc,addr,sl->filename,sl->lineno,sl->columnno,sl->funcname,
-        opt,indent );
+        ds,indent );
 
     addr = 0;
     sl = sl->inlineLocation;
@@ -2858,27 +4604,24 @@ static void printStackCount( void **framesV,int fc,
   int j;
   for( j=0; j<fc; )
   {
-    int k;
     uintptr_t frame = frames[j];
-    for( k=0; k<mi_q && (frame<mi_a[k].base ||
-          frame>=mi_a[k].base+mi_a[k].size); k++ );
-    if( k>=mi_q )
+    modInfo *mi = findModule( ds,mi_a,mi_q,frame );
+    if( !mi )
     {
       if( indent>=0 )
-        locOut( tc,frame,L"?",DWST_BASE_ADDR,0,NULL,ds->opt,indent );
+        locOut( tc,frame,L"?",DWST_BASE_ADDR,0,NULL,ds,indent );
       else
         locXml( tc,frame,NULL,0,NULL,NULL );
       j++;
       continue;
     }
-    modInfo *mi = mi_a + k;
 
     int l;
     for( l=j+1; l<fc && frames[l]>=mi->base &&
         frames[l]<mi->base+mi->size; l++ );
 
     if( indent>=0 )
-      locOut( tc,mi->base,mi->path,DWST_BASE_ADDR,0,NULL,ds->opt,indent );
+      locOut( tc,mi->base,mi->path,DWST_BASE_ADDR,0,NULL,ds,indent );
 
     for( ; j<l; j++ )
     {
@@ -2887,13 +4630,13 @@ static void printStackCount( void **framesV,int fc,
       if( !s )
       {
         if( indent>=0 )
-          locOut( tc,frame,mi->path,DWST_NO_DBG_SYM,0,NULL,ds->opt,indent );
+          locOut( tc,frame,mi->path,DWST_NO_DBG_SYM,0,NULL,ds,indent );
         else
           locXml( tc,frame,NULL,0,NULL,mi );
         continue;
       }
       if( indent>=0 )
-        sslOut( tc,s,ds->opt,indent );
+        sslOut( tc,s,ds,indent );
       else
         sslXml( tc,s,mi );
     }
@@ -3015,18 +4758,10 @@ static inline void swap_idxs( int *a,int *b )
   *b = t;
 }
 
-static int *sort_allocations( void *base,int *idxs,int num,int size,
-    HANDLE heap,int (*compar)(const void*,const void*) )
+static void heap_sort_idxs( char *b,int *idxs,int num,int size,
+    int (*compar)(const void*,const void*) )
 {
   int i,c,r;
-  char *b = base;
-
-  if( !idxs )
-  {
-    idxs = HeapAlloc( heap,0,(size_t)num*sizeof(int) );
-    for( i=0; i<num; i++ )
-      idxs[i] = i;
-  }
 
   for( i=num/2-1; i>=0; i-- )
   {
@@ -3055,10 +4790,310 @@ static int *sort_allocations( void *base,int *idxs,int num,int size,
       swap_idxs( idxs+r,idxs+c );
     }
   }
+}
+
+// merges the sorted ranges idxs[0..mid) and idxs[mid..num) via tmp
+static void merge_idxs( char *b,int *idxs,int *tmp,int mid,int num,int size,
+    int (*compar)(const void*,const void*) )
+{
+  if( compar(b+(size_t)idxs[mid-1]*size,b+(size_t)idxs[mid]*size)<=0 )
+    return;
+
+  int l = 0;
+  int r = mid;
+  int t = 0;
+  while( l<mid && r<num )
+  {
+    if( compar(b+(size_t)idxs[l]*size,b+(size_t)idxs[r]*size)<=0 )
+      tmp[t++] = idxs[l++];
+    else
+      tmp[t++] = idxs[r++];
+  }
+  while( l<mid )
+    tmp[t++] = idxs[l++];
+  RtlMoveMemory( idxs,tmp,t*sizeof(int) );
+}
+
+static void merge_sort_idxs( char *b,int *idxs,int *tmp,int num,int size,
+    int (*compar)(const void*,const void*) )
+{
+  if( num<=16 )
+  {
+    int i;
+    for( i=1; i<num; i++ )
+    {
+      int idx = idxs[i];
+      int j;
+      for( j=i; j>0 &&
+          compar(b+(size_t)idxs[j-1]*size,b+(size_t)idx*size)>0; j-- )
+        idxs[j] = idxs[j-1];
+      idxs[j] = idx;
+    }
+    return;
+  }
+
+  int mid = num/2;
+  merge_sort_idxs( b,idxs,tmp,mid,size,compar );
+  merge_sort_idxs( b,idxs+mid,tmp+mid,num-mid,size,compar );
+  merge_idxs( b,idxs,tmp,mid,num,size,compar );
+}
+
+typedef struct
+{
+  char *b;
+  int *idxs;
+  int *tmp;
+  int num;
+  int size;
+  int (*compar)(const void*,const void*);
+}
+sortPart;
+
+static DWORD WINAPI sortPartThread( LPVOID arg )
+{
+  sortPart *sp = arg;
+  merge_sort_idxs( sp->b,sp->idxs,sp->tmp,sp->num,sp->size,sp->compar );
+  return( 0 );
+}
+
+#define SORT_PARTS_MAX 16
+#define SORT_PART_MIN 0x10000
+
+static int *sort_allocations( void *base,int *idxs,int num,int size,
+    HANDLE heap,int (*compar)(const void*,const void*) )
+{
+  int i;
+  char *b = base;
+
+  if( !idxs )
+  {
+    idxs = HeapAlloc( heap,0,(size_t)num*sizeof(int) );
+    for( i=0; i<num; i++ )
+      idxs[i] = i;
+  }
+  if( num<2 ) return( idxs );
+
+  int *tmp = HeapAlloc( heap,0,(size_t)num*sizeof(int) );
+  if( !tmp )
+  {
+    heap_sort_idxs( b,idxs,num,size,compar );
+    return( idxs );
+  }
+
+  // sort big arrays in parts, one thread for each processor
+  int parts = 1;
+  if( num>=SORT_PART_MIN*2 )
+  {
+    SYSTEM_INFO si;
+    GetSystemInfo( &si );
+    while( parts*2<=(int)si.dwNumberOfProcessors &&
+        parts*2<=SORT_PARTS_MAX && num/(parts*2)>=SORT_PART_MIN )
+      parts *= 2;
+  }
+  if( parts<2 )
+    merge_sort_idxs( b,idxs,tmp,num,size,compar );
+  else
+  {
+    sortPart sp[SORT_PARTS_MAX];
+    HANDLE threads[SORT_PARTS_MAX];
+    for( i=0; i<parts; i++ )
+    {
+      int from = (int)( (INT64)num*i/parts );
+      int to = (int)( (INT64)num*(i+1)/parts );
+      sp[i].b = b;
+      sp[i].idxs = idxs + from;
+      sp[i].tmp = tmp + from;
+      sp[i].num = to - from;
+      sp[i].size = size;
+      sp[i].compar = compar;
+      threads[i] = i ? CreateThread( NULL,0,sortPartThread,sp+i,0,NULL ) :
+        NULL;
+    }
+    sortPartThread( sp );
+    for( i=1; i<parts; i++ )
+    {
+      if( threads[i] )
+      {
+        WaitForSingleObject( threads[i],INFINITE );
+        CloseHandle( threads[i] );
+      }
+      else
+        sortPartThread( sp+i );
+    }
+
+    // merge neighboring parts until only one is left
+    for( ; parts>1; parts/=2 )
+    {
+      for( i=0; i<parts; i+=2 )
+      {
+        sortPart *spl = sp + i;
+        sortPart *spr = sp + i + 1;
+        merge_idxs( b,spl->idxs,spl->tmp,spl->num,spl->num+spr->num,
+            size,compar );
+        sp[i/2].idxs = spl->idxs;
+        sp[i/2].tmp = spl->tmp;
+        sp[i/2].num = spl->num + spr->num;
+      }
+    }
+  }
+
+  HeapFree( heap,0,tmp );
 
   return( idxs );
 }
 
+// radix sort of pointer values
+static void sort_ptrs( uintptr_t *ptrs,int num,HANDLE heap )
+{
+  if( num<2 ) return;
+
+  uintptr_t *tmp = HeapAlloc( heap,0,(size_t)num*sizeof(uintptr_t) );
+  if( !tmp )
+  {
+    int *idxs = sort_allocations( ptrs,NULL,num,sizeof(uintptr_t),
+        heap,cmp_ptr );
+    if( !idxs ) return;
+    int i;
+    for( i=0; i<num; i++ )
+    {
+      // sorted values are collected in place of the already used ones
+      int idx = idxs[i];
+      while( idx<i ) idx = idxs[idx];
+      uintptr_t t = ptrs[i];
+      ptrs[i] = ptrs[idx];
+      ptrs[idx] = t;
+      idxs[i] = idx;
+    }
+    HeapFree( heap,0,idxs );
+    return;
+  }
+
+  uintptr_t *src = ptrs;
+  uintptr_t *dst = tmp;
+  unsigned shift;
+  for( shift=0; shift<sizeof(uintptr_t)*8; shift+=8 )
+  {
+    int count[256];
+    RtlZeroMemory( count,sizeof(count) );
+    int i;
+    for( i=0; i<num; i++ )
+      count[(src[i]>>shift)&0xff]++;
+    // skip the digit if all values have the same
+    if( count[(src[0]>>shift)&0xff]==num ) continue;
+
+    int pos = 0;
+    for( i=0; i<256; i++ )
+    {
+      int c = count[i];
+      count[i] = pos;
+      pos += c;
+    }
+    for( i=0; i<num; i++ )
+      dst[count[(src[i]>>shift)&0xff]++] = src[i];
+
+    uintptr_t *t = src;
+    src = dst;
+    dst = t;
+  }
+  if( src!=ptrs )
+    RtlMoveMemory( ptrs,src,num*sizeof(uintptr_t) );
+
+  HeapFree( heap,0,tmp );
+}
+
+// integer sort keys of allocations
+enum
+{
+  SK_ID,
+  SK_FT,
+  SK_SIZE_DESC,
+#ifndef NO_THREADS
+  SK_THREAD_DESC,
+#endif
+  SK_LT,
+};
+
+// stable radix sort of the allocation indexes,
+// key_a is ordered from the least to the most significant key,
+// returns 0 if the temporary buffers can't be allocated
+static int radix_sort_allocations( allocation *alloc_a,int *idxs,int num,
+    HANDLE heap,const int *key_a,int key_q )
+{
+  if( num<2 ) return( 1 );
+
+  UINT64 *keys = HeapAlloc( heap,0,(size_t)num*2*sizeof(UINT64) );
+  int *tmp = keys ? HeapAlloc( heap,0,(size_t)num*sizeof(int) ) : NULL;
+  if( !tmp )
+  {
+    if( keys ) HeapFree( heap,0,keys );
+    return( 0 );
+  }
+
+  int k;
+  for( k=0; k<key_q; k++ )
+  {
+    int i;
+    UINT64 *srcKey = keys;
+    UINT64 *dstKey = keys + num;
+    for( i=0; i<num; i++ )
+    {
+      allocation *a = alloc_a + idxs[i];
+      UINT64 key;
+      switch( key_a[k] )
+      {
+        case SK_ID:          key = a->id; break;
+        case SK_FT:          key = a->ft; break;
+        case SK_SIZE_DESC:   key = ~(UINT64)a->size; break;
+#ifndef NO_THREADS
+        case SK_THREAD_DESC: key = ~(UINT64)(unsigned)a->threadNum; break;
+#endif
+        default:             key = a->lt; break;
+      }
+      srcKey[i] = key;
+    }
+
+    int *src = idxs;
+    int *dst = tmp;
+    unsigned shift;
+    for( shift=0; shift<64; shift+=8 )
+    {
+      int count[256];
+      RtlZeroMemory( count,sizeof(count) );
+      for( i=0; i<num; i++ )
+        count[(srcKey[i]>>shift)&0xff]++;
+      // skip the digit if all keys have the same
+      if( count[(srcKey[0]>>shift)&0xff]==num ) continue;
+
+      int pos = 0;
+      for( i=0; i<256; i++ )
+      {
+        int c = count[i];
+        count[i] = pos;
+        pos += c;
+      }
+      for( i=0; i<num; i++ )
+      {
+        int d = count[(srcKey[i]>>shift)&0xff]++;
+        dst[d] = src[i];
+        dstKey[d] = srcKey[i];
+      }
+
+      int *t = src;
+      src = dst;
+      dst = t;
+      UINT64 *tk = srcKey;
+      srcKey = dstKey;
+      dstKey = tk;
+    }
+    if( src!=idxs )
+      RtlMoveMemory( idxs,src,num*sizeof(int) );
+  }
+
+  HeapFree( heap,0,tmp );
+  HeapFree( heap,0,keys );
+  return( 1 );
+}
+
 static int cmp_merge_allocation( const void *av,const void *bv )
 {
   const allocation *a = av;
@@ -3085,7 +5120,94 @@ static int cmp_merge_allocation( const void *av,const void *bv )
   return( a->id>b->id ? 1 : -1 );
 }
 
-static int cmp_time_allocation( const void *av,const void *bv )
+// hash of everything cmp_merge_allocation() compares, except the id
+static DWORD merge_hash( const allocation *a )
+{
+  DWORD hash = 2166136261U;
+  hash = ( hash^a->lt )*16777619U;
+  hash = ( hash^(DWORD)a->size )*16777619U;
+  hash = ( hash^a->ft )*16777619U;
+#ifndef NO_THREADS
+  hash = ( hash^a->threadNum )*16777619U;
+#endif
+  const uintptr_t *frames = (const uintptr_t*)a->frames;
+  int c;
+  for( c=0; c<PTRS && frames[c]; c++ )
+  {
+    hash = ( hash^(DWORD)frames[c] )*16777619U;
+#ifdef _WIN64
+    hash = ( hash^(DWORD)(frames[c]>>32) )*16777619U;
+#endif
+  }
+  return( hash );
+}
+
+// merges identical leaks with a hash table,
+// the leak with the lowest id represents the merged group
+static int merge_allocations( allocation *alloc_a,int *alloc_idxs,
+    int alloc_q,HANDLE heap )
+{
+  int hash_q = 64;
+  while( hash_q<alloc_q*2 ) hash_q <<= 1;
+  int *hash_a = HeapAlloc( heap,HEAP_ZERO_MEMORY,hash_q*sizeof(int) );
+  if( !hash_a ) return( -1 );
+
+  int i;
+  for( i=0; i<alloc_q; i++ )
+  {
+    allocation *a = alloc_a + i;
+    int h = merge_hash( a )&( hash_q-1 );
+    while( hash_a[h] )
+    {
+      allocation *rep = alloc_a + ( hash_a[h]-1 );
+      int c = cmp_merge_allocation( rep,a );
+      if( c>=-1 && c<=1 ) break;
+      h = ( h+1 )&( hash_q-1 );
+    }
+    if( !hash_a[h] )
+      hash_a[h] = i + 1;
+    else
+    {
+      allocation *rep = alloc_a + ( hash_a[h]-1 );
+      if( a->id<rep->id )
+      {
+        a->count = rep->count + 1;
+        hash_a[h] = i + 1;
+      }
+      else
+        rep->count++;
+    }
+  }
+
+  int combined_q = 0;
+  for( i=0; i<hash_q; i++ )
+  {
+    if( hash_a[i] )
+      alloc_idxs[combined_q++] = hash_a[i] - 1;
+  }
+
+  HeapFree( heap,0,hash_a );
+
+  return( combined_q );
+}
+
+static int cmp_time_allocation( const void *av,const void *bv )
+{
+  const allocation *a = av;
+  const allocation *b = bv;
+
+  if( a->lt>b->lt ) return( 2 );
+  if( a->lt<b->lt ) return( -2 );
+
+#ifndef NO_THREADS
+  if( a->threadNum>b->threadNum ) return( -2 );
+  if( a->threadNum<b->threadNum ) return( 2 );
+#endif
+
+  return( a->id>b->id ? 1 : -1 );
+}
+
+static int cmp_age_allocation( const void *av,const void *bv )
 {
   const allocation *a = av;
   const allocation *b = bv;
@@ -3093,11 +5215,6 @@ static int cmp_time_allocation( const void *av,const void *bv )
   if( a->lt>b->lt ) return( 2 );
   if( a->lt<b->lt ) return( -2 );
 
-#ifndef NO_THREADS
-  if( a->threadNum>b->threadNum ) return( -2 );
-  if( a->threadNum<b->threadNum ) return( 2 );
-#endif
-
   return( a->id>b->id ? 1 : -1 );
 }
 
@@ -3149,6 +5266,53 @@ static int cmp_frame_allocation( const void *av,const void *bv )
   return( a->id>b->id ? 1 : -1 );
 }
 
+// order of leaks with identical stacks
+static int cmp_leaf_allocation( const void *av,const void *bv )
+{
+  const allocation *a = av;
+  const allocation *b = bv;
+
+  size_t sizeA = a->size*a->count;
+  size_t sizeB = b->size*b->count;
+  if( sizeA>sizeB ) return( -2 );
+  if( sizeA<sizeB ) return( 2 );
+
+#ifndef NO_THREADS
+  if( a->threadNum>b->threadNum ) return( -2 );
+  if( a->threadNum<b->threadNum ) return( 2 );
+#endif
+
+  return( a->id>b->id ? 1 : -1 );
+}
+
+// stable partition by leak type
+static int partition_allocations( allocation *alloc_a,int *alloc_idxs,
+    int alloc_q,HANDLE heap )
+{
+  int *tmp = HeapAlloc( heap,0,alloc_q*sizeof(int) );
+  if( !tmp ) return( 0 );
+
+  int lt_s[LT_COUNT];
+  int i;
+  for( i=0; i<LT_COUNT; i++ )
+    lt_s[i] = 0;
+  for( i=0; i<alloc_q; i++ )
+    lt_s[alloc_a[alloc_idxs[i]].lt]++;
+  int pos = 0;
+  for( i=0; i<LT_COUNT; i++ )
+  {
+    int q = lt_s[i];
+    lt_s[i] = pos;
+    pos += q;
+  }
+  for( i=0; i<alloc_q; i++ )
+    tmp[lt_s[alloc_a[alloc_idxs[i]].lt]++] = alloc_idxs[i];
+
+  RtlMoveMemory( alloc_idxs,tmp,alloc_q*sizeof(int) );
+  HeapFree( heap,0,tmp );
+  return( 1 );
+}
+
 // }}}
 // leak recording status {{{
 
@@ -3262,23 +5426,25 @@ typedef struct stackGroup
   struct stackGroup *child_a;
   int *childSorted_a;
   int child_q;
+  int child_s;
   size_t id;
 }
 stackGroup;
 
-static void stackChildGrouping(
-    allocation *alloc_a,const int *alloc_idxs,int alloc_q,
-    int alloc_s,HANDLE heap,stackGroup *sgParent,
-    int stackIdx,int stackIndent )
+static stackGroup *addStackGroup( stackGroup *sgParent,HANDLE heap,
+    int alloc_s,int alloc_q,int stackIdx,int stackIndent )
 {
-  sgParent->child_q++;
-  if( !sgParent->child_a )
-    sgParent->child_a = HeapAlloc( heap,0,
-        (size_t)sgParent->child_q*sizeof(stackGroup) );
-  else
-    sgParent->child_a = HeapReAlloc( heap,0,
-        sgParent->child_a,(size_t)sgParent->child_q*sizeof(stackGroup) );
-  stackGroup *sg = sgParent->child_a + ( sgParent->child_q - 1 );
+  if( sgParent->child_q>=sgParent->child_s )
+  {
+    sgParent->child_s = sgParent->child_s ? sgParent->child_s*2 : 4;
+    if( !sgParent->child_a )
+      sgParent->child_a = HeapAlloc( heap,0,
+          (size_t)sgParent->child_s*sizeof(stackGroup) );
+    else
+      sgParent->child_a = HeapReAlloc( heap,0,
+          sgParent->child_a,(size_t)sgParent->child_s*sizeof(stackGroup) );
+  }
+  stackGroup *sg = sgParent->child_a + sgParent->child_q++;
   sg->stackStart = stackIdx;
   sg->stackIndent = stackIndent;
   sg->allocStart = alloc_s;
@@ -3288,6 +5454,19 @@ static void stackChildGrouping(
   sg->child_a = NULL;
   sg->childSorted_a = NULL;
   sg->child_q = 0;
+  sg->child_s = 0;
+  return( sg );
+}
+
+// only neighbors in alloc_idxs are grouped, so the stacks are either
+// sorted with cmp_frame_allocation(), or in allocation order (-g3/-g4)
+static void stackChildGrouping(
+    allocation *alloc_a,const int *alloc_idxs,int alloc_q,
+    int alloc_s,HANDLE heap,stackGroup *sgParent,
+    int stackIdx,int stackIndent )
+{
+  stackGroup *sg = addStackGroup( sgParent,heap,
+      alloc_s,alloc_q,stackIdx,stackIndent );
 
   int i = 0;
   int startStackIdx = stackIdx++;
@@ -3339,6 +5518,280 @@ static void stackChildGrouping(
   sgParent->allocSumSize += sg->allocSumSize;
 }
 
+// groups of identical outermost frame, all of the same leak type
+static void stackRunGrouping(
+    allocation *alloc_a,const int *alloc_idxs,int alloc_q,
+    int alloc_s,HANDLE heap,stackGroup *sgParent )
+{
+  int i;
+  for( i=0; i<alloc_q; )
+  {
+    allocation *a = alloc_a + alloc_idxs[i];
+    int startIdx = i;
+    int fc = a->frameCount;
+    void *cmpFrame = fc ? a->frames[fc-1] : NULL;
+
+    for( i++; i<alloc_q; i++ )
+    {
+      a = alloc_a + alloc_idxs[i];
+      fc = a->frameCount;
+      void *frame = fc ? a->frames[fc-1] : NULL;
+      if( cmpFrame!=frame ) break;
+    }
+    stackChildGrouping( alloc_a,alloc_idxs+startIdx,i-startIdx,
+        alloc_s+startIdx,heap,sgParent,
+        0,1 );
+  }
+}
+
+// stack trie {{{
+
+// all stacks are inserted into a prefix tree (starting with the outermost
+// frame), so the grouping doesn't need a full sort of the allocations
+
+typedef struct
+{
+  void *frame;
+  int parent;
+  int child;
+  int next;
+  // allocations with their innermost frame here
+  int leaf;
+  int leafLast;
+  // range in the reordered alloc_idxs (whole subtree)
+  int allocStart;
+  int allocCount;
+}
+stackTrieNode;
+
+typedef struct
+{
+  allocation *alloc_a;
+  const int *alloc_idxs;
+  int *order_a;
+  int order_q;
+  int alloc_s;
+  int *leafNext;
+  stackTrieNode *node_a;
+  int node_q;
+  int *hash_a;
+  size_t hashMask;
+  HANDLE heap;
+  int (*cmpLeaf)(const void*,const void*);
+}
+stackTrie;
+
+static int stackTrieChild( stackTrie *st,int parent,void *frame )
+{
+  uintptr_t f = (uintptr_t)frame;
+#ifdef _WIN64
+  f ^= f>>32;
+#endif
+  size_t h = ( (unsigned)f^((unsigned)parent*0x9e3779b9U) )*2654435761U;
+  size_t pos;
+  for( pos=(h^(h>>15))&st->hashMask; st->hash_a[pos];
+      pos=(pos+1)&st->hashMask )
+  {
+    int idx = st->hash_a[pos] - 1;
+    stackTrieNode *n = st->node_a + idx;
+    if( n->frame==frame && n->parent==parent ) return( idx );
+  }
+
+  int idx = st->node_q++;
+  st->hash_a[pos] = idx + 1;
+  stackTrieNode *n = st->node_a + idx;
+  n->frame = frame;
+  n->parent = parent;
+  n->child = -1;
+  n->next = st->node_a[parent].child;
+  st->node_a[parent].child = idx;
+  n->leaf = n->leafLast = -1;
+  return( idx );
+}
+
+static int cmp_trie_frame( const void *av,const void *bv )
+{
+  const stackTrieNode *a = av;
+  const stackTrieNode *b = bv;
+
+  return( (uintptr_t)a->frame>(uintptr_t)b->frame ? 1 : -1 );
+}
+
+// depth-first order, the same as sorted with cmp_frame_allocation()
+static int stackTrieOrder( stackTrie *st,int t )
+{
+  stackTrieNode *n = st->node_a + t;
+  n->allocStart = st->order_q;
+  int i;
+  for( i=n->leaf; i>=0; i=st->leafNext[i] )
+    st->order_a[st->order_q++] = st->alloc_idxs[i];
+  int leaf_q = st->order_q - n->allocStart;
+  if( leaf_q>1 )
+    sort_allocations( st->alloc_a,st->order_a+n->allocStart,leaf_q,
+        sizeof(allocation),st->heap,st->cmpLeaf );
+
+  int child_q = 0;
+  for( i=n->child; i>=0; i=st->node_a[i].next )
+    child_q++;
+  if( child_q>1 )
+  {
+    int *child_idxs = HeapAlloc( st->heap,0,child_q*sizeof(int) );
+    if( !child_idxs ) return( 0 );
+    child_q = 0;
+    for( i=n->child; i>=0; i=st->node_a[i].next )
+      child_idxs[child_q++] = i;
+    sort_allocations( st->node_a,child_idxs,child_q,
+        sizeof(stackTrieNode),st->heap,cmp_trie_frame );
+    n->child = child_idxs[0];
+    for( i=0; i<child_q; i++ )
+      st->node_a[child_idxs[i]].next = i+1<child_q ? child_idxs[i+1] : -1;
+    HeapFree( st->heap,0,child_idxs );
+  }
+
+  for( i=n->child; i>=0; i=st->node_a[i].next )
+    if( !stackTrieOrder(st,i) ) return( 0 );
+  n->allocCount = st->order_q - n->allocStart;
+  return( 1 );
+}
+
+// same groups as stackChildGrouping() of the sorted allocations
+static void stackTrieGroup( stackTrie *st,int t,stackGroup *sgParent,
+    int stackIdx,int stackIndent )
+{
+  stackTrieNode *n = st->node_a + t;
+  int allocStart = n->allocStart;
+  int allocCount = n->allocCount;
+  stackGroup *sg = addStackGroup( sgParent,st->heap,
+      st->alloc_s+allocStart,allocCount,stackIdx,stackIndent );
+
+  int startStackIdx = stackIdx++;
+  while( n->leaf<0 && st->node_a[n->child].next<0 )
+  {
+    n = st->node_a + n->child;
+    stackIdx++;
+  }
+  if( n->leaf<0 )
+  {
+    int i;
+    for( i=n->child; i>=0; i=st->node_a[i].next )
+      stackTrieGroup( st,i,sg,stackIdx,stackIndent+1 );
+  }
+
+  const int *alloc_idxs = st->order_a + allocStart;
+  allocation *a = st->alloc_a + alloc_idxs[0];
+  sg->stackCount = stackIdx - startStackIdx;
+  sg->id = a->id;
+
+  if( stackIdx==a->frameCount )
+  {
+    int curAllocSum = 0;
+    size_t curAllocSumSize = 0;
+    int i;
+    for( i=0; i<allocCount; i++ )
+    {
+      a = st->alloc_a + alloc_idxs[i];
+      curAllocSum += a->count;
+      curAllocSumSize += a->size*a->count;
+    }
+    sg->allocSum += curAllocSum;
+    sg->allocSumSize += curAllocSumSize;
+  }
+
+  sgParent->allocSum += sg->allocSum;
+  sgParent->allocSumSize += sg->allocSumSize;
+}
+
+// alloc_idxs (all of the same leak type) is reordered like sorted with
+// cmp_frame_allocation(), and cmpLeaf for identical stacks
+static void stackTrieGrouping(
+    allocation *alloc_a,int *alloc_idxs,int alloc_q,
+    int alloc_s,HANDLE heap,stackGroup *sgParent,
+    int (*cmpLeaf)(const void*,const void*) )
+{
+  if( !alloc_q ) return;
+
+  stackTrie st;
+  RtlZeroMemory( &st,sizeof(stackTrie) );
+  st.alloc_a = alloc_a;
+  st.alloc_idxs = alloc_idxs;
+  st.alloc_s = alloc_s;
+  st.heap = heap;
+  st.cmpLeaf = cmpLeaf;
+
+  int i;
+  size_t node_s = 1;
+  for( i=0; i<alloc_q; i++ )
+    node_s += alloc_a[alloc_idxs[i]].frameCount;
+  size_t hash_s = 64;
+  while( hash_s<node_s*2 ) hash_s *= 2;
+  st.hashMask = hash_s - 1;
+
+  st.node_a = HeapAlloc( heap,0,node_s*sizeof(stackTrieNode) );
+  st.hash_a = HeapAlloc( heap,HEAP_ZERO_MEMORY,hash_s*sizeof(int) );
+  st.leafNext = HeapAlloc( heap,0,alloc_q*sizeof(int) );
+  st.order_a = HeapAlloc( heap,0,alloc_q*sizeof(int) );
+  int ok = st.node_a && st.hash_a && st.leafNext && st.order_a;
+
+  if( ok )
+  {
+    stackTrieNode *root = st.node_a;
+    RtlZeroMemory( root,sizeof(stackTrieNode) );
+    root->child = root->next = root->leaf = root->leafLast = -1;
+    st.node_q = 1;
+
+    for( i=0; i<alloc_q; i++ )
+    {
+      allocation *a = alloc_a + alloc_idxs[i];
+      int t = 0;
+      int c;
+      for( c=a->frameCount-1; c>=0; c-- )
+        t = stackTrieChild( &st,t,a->frames[c] );
+
+      stackTrieNode *n = st.node_a + t;
+      st.leafNext[i] = -1;
+      if( n->leafLast>=0 )
+        st.leafNext[n->leafLast] = i;
+      else
+        n->leaf = i;
+      n->leafLast = i;
+    }
+
+    ok = stackTrieOrder( &st,0 );
+  }
+
+  if( ok )
+  {
+    stackTrieNode *root = st.node_a;
+    if( root->leaf>=0 )
+    {
+      // without any stack frames
+      int leaf_q = root->allocCount;
+      for( i=root->child; i>=0; i=st.node_a[i].next )
+        leaf_q -= st.node_a[i].allocCount;
+      stackChildGrouping( alloc_a,st.order_a,leaf_q,alloc_s,heap,sgParent,
+          0,1 );
+    }
+    for( i=root->child; i>=0; i=st.node_a[i].next )
+      stackTrieGroup( &st,i,sgParent,0,1 );
+
+    RtlMoveMemory( alloc_idxs,st.order_a,alloc_q*sizeof(int) );
+  }
+
+  if( st.node_a ) HeapFree( heap,0,st.node_a );
+  if( st.hash_a ) HeapFree( heap,0,st.hash_a );
+  if( st.leafNext ) HeapFree( heap,0,st.leafNext );
+  if( st.order_a ) HeapFree( heap,0,st.order_a );
+
+  if( !ok )
+  {
+    sort_allocations( alloc_a,alloc_idxs,alloc_q,sizeof(allocation),
+        heap,cmp_frame_allocation );
+    stackRunGrouping( alloc_a,alloc_idxs,alloc_q,alloc_s,heap,sgParent );
+  }
+}
+
+// }}}
+
 static int cmp_stack_group( const void *av,const void *bv )
 {
   const stackGroup *a = av;
@@ -3362,7 +5815,16 @@ static void sortStackGroup( stackGroup *sg,HANDLE heap )
       sizeof(stackGroup),heap,cmp_stack_group );
 }
 
-static void printStackGroup( stackGroup *sg,
+static DWORD counterToMs( appData *ad,UINT64 counter )
+{
+  if( counter<ad->startCounter || !ad->counterFreq ) return( 0 );
+
+  LARGE_INTEGER li;
+  li.QuadPart = ( counter-ad->startCounter )*1000;
+  return( div64(li.LowPart,li.HighPart,ad->counterFreq) );
+}
+
+static void printStackGroup( appData *ad,stackGroup *sg,
     allocation *alloc_a,const int *alloc_idxs,
 #ifndef NO_THREADS
     threadInfo *threadName_a,int threadName_q,
@@ -3381,7 +5843,7 @@ static void printStackGroup( stackGroup *sg,
   for( i=0; i<child_q; i++ )
   {
     int idx = childSorted_a ? childSorted_a[i] : i;
-    printStackGroup( child_a+idx,alloc_a,alloc_idxs,
+    printStackGroup( ad,child_a+idx,alloc_a,alloc_idxs,
 #ifndef NO_THREADS
         threadName_a,threadName_q,
 #endif
@@ -3414,6 +5876,8 @@ static void printStackGroup( stackGroup *sg,
       else
         printf( "%E$W%d sample%s ",indent,a->count,a->count>1?"s":NULL );
       printf( "$N(#%U)",a->id );
+      if( opt->groupLeaks==4 && !sampling )
+        printf( " $I+%m$N",counterToMs(ad,a->timestamp) );
       printThreadName( a->threadNum );
       if( allocCount>1 )
         printStackCount( NULL,0,NULL,0,ds,a->ft,indent );
@@ -3581,25 +6045,259 @@ static void freeStackGroup( stackGroup *sg,HANDLE heap )
     HeapFree( heap,0,sg->childSorted_a );
 }
 
+// only keeps the biggest groups, and removes the others from the sums
+static void limitStackGroup( stackGroup *sg,int top,HANDLE heap )
+{
+  int i;
+  int child_q = sg->child_q;
+  if( top<=0 || child_q<=top ) return;
+
+  int *childSorted_a = sg->childSorted_a;
+  stackGroup *child_a = sg->child_a;
+  if( childSorted_a )
+  {
+    // keep the biggest groups in sorted order at the start of child_a
+    stackGroup *top_a = HeapAlloc( heap,0,top*sizeof(stackGroup) );
+    if( !top_a ) return;
+    for( i=0; i<top; i++ )
+      RtlMoveMemory( top_a+i,child_a+childSorted_a[i],sizeof(stackGroup) );
+    for( i=top; i<child_q; i++ )
+    {
+      stackGroup *sgc = child_a + childSorted_a[i];
+      sg->allocSum -= sgc->allocSum;
+      sg->allocSumSize -= sgc->allocSumSize;
+      freeStackGroup( sgc,heap );
+    }
+    HeapFree( heap,0,child_a );
+    HeapFree( heap,0,childSorted_a );
+    sg->child_a = top_a;
+    sg->child_s = top;
+    sg->childSorted_a = NULL;
+  }
+  else
+  {
+    // the biggest groups keep the allocation order of -g3/-g4
+    unsigned char *keep_a = HeapAlloc( heap,HEAP_ZERO_MEMORY,child_q );
+    if( !keep_a ) return;
+    int *sorted_a = sort_allocations( child_a,NULL,child_q,
+        sizeof(stackGroup),heap,cmp_stack_group );
+    if( !sorted_a )
+    {
+      HeapFree( heap,0,keep_a );
+      return;
+    }
+    for( i=0; i<top; i++ )
+      keep_a[sorted_a[i]] = 1;
+    HeapFree( heap,0,sorted_a );
+
+    int kept = 0;
+    for( i=0; i<child_q; i++ )
+    {
+      stackGroup *sgc = child_a + i;
+      if( keep_a[i] )
+      {
+        if( kept<i )
+          RtlMoveMemory( child_a+kept,sgc,sizeof(stackGroup) );
+        kept++;
+        continue;
+      }
+      sg->allocSum -= sgc->allocSum;
+      sg->allocSumSize -= sgc->allocSumSize;
+      freeStackGroup( sgc,heap );
+    }
+    HeapFree( heap,0,keep_a );
+  }
+  sg->child_q = top;
+}
+
+// marks the leaks whose stacks are printed
+static void markPrintedLeaks( stackGroup *sg,allocation *alloc_a,
+    const int *alloc_idxs,size_t minLeakSize,unsigned char *printed )
+{
+  if( sg->allocSumSize<minLeakSize ) return;
+
+  int i;
+  int allocStart = sg->allocStart;
+  int allocCount = sg->allocCount;
+  if( allocCount )
+  {
+    // common stack of the group
+    if( sg->stackCount )
+      printed[alloc_idxs[allocStart]] = 1;
+
+    allocation *a = alloc_a + alloc_idxs[allocStart];
+    if( sg->stackStart+sg->stackCount==a->frameCount )
+    {
+      for( i=0; i<allocCount; i++ )
+      {
+        int idx = alloc_idxs[allocStart+i];
+        a = alloc_a + idx;
+        if( a->size*a->count>=minLeakSize )
+          printed[idx] = 1;
+      }
+    }
+  }
+
+  stackGroup *child_a = sg->child_a;
+  int child_q = sg->child_q;
+  for( i=0; i<child_q; i++ )
+    markPrintedLeaks( child_a+i,alloc_a,alloc_idxs,minLeakSize,printed );
+}
+
 static void printFullStackGroupSvg( appData *ad,stackGroup *sg,textColor *tc,
     allocation *alloc_a,const int *alloc_idxs,
 #ifndef NO_THREADS
     threadInfo *threadName_a,int threadName_q,
 #endif
-    modInfo *mi_a,int mi_q,dbgsym *ds,
-    const char *groupName,const char *groupTypeName,int sampling );
+    modInfo *mi_a,int mi_q,dbgsym *ds,
+    const char *groupName,const char *groupTypeName,int sampling );
+static void writeFlameHeader( textColor *tc,appData *ad );
+static void writeFlameFooter( textColor *tc,appData *ad,dbgsym *ds );
+static void printFullStackGroupFlame( appData *ad,stackGroup *sg,
+    textColor *tc,allocation *alloc_a,const int *alloc_idxs,
+    modInfo *mi_a,int mi_q,dbgsym *ds,const char *fullName,int sampling );
+static void printFullStackGroupPprof( stackGroup *sg,textColor *tc,
+    allocation *alloc_a,const int *alloc_idxs,modInfo *mi_a,int mi_q,
+    dbgsym *ds,const char *fullName,int sampling );
+static void printSampleTrace( appData *ad,textColor *tc,
+    allocation *alloc_a,int alloc_q,
+#ifndef NO_THREADS
+    threadInfo *threadName_a,int threadName_q,
+#endif
+    modInfo *mi_a,int mi_q,dbgsym *ds );
+
+// sum of leaks allocated in time ranges which double in length
+static void printLeakTimes( appData *ad,
+    allocation *alloc_a,const int *alloc_idxs,int alloc_q,int lt,
+    textColor *tc )
+{
+  int timeCount[33];
+  size_t timeSize[33];
+  RtlZeroMemory( timeCount,sizeof(timeCount) );
+  RtlZeroMemory( timeSize,sizeof(timeSize) );
+  int i;
+  for( i=0; i<alloc_q; i++ )
+  {
+    allocation *a = alloc_a + alloc_idxs[i];
+    if( a->lt!=(leakType)lt ) continue;
+    DWORD sec = counterToMs( ad,a->timestamp )/1000;
+    int t = 0;
+    while( sec ) { t++; sec >>= 1; }
+    timeCount[t] += a->count;
+    timeSize[t] += a->size*a->count;
+  }
+
+  printf( "  $Wallocation time:\n" );
+  for( i=0; i<33; i++ )
+  {
+    if( !timeCount[i] ) continue;
+    DWORD start = i ? 1U<<(i-1) : 0;
+    printf( "    $I%t$N - $I%t$N: %B / %d\n",
+        start,i<32?1U<<i:(DWORD)-1,timeSize[i],timeCount[i] );
+  }
+}
+
+// everything written until seekBackEnd() is overwritten by the next output
+static int seekBackBegin( textColor *tc,LARGE_INTEGER *pos )
+{
+  flushText( tc );
+
+  // a compressed stream can't be continued after the footer,
+  // so everything up to here becomes a complete gzip member,
+  // and the footer a separate one, which is later overwritten
+  if( tc->gz && tc->gz->started ) gzipEnd( tc->gz );
+
+  pos->LowPart = pos->HighPart = 0;
+  return( SetFilePointerEx(tc->out,*pos,pos,FILE_CURRENT) );
+}
+
+static void seekBackEnd( textColor *tc,LARGE_INTEGER pos )
+{
+  flushText( tc );
+  if( tc->gz )
+  {
+    gzipEnd( tc->gz );
+    SetEndOfFile( tc->out );
+  }
+  SetFilePointerEx( tc->out,pos,NULL,FILE_BEGIN );
+}
+
+static void writeFileSeekBack( textColor *tc,const char *text )
+{
+  if( !tc || !text || !text[0] ) return;
+
+  LARGE_INTEGER pos;
+  if( !seekBackBegin(tc,&pos) ) return;
+  tc->fWriteText( tc,text,lstrlen(text) );
+  seekBackEnd( tc,pos );
+}
+
+// leak groups for the output threads of printLeaks()
+typedef struct
+{
+  appData *ad;
+  dbgsym *ds;
+  dbgsym *dsXml;
+  textColor *tcSvg;
+  stackGroup *sg_a;
+  int lDetails;
+  allocation *alloc_a;
+  const int *alloc_idxs;
+  int combined_q;
+#ifndef NO_THREADS
+  threadInfo *threadName_a;
+  int threadName_q;
+#endif
+  modInfo *mi_a;
+  int mi_q;
+  const char **leakTypeNames;
+  const char **leakTypeNamesRef;
+  const char *groupName;
+  int sampling;
+}
+leakReport;
+
+static DWORD WINAPI leakXmlThread( LPVOID arg )
+{
+  leakReport *lr = arg;
+
+  int xmlRecordNum = 0;
+  int l;
+  for( l=0; l<lr->lDetails; l++ )
+  {
+    stackGroup *sg = lr->sg_a + l;
+    if( !sg->allocSum ) continue;
+    xmlRecordNum = printStackGroupXml( sg,lr->alloc_a,lr->alloc_idxs,
+        lr->combined_q,
+#ifndef NO_THREADS
+        lr->threadName_a,lr->threadName_q,
+#endif
+        lr->mi_a,lr->mi_q,lr->dsXml,lr->leakTypeNames,xmlRecordNum,
+        lr->sampling );
+  }
 
-static void writeFileSeekBack( textColor *tc,const char *text )
+  return( 0 );
+}
+
+static DWORD WINAPI leakSvgThread( LPVOID arg )
 {
-  if( !tc || !text || !text[0] ) return;
+  leakReport *lr = arg;
 
-  LARGE_INTEGER pos;
-  pos.LowPart = pos.HighPart = 0;
-  if( SetFilePointerEx(tc->out,pos,&pos,FILE_CURRENT) )
+  int l;
+  for( l=0; l<lr->lDetails; l++ )
   {
-    tc->fWriteText( tc,text,lstrlen(text) );
-    SetFilePointerEx( tc->out,pos,NULL,FILE_BEGIN );
+    stackGroup *sg = lr->sg_a + l;
+    if( !sg->allocSum ) continue;
+    printFullStackGroupSvg( lr->ad,sg,lr->tcSvg,lr->alloc_a,lr->alloc_idxs,
+#ifndef NO_THREADS
+        lr->threadName_a,lr->threadName_q,
+#endif
+        lr->mi_a,lr->mi_q,lr->ds,lr->groupName,
+        lr->leakTypeNamesRef ? lr->leakTypeNamesRef[l] : NULL,
+        lr->sampling );
   }
+
+  return( 0 );
 }
 
 static void printLeaks( allocation *alloc_a,int alloc_q,
@@ -3633,6 +6331,22 @@ static void printLeaks( allocation *alloc_a,int alloc_q,
   int combined_q = alloc_q;
   for( i=0; i<alloc_q; i++ )
     alloc_a[i].count = 1;
+  // the trace needs all samples, not only the merged ones
+  int sampleTrace = sampling && tcSvg && ad->svgFormat==FLAME_TRACE;
+  if( sampleTrace )
+  {
+    uintptr_t threadInitAddr = ds->threadInitAddr;
+    for( i=0; i<alloc_q; i++ )
+    {
+      allocation *a = alloc_a + i;
+      uintptr_t *frames = (uintptr_t*)a->frames;
+      int c;
+      for( c=0; c<PTRS && frames[c] && frames[c]!=threadInitAddr; c++ )
+        frames[c]--;
+      a->frameCount = c;
+    }
+  }
+  int showTime = opt->groupLeaks==4 && !sampling;
   int *alloc_idxs = NULL;
   if( leakDetails )
   {
@@ -3644,12 +6358,39 @@ static void printLeaks( allocation *alloc_a,int alloc_q,
   // merge identical leaks {{{
   if( opt->groupLeaks && leakDetails )
   {
-    if( opt->groupLeaks!=3 )
-      sort_allocations( alloc_a,alloc_idxs,alloc_q,sizeof(allocation),
-          heap,cmp_merge_allocation );
+    // without time ordering the merge needs no sorting
+    combined_q = opt->groupLeaks<3 ?
+      merge_allocations( alloc_a,alloc_idxs,alloc_q,heap ) : -1;
+  }
+  if( opt->groupLeaks && leakDetails && combined_q<0 )
+  {
+    if( opt->groupLeaks==3 )
+    {
+      // same order as cmp_time_allocation()
+      static const int timeKeys[] = {
+        SK_ID,
+#ifndef NO_THREADS
+        SK_THREAD_DESC,
+#endif
+        SK_LT,
+      };
+      if( !radix_sort_allocations(alloc_a,alloc_idxs,alloc_q,heap,
+            timeKeys,sizeof(timeKeys)/sizeof(timeKeys[0])) )
+        sort_allocations( alloc_a,alloc_idxs,alloc_q,sizeof(allocation),
+            heap,cmp_time_allocation );
+    }
+    else if( opt->groupLeaks==4 )
+    {
+      // same order as cmp_age_allocation()
+      static const int ageKeys[] = { SK_ID,SK_LT };
+      if( !radix_sort_allocations(alloc_a,alloc_idxs,alloc_q,heap,
+            ageKeys,sizeof(ageKeys)/sizeof(ageKeys[0])) )
+        sort_allocations( alloc_a,alloc_idxs,alloc_q,sizeof(allocation),
+            heap,cmp_age_allocation );
+    }
     else
       sort_allocations( alloc_a,alloc_idxs,alloc_q,sizeof(allocation),
-          heap,cmp_time_allocation );
+          heap,cmp_merge_allocation );
     combined_q = 0;
     for( i=0; i<alloc_q; )
     {
@@ -3693,6 +6434,7 @@ static void printLeaks( allocation *alloc_a,int alloc_q,
     {
       allocation *a = alloc_a + alloc_idxs[i];
       a->size *= a->count;
+      if( sampleTrace ) continue;
 
       uintptr_t *frames = (uintptr_t*)a->frames;
       int c;
@@ -3700,13 +6442,23 @@ static void printLeaks( allocation *alloc_a,int alloc_q,
         frames[c]--;
       a->frameCount = c;
     }
-    if( opt->groupLeaks==3 );
+    if( opt->groupLeaks>=3 );
     else if( opt->groupLeaks>1 )
-      sort_allocations( alloc_a,alloc_idxs,combined_q,sizeof(allocation),
-          heap,cmp_frame_allocation );
+    {
+      // the stack trie orders each leak type
+      if( !partition_allocations(alloc_a,alloc_idxs,combined_q,heap) )
+        sort_allocations( alloc_a,alloc_idxs,combined_q,sizeof(allocation),
+            heap,cmp_frame_allocation );
+    }
     else
-      sort_allocations( alloc_a,alloc_idxs,combined_q,sizeof(allocation),
-          heap,cmp_type_allocation );
+    {
+      // same order as cmp_type_allocation()
+      static const int typeKeys[] = { SK_ID,SK_FT,SK_SIZE_DESC,SK_LT };
+      if( !radix_sort_allocations(alloc_a,alloc_idxs,combined_q,heap,
+            typeKeys,sizeof(typeKeys)/sizeof(typeKeys[0])) )
+        sort_allocations( alloc_a,alloc_idxs,combined_q,sizeof(allocation),
+            heap,cmp_type_allocation );
+    }
     for( i=0; i<combined_q; i++ )
       alloc_a[alloc_idxs[i]].size /= alloc_a[alloc_idxs[i]].count;
     // }}}
@@ -3717,29 +6469,17 @@ static void printLeaks( allocation *alloc_a,int alloc_q,
       for( l=0,i=0; l<lDetails; l++ )
       {
         stackGroup *sg = sg_a + l;
-        while( i<combined_q )
+        int startIdx = i;
+        for( ; i<combined_q && alloc_a[alloc_idxs[i]].lt==(leakType)l; i++ );
+        if( opt->groupLeaks<3 )
         {
-          allocation *a = alloc_a + alloc_idxs[i];
-          leakType lt = a->lt;
-          if( lt!=(leakType)l ) break;
-          int startIdx = i;
-          int fc = a->frameCount;
-          void *cmpFrame = fc ? a->frames[fc-1] : NULL;
-
-          for( i++; i<combined_q; i++ )
-          {
-            a = alloc_a + alloc_idxs[i];
-            if( lt!=a->lt ) break;
-            fc = a->frameCount;
-            void *frame = fc ? a->frames[fc-1] : NULL;
-            if( cmpFrame!=frame ) break;
-          }
-          stackChildGrouping( alloc_a,alloc_idxs+startIdx,i-startIdx,
-              startIdx,heap,sg,
-              0,1 );
-        }
-        if( opt->groupLeaks!=3 )
+          stackTrieGrouping( alloc_a,alloc_idxs+startIdx,i-startIdx,
+              startIdx,heap,sg,cmp_leaf_allocation );
           sortStackGroup( sg,heap );
+        }
+        else
+          stackRunGrouping( alloc_a,alloc_idxs+startIdx,i-startIdx,
+              startIdx,heap,sg );
       }
     }
     // }}}
@@ -3780,6 +6520,14 @@ static void printLeaks( allocation *alloc_a,int alloc_q,
     // }}}
   }
 
+  // show only the biggest groups {{{
+  if( opt->topGroups>0 )
+  {
+    for( l=0; l<lDetails; l++ )
+      limitStackGroup( sg_a+l,opt->topGroups,heap );
+  }
+  // }}}
+
   // cache symbol data {{{
   if( lDetails==lMax )
     i = combined_q;
@@ -3791,9 +6539,37 @@ static void printLeaks( allocation *alloc_a,int alloc_q,
       if( alloc_a[idx].lt>=lDetails ) break;
     }
   }
-  cacheSymbolData( alloc_a,alloc_idxs,i,mi_a,mi_q,ds,0 );
+  // only of leaks which are printed
+  unsigned char *printed = i && !sampleTrace ?
+    HeapAlloc( heap,HEAP_ZERO_MEMORY,alloc_q ) : NULL;
+  int *sym_idxs = printed ? HeapAlloc( heap,0,i*sizeof(int) ) : NULL;
+  if( sym_idxs )
+  {
+    for( l=0; l<lDetails; l++ )
+      markPrintedLeaks( sg_a+l,alloc_a,alloc_idxs,opt->minLeakSize,printed );
+    int sym_q = 0;
+    int j;
+    for( j=0; j<i; j++ )
+    {
+      int idx = alloc_idxs[j];
+      if( printed[idx] ) sym_idxs[sym_q++] = idx;
+    }
+    cacheSymbolData( alloc_a,sym_idxs,sym_q,mi_a,mi_q,ds,0 );
+    HeapFree( heap,0,sym_idxs );
+  }
+  else
+    cacheSymbolData( alloc_a,alloc_idxs,i,mi_a,mi_q,ds,0 );
+  if( printed ) HeapFree( heap,0,printed );
   // }}}
 
+  // the merged samples include all stacks of the trace
+  if( sampleTrace )
+    printSampleTrace( ad,tcSvg,alloc_a,alloc_q,
+#ifndef NO_THREADS
+        threadName_a,threadName_q,
+#endif
+        mi_a,mi_q,ds );
+
   // print leaks {{{
   if( lMax==1 )
   {
@@ -3807,11 +6583,46 @@ static void printLeaks( allocation *alloc_a,int alloc_q,
     sg_a[LT_INDIRECTLY_REACHABLE].allocSum += alloc_ignore_ind_q;
     sg_a[LT_INDIRECTLY_REACHABLE].allocSumSize += alloc_ignore_ind_sum;
   }
-  int xmlRecordNum = 0;
+  const char *groupName = !sampling ? "leaks" : "profiling samples";
+
+  // xml and svg are written by own threads during the text output,
+  // the group tree and symbol data are no longer modified
+  leakReport lr;
+  lr.ad = ad;
+  lr.ds = ds;
+  lr.tcSvg = tcSvg;
+  lr.sg_a = sg_a;
+  lr.lDetails = lDetails;
+  lr.alloc_a = alloc_a;
+  lr.alloc_idxs = alloc_idxs;
+  lr.combined_q = combined_q;
+#ifndef NO_THREADS
+  lr.threadName_a = threadName_a;
+  lr.threadName_q = threadName_q;
+#endif
+  lr.mi_a = mi_a;
+  lr.mi_q = mi_q;
+  lr.leakTypeNames = leakTypeNames;
+  lr.leakTypeNamesRef = leakTypeNamesRef;
+  lr.groupName = groupName;
+  lr.sampling = sampling;
+  // the xml output switches the textColor of its own copy
+  dbgsym dsXml;
+  if( tcXml )
+  {
+    RtlMoveMemory( &dsXml,ds,sizeof(dbgsym) );
+    dsXml.tc = tcXml;
+  }
+  lr.dsXml = &dsXml;
+  int parallel = ( tc->out?1:0 ) + ( tcXml?1:0 ) + ( tcSvg?1:0 )>1;
+  HANDLE xmlThread = tcXml && parallel ?
+    CreateThread( NULL,0,leakXmlThread,&lr,0,NULL ) : NULL;
+  HANDLE svgThread = tcSvg && parallel ?
+    CreateThread( NULL,0,leakSvgThread,&lr,0,NULL ) : NULL;
+
   for( l=0; l<lMax; l++ )
   {
     stackGroup *sg = sg_a + l;
-    const char *groupName = !sampling ? "leaks" : "profiling samples";
     const char *groupTypeName = leakTypeNamesRef ? leakTypeNamesRef[l] : NULL;
     if( sg->allocSum && tc->out )
     {
@@ -3820,7 +6631,7 @@ static void printLeaks( allocation *alloc_a,int alloc_q,
         printf( " (%s)",groupTypeName );
       printf( ":\n" );
       if( l<lDetails )
-        printStackGroup( sg,alloc_a,alloc_idxs,
+        printStackGroup( ad,sg,alloc_a,alloc_idxs,
 #ifndef NO_THREADS
             threadName_a,threadName_q,
 #endif
@@ -3830,36 +6641,402 @@ static void printLeaks( allocation *alloc_a,int alloc_q,
       else
         printf( "  $Wsum: %d sample%s\n",
             sg->allocSum,sg->allocSum>1?"s":NULL );
+      if( showTime && l<lDetails )
+        printLeakTimes( ad,alloc_a,alloc_idxs,combined_q,l,tc );
     }
-    if( sg->allocSum && tcXml && l<lDetails )
-    {
-      textColor *tcOrig = tc;
-      ds->tc = tcXml;
-      xmlRecordNum = printStackGroupXml( sg,alloc_a,alloc_idxs,combined_q,
-#ifndef NO_THREADS
-          threadName_a,threadName_q,
-#endif
-          mi_a,mi_q,ds,leakTypeNames,xmlRecordNum,sampling );
-      ds->tc = tcOrig;
-    }
-    if( sg->allocSum && tcSvg && l<lDetails )
-      printFullStackGroupSvg( ad,sg,tcSvg,alloc_a,alloc_idxs,
-#ifndef NO_THREADS
-          threadName_a,threadName_q,
-#endif
-          mi_a,mi_q,ds,groupName,groupTypeName,sampling );
-    freeStackGroup( sg,heap );
   }
+
+  if( tcXml && !xmlThread ) leakXmlThread( &lr );
+  if( tcSvg && !svgThread ) leakSvgThread( &lr );
+  if( xmlThread )
+  {
+    WaitForSingleObject( xmlThread,INFINITE );
+    CloseHandle( xmlThread );
+  }
+  if( svgThread )
+  {
+    WaitForSingleObject( svgThread,INFINITE );
+    CloseHandle( svgThread );
+  }
+
+  for( l=0; l<lMax; l++ )
+    freeStackGroup( sg_a+l,heap );
   // }}}
 
   writeFileSeekBack( tcXml,"</valgrindoutput>\n" );
-  writeFileSeekBack( tcSvg,"</svg>\n" );
+  writeFlameFooter( tcSvg,ad,ds );
 
   if( alloc_idxs )
     HeapFree( heap,0,alloc_idxs );
   HeapFree( heap,0,sg_a );
 }
 
+// }}}
+// allocation profile {{{
+
+// ties of the sort criteria are ordered by stack
+static int cmp_profile_stack( const allocProfile *a,const allocProfile *b )
+{
+  if( a->hash>b->hash ) return( 1 );
+  if( a->hash<b->hash ) return( -1 );
+
+  int i;
+  for( i=0; i<PTRS; i++ )
+  {
+    uintptr_t fa = (uintptr_t)a->frames[i];
+    uintptr_t fb = (uintptr_t)b->frames[i];
+    if( fa>fb ) return( 1 );
+    if( fa<fb ) return( -1 );
+    if( !fa ) break;
+  }
+
+  if( a->ft>b->ft ) return( 1 );
+  if( a->ft<b->ft ) return( -1 );
+
+  return( 0 );
+}
+
+static int cmp_alloc_profile( const void *av,const void *bv )
+{
+  const allocProfile *a = av;
+  const allocProfile *b = bv;
+
+  if( a->allocSum>b->allocSum ) return( -1 );
+  if( a->allocSum<b->allocSum ) return( 1 );
+
+  if( a->allocCount>b->allocCount ) return( -1 );
+  if( a->allocCount<b->allocCount ) return( 1 );
+
+  return( cmp_profile_stack(a,b) );
+}
+
+static void printLifetime( textColor *tc,UINT64 ticks,DWORD freq )
+{
+  const char *units[4] = { "s","ms","us","ns" };
+  int u;
+  UINT64 mul = 1;
+  for( u=0; u<3 && ticks*mul<freq; u++ )
+    mul *= 1000;
+  LARGE_INTEGER li;
+  li.QuadPart = ticks*mul;
+  printf( "%u%s",div64(li.LowPart,li.HighPart,freq),units[u] );
+}
+
+static int cmp_short_profile( const void *av,const void *bv )
+{
+  const allocProfile *a = av;
+  const allocProfile *b = bv;
+
+  if( a->shortCount>b->shortCount ) return( -1 );
+  if( a->shortCount<b->shortCount ) return( 1 );
+
+  if( a->shortSum>b->shortSum ) return( -1 );
+  if( a->shortSum<b->shortSum ) return( 1 );
+
+  return( cmp_profile_stack(a,b) );
+}
+
+static int cmp_heap_peak_profile( const void *av,const void *bv )
+{
+  const allocProfile *a = av;
+  const allocProfile *b = bv;
+
+  if( a->heapPeakSum>b->heapPeakSum ) return( -1 );
+  if( a->heapPeakSum<b->heapPeakSum ) return( 1 );
+
+  if( a->heapPeakCount>b->heapPeakCount ) return( -1 );
+  if( a->heapPeakCount<b->heapPeakCount ) return( 1 );
+
+  return( cmp_profile_stack(a,b) );
+}
+
+// sets the allocations a and a[rest_q] with the same stack to the count
+// and size, so their size*count adds up exactly to sum,
+// and the count fits into an int
+static void profileSizeCount( allocation *a,int rest_q,
+    size_t sum,size_t count )
+{
+  if( count>0x7fffffff ) count = 0x7fffffff;
+  size_t size = count ? sum/count : 0;
+  size_t rem = count ? sum%count : 0;
+
+  allocation *rest = a + rest_q;
+  RtlMoveMemory( rest,a,sizeof(allocation) );
+  a->count = (int)( count-rem );
+  a->size = size;
+  rest->count = (int)rem;
+  rest->size = size + 1;
+}
+
+static void printProfileSvg( appData *ad,textColor *tcSvg,
+    allocation *alloc_a,int alloc_q,modInfo *mi_a,int mi_q,dbgsym *ds,
+    HANDLE heap,const char *groupName )
+{
+  int *alloc_idxs = HeapAlloc( heap,0,alloc_q*sizeof(int) );
+  if( !alloc_idxs ) return;
+  int i;
+  int used_q = 0;
+  for( i=0; i<alloc_q; i++ )
+  {
+    if( alloc_a[i].count )
+      alloc_idxs[used_q++] = i;
+  }
+
+  stackGroup sg;
+  RtlZeroMemory( &sg,sizeof(stackGroup) );
+  stackTrieGrouping( alloc_a,alloc_idxs,used_q,0,heap,&sg,
+      cmp_frame_allocation );
+  sortStackGroup( &sg,heap );
+
+  if( sg.allocSum )
+    printFullStackGroupSvg( ad,&sg,tcSvg,alloc_a,alloc_idxs,
+#ifndef NO_THREADS
+        NULL,0,
+#endif
+        mi_a,mi_q,ds,groupName,NULL,0 );
+  freeStackGroup( &sg,heap );
+
+  writeFlameFooter( tcSvg,ad,ds );
+
+  HeapFree( heap,0,alloc_idxs );
+}
+
+// the heap usage over time is drawn by svg.js,
+// long timelines are reduced to the maxima of neighboring samples
+static void writeSvgTimeline( textColor *tc,appData *ad )
+{
+  size_t *timeline_a = ad->timeline_a;
+  int timeline_q = ad->timeline_q;
+  int timelinePeak = ad->timelinePeak;
+  int interval = ad->opt->heapTimeline;
+  while( timeline_q>2048 )
+  {
+    int i;
+    for( i=0; i<timeline_q/2; i++ )
+    {
+      size_t s1 = timeline_a[i*2];
+      size_t s2 = timeline_a[i*2+1];
+      timeline_a[i] = s1>s2 ? s1 : s2;
+    }
+    if( timeline_q&1 )
+      timeline_a[i++] = timeline_a[timeline_q-1];
+    timeline_q = i;
+    timelinePeak /= 2;
+    interval *= 2;
+  }
+
+  printf( "  <text id=\"heapTimeline\" heobInterval=\"%d\""
+      " heobPeak=\"%d\" heobTimeline=\"",interval,timelinePeak );
+  int i;
+  for( i=0; i<timeline_q; i++ )
+    printf( i ? " %U" : "%U",timeline_a[i] );
+  printf( "\"/>\n" );
+
+  writeFileSeekBack( tc,"</svg>\n" );
+}
+
+static void printAllocProfile( allocProfile *prof_a,int prof_q,
+    modInfo *mi_a,int mi_q,options *opt,textColor *tc,dbgsym *ds,
+    HANDLE heap,appData *ad,textColor *tcSvg )
+{
+  if( !tc->out && !tcSvg ) return;
+
+  printf( "\n" );
+  if( !prof_q )
+  {
+    printf( "$Ino allocations\n" );
+    return;
+  }
+
+  // the stack data is handled like merged leaks,
+  // the second half gets the remainder of the sizes
+  allocation *alloc_a =
+    HeapAlloc( heap,HEAP_ZERO_MEMORY,2*prof_q*sizeof(allocation) );
+  if( !alloc_a ) return;
+  int i;
+  for( i=0; i<prof_q; i++ )
+  {
+    allocProfile *ap = prof_a + i;
+    allocation *a = alloc_a + i;
+    RtlMoveMemory( a->frames,ap->frames,PTRS*sizeof(void*) );
+    a->lt = LT_LOST;
+    a->ft = ap->ft;
+  }
+  cacheSymbolData( alloc_a,NULL,prof_q,mi_a,mi_q,ds,1 );
+  for( i=0; i<prof_q; i++ )
+  {
+    allocProfile *ap = prof_a + i;
+    profileSizeCount( alloc_a+i,prof_q,ap->allocSum,ap->allocCount );
+  }
+
+  // ranked by allocated bytes {{{
+  if( tc->out && opt->allocProfile )
+  {
+    int *prof_idxs = sort_allocations( prof_a,NULL,prof_q,
+        sizeof(allocProfile),heap,cmp_alloc_profile );
+
+    LARGE_INTEGER freq;
+    if( !QueryPerformanceFrequency(&freq) || freq.HighPart )
+      freq.LowPart = 0;
+
+    size_t allocSum = 0;
+    size_t allocCount = 0;
+    size_t freeSum = 0;
+    size_t freeCount = 0;
+    printf( "$Sallocations:\n" );
+    for( i=0; i<prof_q; i++ )
+    {
+      int idx = prof_idxs[i];
+      allocProfile *ap = prof_a + idx;
+      allocation *a = alloc_a + idx;
+
+      printf( "%E$W%B / %U$N (freed: %B / %U, peak: %B)\n",
+          1,ap->allocSum,ap->allocCount,
+          ap->freeSum,ap->freeCount,ap->peakSum );
+      printStackCount( a->frames,a->frameCount,mi_a,mi_q,ds,a->ft,1 );
+
+      if( ap->freeCount && freq.LowPart )
+      {
+        printf( "%i      $Ilifetime:$N",1 );
+        int l;
+        const char *sep = "";
+        for( l=0; l<LIFETIME_BUCKETS; l++ )
+        {
+          size_t count = ap->lifetimes[l];
+          if( !count ) continue;
+          if( l<LIFETIME_BUCKETS-1 )
+          {
+            printf( "%s <",sep );
+            printLifetime( tc,(UINT64)1<<l,freq.LowPart );
+          }
+          else
+          {
+            printf( "%s >=",sep );
+            printLifetime( tc,(UINT64)1<<(l-1),freq.LowPart );
+          }
+          printf( ": %U",count );
+          sep = ",";
+        }
+        printf( "\n" );
+      }
+      if( tc->canWriteWideChar )
+        printf( "%I\n",1 );
+
+      allocSum += ap->allocSum;
+      allocCount += ap->allocCount;
+      freeSum += ap->freeSum;
+      freeCount += ap->freeCount;
+    }
+    printf( "  $Wsum: %B / %U (freed: %B / %U)\n",
+        allocSum,allocCount,freeSum,freeCount );
+
+    HeapFree( heap,0,prof_idxs );
+  }
+  // }}}
+
+  // short-lived allocations {{{
+  if( tc->out && opt->shortLifetime>0 )
+  {
+    int *prof_idxs = sort_allocations( prof_a,NULL,prof_q,
+        sizeof(allocProfile),heap,cmp_short_profile );
+
+    DWORD runTime = GetTickCount() - ad->startTicks;
+    if( !runTime ) runTime = 1;
+
+    size_t shortSum = 0;
+    size_t shortCount = 0;
+    if( opt->allocProfile )
+      printf( "\n" );
+    printf( "$Sshort-lived allocations (< %d us):\n",opt->shortLifetime );
+    for( i=0; i<prof_q; i++ )
+    {
+      int idx = prof_idxs[i];
+      allocProfile *ap = prof_a + idx;
+      if( !ap->shortCount ) break;
+      allocation *a = alloc_a + idx;
+
+      LARGE_INTEGER rate;
+      rate.QuadPart = (UINT64)ap->shortCount*1000;
+      DWORD perSec = div64( rate.LowPart,rate.HighPart,runTime );
+      printf( "%E$W%B / %U$N of %U (%u/s, same thread: %U)\n",
+          1,ap->shortSum,ap->shortCount,ap->allocCount,
+          perSec,ap->shortSameThread );
+      printStackCount( a->frames,a->frameCount,mi_a,mi_q,ds,a->ft,1 );
+      if( tc->canWriteWideChar )
+        printf( "%I\n",1 );
+
+      shortSum += ap->shortSum;
+      shortCount += ap->shortCount;
+    }
+    if( shortCount )
+      printf( "  $Wsum: %B / %U\n",shortSum,shortCount );
+    else
+      printf( "  $Ono short-lived allocations\n" );
+
+    HeapFree( heap,0,prof_idxs );
+  }
+  // }}}
+
+  // heap timeline {{{
+  if( ad->timeline_a && tc->out )
+  {
+    int *prof_idxs = sort_allocations( prof_a,NULL,prof_q,
+        sizeof(allocProfile),heap,cmp_heap_peak_profile );
+
+    int timelinePeak = ad->timelinePeak;
+    if( opt->allocProfile || opt->shortLifetime>0 )
+      printf( "\n" );
+    printf( "$Sheap peak: %B after %m\n",
+        ad->timeline_a[timelinePeak],
+        (DWORD)(timelinePeak+1)*opt->heapTimeline );
+
+    size_t heapPeakSum = 0;
+    size_t heapPeakCount = 0;
+    for( i=0; i<prof_q; i++ )
+    {
+      int idx = prof_idxs[i];
+      allocProfile *ap = prof_a + idx;
+      if( !ap->heapPeakCount ) break;
+      allocation *a = alloc_a + idx;
+
+      printf( "%E$W%B / %U$N\n",1,ap->heapPeakSum,ap->heapPeakCount );
+      printStackCount( a->frames,a->frameCount,mi_a,mi_q,ds,a->ft,1 );
+      if( tc->canWriteWideChar )
+        printf( "%I\n",1 );
+
+      heapPeakSum += ap->heapPeakSum;
+      heapPeakCount += ap->heapPeakCount;
+    }
+    printf( "  $Wsum: %B / %U\n",heapPeakSum,heapPeakCount );
+
+    HeapFree( heap,0,prof_idxs );
+  }
+  // }}}
+
+  // flame graph {{{
+  if( tcSvg && opt->allocProfile )
+    printProfileSvg( ad,tcSvg,alloc_a,2*prof_q,mi_a,mi_q,ds,heap,
+        "allocations" );
+
+  if( tcSvg && ad->timeline_a )
+  {
+    for( i=0; i<prof_q; i++ )
+    {
+      allocProfile *ap = prof_a + i;
+      profileSizeCount( alloc_a+i,prof_q,
+          ap->heapPeakSum,ap->heapPeakCount );
+    }
+    printProfileSvg( ad,tcSvg,alloc_a,2*prof_q,mi_a,mi_q,ds,heap,
+        "heap peak" );
+
+    if( ad->svgFormat==FLAME_SVG )
+      writeSvgTimeline( tcSvg,ad );
+  }
+  // }}}
+
+  HeapFree( heap,0,alloc_a );
+}
+
 // }}}
 // sampling profiler {{{
 
@@ -3918,6 +7095,10 @@ static DWORD WINAPI samplingThread( LPVOID arg )
       ad->samp_s += samp_add;
     }
 
+    // time of this round, for the trace events
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter( &counter );
+
     int ts;
     for( ts=0; ts<thread_samp_q; ts++ )
     {
@@ -3926,6 +7107,7 @@ static DWORD WINAPI samplingThread( LPVOID arg )
       a->size = 1;
       a->ft = FT_COUNT;
       a->id = ++ad->samp_id;
+      a->timestamp = counter.QuadPart;
 
 #ifndef NO_THREADS
       a->threadNum = thread_samp_a[ts].threadNum;
@@ -4408,6 +7590,34 @@ static wchar_t *readOption( wchar_t *args,appData *ad,HANDLE heap )
       opt->disableParallelLoading = wtoi( args+2 );
       break;
 
+    case 'u':
+      opt->allocProfile = wtoi( args+2 );
+      break;
+
+    case 'U':
+      opt->shortLifetime = wtoi( args+2 );
+      break;
+
+    case 't':
+      opt->heapTimeline = wtoi( args+2 );
+      break;
+
+    case 'j':
+      opt->leakAfter = wtoi( args+2 );
+      break;
+
+    case 'N':
+      opt->topGroups = wtoi( args+2 );
+      break;
+
+    case 'W':
+      opt->svgMinWidth = wtoi( args+2 );
+      break;
+
+    case 'Q':
+      opt->errorLimit = wtoi( args+2 );
+      break;
+
     default:
       return( NULL );
   }
@@ -4644,6 +7854,7 @@ static void printDisassembler( textColor *tc,const char *header,
 static WORD waitForKey( textColor *tc,HANDLE in )
 {
   printf( "press any key to continue..." );
+  flushText( tc );
 
   DWORD flags;
   int hasConMode;
@@ -4726,6 +7937,10 @@ static textColor *createExpandedXml( appData *ad,const wchar_t *name )
   int access = GENERIC_WRITE | ( ad->opt->leakErrorExitCode>1 ? DELETE : 0 );
   HANDLE xml = CreateFileW( usedName,access,FILE_SHARE_READ,
       NULL,CREATE_ALWAYS,FILE_ATTRIBUTE_NORMAL,NULL );
+  // .svgz or .gz files are compressed
+  int len = lstrlenW( usedName );
+  int compress = hasExtension( usedName,len,".gz" ) ||
+    hasExtension( usedName,len,".svgz" );
   if( fullName ) HeapFree( ad->heap,0,fullName );
   if( xml==INVALID_HANDLE_VALUE ) return( NULL );
 
@@ -4736,6 +7951,9 @@ static textColor *createExpandedXml( appData *ad,const wchar_t *name )
   tc->fTextColor = NULL;
   tc->out = xml;
   tc->color = ATT_NORMAL;
+  tc->buf = HeapAlloc( ad->heap,0,TEXT_BUFFER_SIZE );
+  if( compress )
+    tc->gz = gzipInit( xml );
 
   return( tc );
 }
@@ -4890,6 +8108,7 @@ static void writeXmlFooter( textColor *tc,appData *ad )
 
   printf( "</valgrindoutput>\n" );
 
+  freeTextBuffer( tc );
   CloseHandle( tc->out );
   HeapFree( ad->heap,0,tc );
 }
@@ -5156,6 +8375,40 @@ static void writeXmlWrongDealloc( textColor *tc,dbgsym *ds,
   ds->tc = tcOrig;
 }
 
+// the suppressed repeats are given by errorcounts of the unique id
+static void writeXmlErrorRepeat( textColor *tc,dbgsym *ds,
+    errorRepeat *er,const char *kind,const char *what,int repeats,
+    size_t unique,modInfo *mi_a,int mi_q )
+{
+  if( !tc ) return;
+
+  textColor *tcOrig = ds->tc;
+  ds->tc = tc;
+
+  printf( "<error>\n" );
+  printf( "  <unique>%X</unique>\n",unique );
+  printf( "  <kind>%s</kind>\n",kind );
+  printf( "  <what>%s repeated %d more time%s</what>\n",
+      what,repeats,repeats>1?"s":"" );
+  printf( "  <auxwhat>called on</auxwhat>\n" );
+  printf( "  <stack>\n" );
+  printStackCount( er->aa[0].frames,er->aa[0].frameCount,
+      mi_a,mi_q,ds,er->aa[0].ft,-1 );
+  printf( "  </stack>\n" );
+  if( er->aa[1].ptr )
+    writeXmlAllocatedFreed( tc,ds,er->aa+1,0,mi_a,mi_q );
+  printf( "</error>\n\n" );
+
+  printf( "<errorcounts>\n" );
+  printf( "  <pair>\n" );
+  printf( "    <count>%d</count>\n",repeats );
+  printf( "    <unique>%X</unique>\n",unique );
+  printf( "  </pair>\n" );
+  printf( "</errorcounts>\n\n" );
+
+  ds->tc = tcOrig;
+}
+
 // }}}
 // svg {{{
 
@@ -5170,11 +8423,34 @@ static void writeResource( textColor *tc,int resID )
   WriteText( tc,LockResource(hglobal),SizeofResource(NULL,hrsrc) );
 }
 
+static flameFormat flameFormatOfName( const wchar_t *name )
+{
+  int len = lstrlenW( name );
+  if( hasExtension(name,len,".gz") ) len -= 3;
+
+  if( hasExtension(name,len,".pb") || hasExtension(name,len,".pprof") )
+    return( FLAME_PPROF );
+  if( hasExtension(name,len,".folded") )
+    return( FLAME_FOLDED );
+  if( hasExtension(name,len,".trace.json") )
+    return( FLAME_TRACE );
+  if( hasExtension(name,len,".json") )
+    return( FLAME_SPEEDSCOPE );
+  return( FLAME_SVG );
+}
+
 static textColor *writeSvgHeader( appData *ad )
 {
   textColor *tc = createExpandedXml( ad,ad->svgName );
   if( !tc ) return( NULL );
 
+  ad->svgFormat = flameFormatOfName( ad->svgName );
+  if( ad->svgFormat!=FLAME_SVG )
+  {
+    writeFlameHeader( tc,ad );
+    return( tc );
+  }
+
   int svgWidth = 1280;
   HMODULE user32 = LoadLibrary( "user32.dll" );
   if( user32 )
@@ -5223,7 +8499,59 @@ static textColor *writeSvgHeader( appData *ad )
   return( tc );
 }
 
-static void locSvg( textColor *tc,uintptr_t addr,int useAddr,
+// index of an attribute value in the string table of the svg file,
+// or -1 if it has to be written directly
+static int svgStringIdx( dbgsym *ds,int type,
+    const void *str,size_t l,int num1,UINT num2,int *isNew )
+{
+  *isNew = 0;
+
+  size_t keyLen = 3*sizeof(int) + l;
+  if( keyLen>ds->svgKey_s )
+  {
+    size_t svgKey_s = keyLen + 256;
+    char *svgKey = ds->svgKey ?
+      HeapReAlloc( ds->heap,0,ds->svgKey,svgKey_s ) :
+      HeapAlloc( ds->heap,0,svgKey_s );
+    if( !svgKey ) return( -1 );
+    ds->svgKey = svgKey;
+    ds->svgKey_s = svgKey_s;
+  }
+  int *keyNums = (int*)ds->svgKey;
+  keyNums[0] = type;
+  keyNums[1] = num1;
+  keyNums[2] = num2;
+  if( l ) RtlMoveMemory( ds->svgKey+3*sizeof(int),str,l );
+
+  int q = ds->svgStrings.hash_q;
+  int idx;
+  if( !strings_intern(ds->svgKey,(DWORD)keyLen,&ds->svgStrings,ds->heap,
+        &idx) )
+    return( -1 );
+  *isNew = ds->svgStrings.hash_q>q;
+  return( idx );
+}
+
+#ifndef NO_THREADS
+static void svgThreadText( textColor *tc,
+    threadInfo *threadName_a,int threadName_q,int threadNum )
+{
+  if( threadNum>0 && threadNum<=threadName_q &&
+      threadName_a[threadNum-1].name )
+    printf( "thread %d [%u]: %S",
+        threadNum,threadName_a[threadNum-1].id,
+        threadName_a[threadNum-1].name );
+  else if( threadNum>0 && threadNum<=threadName_q )
+    printf( "thread %d [%u]",
+        threadNum,threadName_a[threadNum-1].id );
+  else
+    printf( "thread %d",threadNum );
+}
+#endif
+
+// the source, function, module and thread attributes reference
+// the values of heobStr elements, each written before their first use
+static void locSvg( textColor *tc,dbgsym *ds,uintptr_t addr,int useAddr,
     size_t samples,size_t ofs,int stack,int allocs,
 #ifndef NO_THREADS
     threadInfo *threadName_a,int threadName_q,int threadNum,
@@ -5233,29 +8561,80 @@ static void locSvg( textColor *tc,uintptr_t addr,int useAddr,
 {
   if( stack<=1 ) printf( "\n" );
 
+  // string table {{{
+  int isNew;
+  int sourceIdx = -1;
+  if( lineno>0 )
+  {
+    sourceIdx = svgStringIdx( ds,'S',
+        filename,lstrlenW(filename)*2,lineno,0,&isNew );
+    if( isNew )
+      printf( "  <heobStr v=\"%S:%d\"/>\n",filename,lineno );
+  }
+  int funcIdx = -1;
+  if( funcname )
+  {
+    funcIdx = svgStringIdx( ds,'F',funcname,lstrlen(funcname),0,0,&isNew );
+    if( isNew )
+      printf( "  <heobStr v=\"%s\"/>\n",funcname );
+  }
+  int modIdx = -1;
+  if( modname )
+  {
+    modIdx = svgStringIdx( ds,'M',modname,lstrlenW(modname)*2,0,0,&isNew );
+    if( isNew )
+      printf( "  <heobStr v=\"%S\"/>\n",modname );
+  }
+#ifndef NO_THREADS
+  int threadIdx = -1;
+  if( threadNum )
+  {
+    const wchar_t *threadName = NULL;
+    UINT threadId = 0;
+    if( threadNum>0 && threadNum<=threadName_q )
+    {
+      threadName = threadName_a[threadNum-1].name;
+      threadId = threadName_a[threadNum-1].id;
+    }
+    threadIdx = svgStringIdx( ds,'T',threadName,
+        threadName ? lstrlenW(threadName)*2 : 0,threadNum,threadId,&isNew );
+    if( isNew )
+    {
+      printf( "  <heobStr v=\"" );
+      svgThreadText( tc,threadName_a,threadName_q,threadNum );
+      printf( "\"/>\n" );
+    }
+  }
+#endif
+  // }}}
+
   printf( "  <svg heobSum=\"%U\" heobOfs=\"%U\" heobStack=\"%d\"",
       samples,ofs,stack );
   if( allocs )
     printf( " heobAllocs=\"%d\"",allocs );
   if( useAddr )
     printf( " heobAddr=\"%X\"",addr );
-  if( lineno>0 )
+  if( sourceIdx>=0 )
+    printf( " heobS=\"%d\"",sourceIdx );
+  else if( lineno>0 )
     printf( " heobSource=\"%S:%d\"",filename,lineno );
-  if( funcname )
+  if( funcIdx>=0 )
+    printf( " heobF=\"%d\"",funcIdx );
+  else if( funcname )
     printf( " heobFunc=\"%s\"",funcname );
-  if( modname )
+  if( modIdx>=0 )
+    printf( " heobM=\"%d\"",modIdx );
+  else if( modname )
     printf( " heobMod=\"%S\"",modname );
 #ifndef NO_THREADS
-  if( threadNum>0 && threadNum<=threadName_q &&
-      threadName_a[threadNum-1].name )
-    printf( " heobThread=\"thread %d [%u]: %S\"",
-        threadNum,threadName_a[threadNum-1].id,
-        threadName_a[threadNum-1].name );
-  else if( threadNum>0 && threadNum<=threadName_q )
-    printf( " heobThread=\"thread %d [%u]\"",
-        threadNum,threadName_a[threadNum-1].id );
+  if( threadIdx>=0 )
+    printf( " heobT=\"%d\"",threadIdx );
   else if( threadNum )
-    printf( " heobThread=\"thread %d\"",threadNum );
+  {
+    printf( " heobThread=\"" );
+    svgThreadText( tc,threadName_a,threadName_q,threadNum );
+    printf( "\"" );
+  }
 #endif
   if( blocked )
     printf( " heobBlocked=\"%d\"",blocked );
@@ -5278,13 +8657,11 @@ static int printStackCountSvg( void **framesV,int fc,
   int j;
   for( j=fc-1; j>=0; )
   {
-    int k;
     uintptr_t frame = frames[j];
-    for( k=0; k<mi_q && (frame<mi_a[k].base ||
-          frame>=mi_a[k].base+mi_a[k].size); k++ );
-    if( k>=mi_q )
+    modInfo *mi = findModule( ds,mi_a,mi_q,frame );
+    if( !mi )
     {
-      locSvg( tc,frame,1,samples,ofs,stack+stackCount,sampling?0:allocs,
+      locSvg( tc,ds,frame,1,samples,ofs,stack+stackCount,sampling?0:allocs,
 #ifndef NO_THREADS
           threadName_a,threadName_q,threadNum,
 #endif
@@ -5293,7 +8670,6 @@ static int printStackCountSvg( void **framesV,int fc,
       stackCount++;
       continue;
     }
-    modInfo *mi = mi_a + k;
 
     int l;
     for( l=j-1; l>=0 && frames[l]>=mi->base &&
@@ -5305,7 +8681,7 @@ static int printStackCountSvg( void **framesV,int fc,
       stackSourceLocation *s = findStackSourceLocation( frame,ssl,sslCount );
       if( !s )
       {
-        locSvg( tc,frame,1,samples,ofs,stack+stackCount,sampling?0:allocs,
+        locSvg( tc,ds,frame,1,samples,ofs,stack+stackCount,sampling?0:allocs,
 #ifndef NO_THREADS
             threadName_a,threadName_q,threadNum,
 #endif
@@ -5334,7 +8710,7 @@ static int printStackCountSvg( void **framesV,int fc,
       }
       int stackPos = stack + stackCount;
       // output first the bottom stack
-      locSvg( tc,frame,1,samples,ofs,stackPos,sampling?0:allocs,
+      locSvg( tc,ds,frame,1,samples,ofs,stackPos,sampling?0:allocs,
 #ifndef NO_THREADS
           threadName_a,threadName_q,threadNum,
 #endif
@@ -5345,7 +8721,7 @@ static int printStackCountSvg( void **framesV,int fc,
       int inlinePos = inlineCount - 1;
       while( inlinePos>0 )
       {
-        locSvg( tc,0,0,samples,ofs,stackPos+inlinePos,sampling?0:allocs,
+        locSvg( tc,ds,0,0,samples,ofs,stackPos+inlinePos,sampling?0:allocs,
 #ifndef NO_THREADS
             threadName_a,threadName_q,threadNum,
 #endif
@@ -5361,7 +8737,7 @@ static int printStackCountSvg( void **framesV,int fc,
   }
   if( ft<FT_COUNT )
   {
-    locSvg( tc,0,0,samples,ofs,stack+stackCount,sampling?0:allocs,
+    locSvg( tc,ds,0,0,samples,ofs,stack+stackCount,sampling?0:allocs,
 #ifndef NO_THREADS
         threadName_a,threadName_q,threadNum,
 #endif
@@ -5376,7 +8752,8 @@ static void printStackGroupSvg( stackGroup *sg,textColor *tc,
 #ifndef NO_THREADS
     threadInfo *threadName_a,int threadName_q,
 #endif
-    modInfo *mi_a,int mi_q,dbgsym *ds,size_t ofs,int stack,int sampling )
+    modInfo *mi_a,int mi_q,dbgsym *ds,size_t ofs,int stack,int sampling,
+    size_t minSize )
 {
   int i;
   int allocStart = sg->allocStart;
@@ -5418,14 +8795,456 @@ static void printStackGroupSvg( stackGroup *sg,textColor *tc,
       }
     }
 
-    stack += printStackCountSvg(
+    stack += printStackCountSvg(
+        a->frames+(a->frameCount-(sg->stackStart+sg->stackCount)),
+        sg->stackCount,
+#ifndef NO_THREADS
+        threadName_a,threadName_q,threadNum,
+#endif
+        tc,mi_a,mi_q,ds,blocked,
+        sg->allocSumSize,ofs,stack,sg->allocSum,sampling,0 );
+  }
+
+  // nodes narrower than minSize are combined into one
+  size_t otherSum = 0;
+  int otherAllocs = 0;
+
+  size_t minLeakSize = ds->opt->minLeakSize;
+  if( sg->stackStart+sg->stackCount==a->frameCount )
+  {
+    for( i=0; i<allocCount; i++ )
+    {
+      int idx = alloc_idxs[allocStart+i];
+      a = alloc_a + idx;
+      size_t combSize = a->size*a->count;
+      if( combSize<minLeakSize ) continue;
+      if( allocCount>1 && combSize<minSize )
+      {
+        otherSum += combSize;
+        otherAllocs += a->count;
+        continue;
+      }
+      if( allocCount>1 )
+      {
+#ifndef NO_THREADS
+        if( sampling )
+          locSvg( tc,ds,0,0,combSize,ofs,stack,0,
+              threadName_a,threadName_q,a->threadNum,
+              NULL,0,NULL,NULL,a->ft==FT_BLOCKED,a->id );
+        else
+#endif
+          printStackCountSvg( NULL,0,
+#ifndef NO_THREADS
+              threadName_a,threadName_q,a->threadNum,
+#endif
+              tc,NULL,0,ds,a->ft,
+              combSize,ofs,stack,a->count,sampling,a->id );
+      }
+      else
+        stack += printStackCountSvg(
+            a->frames+(a->frameCount-(sg->stackStart+sg->stackCount)),
+            sg->stackCount,
+#ifndef NO_THREADS
+            threadName_a,threadName_q,a->threadNum,
+#endif
+            tc,mi_a,mi_q,ds,a->ft,
+            combSize,ofs,stack,a->count,sampling,a->id );
+      ofs += combSize;
+    }
+  }
+
+  stackGroup *child_a = sg->child_a;
+  int *childSorted_a = sg->childSorted_a;
+  int child_q = sg->child_q;
+  for( i=0; i<child_q; i++ )
+  {
+    int idx = childSorted_a ? childSorted_a[i] : i;
+    stackGroup *sgc = child_a + idx;
+    size_t allocSumSize = sgc->allocSumSize;
+    if( allocSumSize<minLeakSize ) continue;
+    if( allocSumSize<minSize )
+    {
+      otherSum += allocSumSize;
+      otherAllocs += sgc->allocSum;
+      continue;
+    }
+    printStackGroupSvg( sgc,tc,alloc_a,alloc_idxs,
+#ifndef NO_THREADS
+        threadName_a,threadName_q,
+#endif
+        mi_a,mi_q,ds,ofs,stack,sampling,minSize );
+    ofs += allocSumSize;
+  }
+
+  if( otherSum )
+    locSvg( tc,ds,0,0,otherSum,ofs,stack,sampling?0:otherAllocs,
+#ifndef NO_THREADS
+        NULL,0,0,
+#endif
+        NULL,0,"(other)",NULL,0,0 );
+}
+
+static void printFullStackGroupSvg( appData *ad,stackGroup *sg,textColor *tc,
+    allocation *alloc_a,const int *alloc_idxs,
+#ifndef NO_THREADS
+    threadInfo *threadName_a,int threadName_q,
+#endif
+    modInfo *mi_a,int mi_q,dbgsym *ds,
+    const char *groupName,const char *groupTypeName,int sampling )
+{
+  char *fullTypeName = NULL;
+  const char *fullName = groupName;
+  if( groupTypeName )
+  {
+    fullTypeName = HeapAlloc( ad->heap,0,
+        lstrlen(groupName)+lstrlen(groupTypeName)+4 );
+    lstrcpy( fullTypeName,groupName );
+    lstrcat( fullTypeName," (" );
+    lstrcat( fullTypeName,groupTypeName );
+    lstrcat( fullTypeName,")" );
+    fullName = fullTypeName;
+  }
+  if( ad->svgFormat!=FLAME_SVG )
+  {
+    printFullStackGroupFlame( ad,sg,tc,alloc_a,alloc_idxs,
+        mi_a,mi_q,ds,fullName,sampling );
+    if( fullTypeName ) HeapFree( ad->heap,0,fullTypeName );
+    return;
+  }
+  locSvg( tc,ds,0,0,sg->allocSumSize,ad->svgSum,1,sampling?0:sg->allocSum,
+#ifndef NO_THREADS
+      NULL,0,0,
+#endif
+      NULL,0,fullName,NULL,0,0 );
+  if( fullTypeName ) HeapFree( ad->heap,0,fullTypeName );
+
+  // width relative to the whole group
+  int minWidth = ds->opt->svgMinWidth;
+  size_t minSize = minWidth>0 ? sg->allocSumSize/10000*minWidth : 0;
+  printStackGroupSvg( sg,tc,alloc_a,alloc_idxs,
+#ifndef NO_THREADS
+      threadName_a,threadName_q,
+#endif
+      mi_a,mi_q,ds,ad->svgSum,2,sampling,minSize );
+  ad->svgSum += sg->allocSumSize;
+}
+
+static void writeSvgFooter( textColor *tc,appData *ad )
+{
+  if( !tc ) return;
+
+  if( ad->svgFormat==FLAME_SVG )
+    printf( "</svg>\n" );
+  else
+  {
+    // the last footer stays, it was written with the symbol data
+    flushText( tc );
+    if( tc->gz && !tc->gz->started )
+    {
+      gzipFree( tc->gz );
+      tc->gz = NULL;
+    }
+    LARGE_INTEGER pos;
+    pos.LowPart = pos.HighPart = 0;
+    SetFilePointerEx( tc->out,pos,NULL,FILE_END );
+  }
+
+  freeTextBuffer( tc );
+  CloseHandle( tc->out );
+  HeapFree( ad->heap,0,tc );
+}
+
+// }}}
+// other flame graph formats {{{
+
+static void writeFlameHeader( textColor *tc,appData *ad )
+{
+  // pprof is written without printf(), the header with the first profile
+  if( ad->svgFormat==FLAME_FOLDED || ad->svgFormat==FLAME_PPROF )
+  {
+    tc->fWriteSubText = &WriteText;
+    tc->fWriteSubTextW = &WriteTextW;
+    return;
+  }
+
+  tc->fWriteSubText = &WriteTextJson;
+  tc->fWriteSubTextW = &WriteTextJsonW;
+
+  // '$' is a color escape of printf(), so the key is an argument
+  if( ad->svgFormat==FLAME_SPEEDSCOPE )
+    printf( "{\"%s\":\"https://www.speedscope.app/file-format-schema.json\",\n"
+        "\"exporter\":\"heob %s\",\"name\":\"%S\",\n"
+        "\"profiles\":[\n",
+        "$schema",HEOB_VER,ad->cmdLineW );
+  else
+    printf( "{\"otherData\":{\"exporter\":\"heob %s\",\"cmd\":\"%S\"},\n"
+        "\"displayTimeUnit\":\"ms\",\n"
+        "\"traceEvents\":[\n",
+        HEOB_VER,ad->cmdLineW );
+
+  writeFlameFooter( tc,ad,NULL );
+}
+
+static char *svgKeyBuffer( dbgsym *ds,size_t keyLen )
+{
+  if( keyLen>ds->svgKey_s )
+  {
+    size_t svgKey_s = keyLen + 256;
+    char *svgKey = ds->svgKey ?
+      HeapReAlloc( ds->heap,0,ds->svgKey,svgKey_s ) :
+      HeapAlloc( ds->heap,0,svgKey_s );
+    if( !svgKey ) return( NULL );
+    ds->svgKey = svgKey;
+    ds->svgKey_s = svgKey_s;
+  }
+  return( ds->svgKey );
+}
+
+// key of a frame in svgStrings, followed by the function name
+// (zero-terminated and padded to an even size),
+// and the zero-terminated source file or module name
+typedef struct
+{
+  uintptr_t addr;
+  int lineno;
+  int funcSize;
+}
+flameFrame;
+
+static int flameFrameIdx( dbgsym *ds,uintptr_t addr,
+    const wchar_t *filename,int lineno,const char *funcname )
+{
+  // only frames without symbol are distinguished by their address
+  if( funcname || lineno>0 ) addr = 0;
+
+  int funcLen = funcname ? lstrlen( funcname ) : 0;
+  int funcSize = ( funcLen+2 )&~1;
+  int nameLen = filename ? lstrlenW( filename ) : 0;
+  size_t keyLen = sizeof(flameFrame) + funcSize + ( nameLen+1 )*2;
+  char *key = svgKeyBuffer( ds,keyLen );
+  if( !key ) return( -1 );
+
+  int q = ds->svgStrings.hash_q;
+  if( q>=ds->flameFrame_s )
+  {
+    int flameFrame_s = ds->flameFrame_s + 1024;
+    const char **flameFrame_a = ds->flameFrame_a ?
+      HeapReAlloc( ds->heap,0,ds->flameFrame_a,
+          flameFrame_s*sizeof(const char*) ) :
+      HeapAlloc( ds->heap,0,flameFrame_s*sizeof(const char*) );
+    if( !flameFrame_a ) return( -1 );
+    ds->flameFrame_a = flameFrame_a;
+    ds->flameFrame_s = flameFrame_s;
+  }
+
+  flameFrame ff;
+  ff.addr = addr;
+  ff.lineno = lineno;
+  ff.funcSize = funcSize;
+  RtlZeroMemory( key,keyLen );
+  RtlMoveMemory( key,&ff,sizeof(flameFrame) );
+  if( funcLen ) RtlMoveMemory( key+sizeof(flameFrame),funcname,funcLen );
+  if( nameLen )
+    RtlMoveMemory( key+sizeof(flameFrame)+funcSize,filename,nameLen*2 );
+
+  int idx;
+  const char *copy = strings_intern( key,(DWORD)keyLen,
+      &ds->svgStrings,ds->heap,&idx );
+  if( !copy ) return( -1 );
+  if( ds->svgStrings.hash_q>q )
+    ds->flameFrame_a[idx] = copy;
+  return( idx );
+}
+
+static void printFlameFrameName( textColor *tc,dbgsym *ds,int idx )
+{
+  const char *key = ds->flameFrame_a[idx];
+  flameFrame ff;
+  RtlMoveMemory( &ff,key,sizeof(flameFrame) );
+  const char *funcname = key + sizeof(flameFrame);
+  const wchar_t *name = (const wchar_t*)( funcname+ff.funcSize );
+
+  if( funcname[0] )
+  {
+    printf( "%s",funcname );
+    return;
+  }
+  const wchar_t *delim = strrchrW( name,'\\' );
+  if( delim ) name = delim + 1;
+  if( !ff.addr )
+    printf( "%S",name );
+  else if( name[0] )
+    printf( "%X [%S]",ff.addr,name );
+  else
+    printf( "%X",ff.addr );
+}
+
+static void printFlameFrameJson( textColor *tc,dbgsym *ds,int idx )
+{
+  const char *key = ds->flameFrame_a[idx];
+  flameFrame ff;
+  RtlMoveMemory( &ff,key,sizeof(flameFrame) );
+
+  printf( "{\"name\":\"" );
+  printFlameFrameName( tc,ds,idx );
+  printf( "\"" );
+  if( ff.lineno>0 )
+    printf( ",\"file\":\"%S\",\"line\":%d",
+        (const wchar_t*)(key+sizeof(flameFrame)+ff.funcSize),ff.lineno );
+  printf( "}" );
+}
+
+// the speedscope frames are shared by all profiles,
+// so they are written again after each one
+static void writeFlameFooter( textColor *tc,appData *ad,dbgsym *ds )
+{
+  if( !tc ) return;
+
+  if( ad->svgFormat==FLAME_SVG )
+    writeFileSeekBack( tc,"</svg>\n" );
+  else if( ad->svgFormat==FLAME_TRACE )
+    writeFileSeekBack( tc,"\n]}\n" );
+  if( ad->svgFormat!=FLAME_SPEEDSCOPE ) return;
+
+  LARGE_INTEGER pos;
+  if( !seekBackBegin(tc,&pos) ) return;
+
+  printf( "\n],\n\"shared\":{\"frames\":[" );
+  int frame_q = ds ? ds->svgStrings.hash_q : 0;
+  int i;
+  for( i=0; i<frame_q; i++ )
+  {
+    printf( i ? ",\n" : "\n" );
+    printFlameFrameJson( tc,ds,i );
+  }
+  printf( "\n]}}\n" );
+
+  seekBackEnd( tc,pos );
+}
+
+static int pushFlameFrame( dbgsym *ds,int path_q,int idx )
+{
+  if( idx<0 ) return( path_q );
+
+  if( path_q>=ds->flamePath_s )
+  {
+    int flamePath_s = ds->flamePath_s + 256;
+    int *flamePath_a = ds->flamePath_a ?
+      HeapReAlloc( ds->heap,0,ds->flamePath_a,flamePath_s*sizeof(int) ) :
+      HeapAlloc( ds->heap,0,flamePath_s*sizeof(int) );
+    if( !flamePath_a ) return( path_q );
+    ds->flamePath_a = flamePath_a;
+    ds->flamePath_s = flamePath_s;
+  }
+  ds->flamePath_a[path_q] = idx;
+  return( path_q + 1 );
+}
+
+// same frames as printStackCountSvg(), appended to flamePath_a
+static int pushFlameStack( void **framesV,int fc,
+    modInfo *mi_a,int mi_q,dbgsym *ds,funcType ft,int path_q )
+{
+  uintptr_t *frames = (uintptr_t*)framesV;
+  stackSourceLocation *ssl = ds->ssl;
+  int sslCount = ds->sslCount;
+  int j;
+  for( j=fc-1; j>=0; j-- )
+  {
+    uintptr_t frame = frames[j];
+    modInfo *mi = findModule( ds,mi_a,mi_q,frame );
+    stackSourceLocation *s = mi ?
+      findStackSourceLocation( frame,ssl,sslCount ) : NULL;
+    if( !s )
+    {
+      path_q = pushFlameFrame( ds,path_q,
+          flameFrameIdx(ds,frame,mi?mi->path:NULL,0,NULL) );
+      continue;
+    }
+
+    // the outermost function of the inline chain first
+    int inlineCount = 0;
+    sourceLocation *sl = &s->sl;
+    for( ; sl; sl=sl->inlineLocation )
+      inlineCount++;
+    int inlinePos;
+    for( inlinePos=inlineCount-1; inlinePos>=0; inlinePos-- )
+    {
+      int k;
+      for( k=0,sl=&s->sl; k<inlinePos; k++ )
+        sl = sl->inlineLocation;
+      path_q = pushFlameFrame( ds,path_q,
+          flameFrameIdx(ds,frame,sl->filename,sl->lineno,sl->funcname) );
+    }
+  }
+  if( ft<FT_COUNT )
+    path_q = pushFlameFrame( ds,path_q,
+        flameFrameIdx(ds,0,NULL,0,ds->funcnames[ft]) );
+  return( path_q );
+}
+
+// part 0: folded stack line
+// part 1: speedscope sample (frame indexes)
+// part 2: speedscope weight
+static void printFlameLeaf( textColor *tc,dbgsym *ds,int path_q,
+    size_t size,int part )
+{
+  const int *path_a = ds->flamePath_a;
+  int i;
+  if( !part )
+  {
+    for( i=0; i<path_q; i++ )
+    {
+      if( i ) printf( ";" );
+      printFlameFrameName( tc,ds,path_a[i] );
+    }
+    printf( " %U\n",size );
+    return;
+  }
+
+  if( ds->flameLeaf_q++ ) printf( ",\n" );
+  if( part==1 )
+  {
+    printf( "[" );
+    for( i=0; i<path_q; i++ )
+      printf( i ? ",%d" : "%d",path_a[i] );
+    printf( "]" );
+  }
+  else
+    printf( "%U",size );
+}
+
+// same walk as printStackGroupSvg(), without combining narrow nodes
+static void printStackGroupFlame( stackGroup *sg,textColor *tc,
+    allocation *alloc_a,const int *alloc_idxs,modInfo *mi_a,int mi_q,
+    dbgsym *ds,int path_q,int sampling,int part )
+{
+  int i;
+  int allocStart = sg->allocStart;
+  int allocCount = sg->allocCount;
+
+  allocation *a = alloc_a + alloc_idxs[allocStart];
+  if( sg->stackCount &&
+      (sg->stackStart+sg->stackCount!=a->frameCount ||
+       allocCount>1) )
+  {
+    funcType blocked = FT_COUNT;
+    if( sampling )
+    {
+      blocked = FT_BLOCKED;
+      for( i=0; i<allocCount; i++ )
+      {
+        int idx = alloc_idxs[allocStart+i];
+        if( alloc_a[idx].ft!=FT_BLOCKED )
+        {
+          blocked = FT_COUNT;
+          break;
+        }
+      }
+    }
+
+    path_q = pushFlameStack(
         a->frames+(a->frameCount-(sg->stackStart+sg->stackCount)),
-        sg->stackCount,
-#ifndef NO_THREADS
-        threadName_a,threadName_q,threadNum,
-#endif
-        tc,mi_a,mi_q,ds,blocked,
-        sg->allocSumSize,ofs,stack,sg->allocSum,sampling,0 );
+        sg->stackCount,mi_a,mi_q,ds,blocked,path_q );
   }
 
   size_t minLeakSize = ds->opt->minLeakSize;
@@ -5437,32 +9256,14 @@ static void printStackGroupSvg( stackGroup *sg,textColor *tc,
       a = alloc_a + idx;
       size_t combSize = a->size*a->count;
       if( combSize<minLeakSize ) continue;
+      int leaf_q;
       if( allocCount>1 )
-      {
-#ifndef NO_THREADS
-        if( sampling )
-          locSvg( tc,0,0,combSize,ofs,stack,0,
-              threadName_a,threadName_q,a->threadNum,
-              NULL,0,NULL,NULL,a->ft==FT_BLOCKED,a->id );
-        else
-#endif
-          printStackCountSvg( NULL,0,
-#ifndef NO_THREADS
-              threadName_a,threadName_q,a->threadNum,
-#endif
-              tc,NULL,0,ds,a->ft,
-              combSize,ofs,stack,a->count,sampling,a->id );
-      }
+        leaf_q = pushFlameStack( NULL,0,NULL,0,ds,a->ft,path_q );
       else
-        stack += printStackCountSvg(
+        leaf_q = pushFlameStack(
             a->frames+(a->frameCount-(sg->stackStart+sg->stackCount)),
-            sg->stackCount,
-#ifndef NO_THREADS
-            threadName_a,threadName_q,a->threadNum,
-#endif
-            tc,mi_a,mi_q,ds,a->ft,
-            combSize,ofs,stack,a->count,sampling,a->id );
-      ofs += combSize;
+            sg->stackCount,mi_a,mi_q,ds,a->ft,path_q );
+      printFlameLeaf( tc,ds,leaf_q,combSize,part );
     }
   }
 
@@ -5473,60 +9274,504 @@ static void printStackGroupSvg( stackGroup *sg,textColor *tc,
   {
     int idx = childSorted_a ? childSorted_a[i] : i;
     stackGroup *sgc = child_a + idx;
-    size_t allocSumSize = sgc->allocSumSize;
-    if( allocSumSize<minLeakSize ) continue;
-    printStackGroupSvg( sgc,tc,alloc_a,alloc_idxs,
-#ifndef NO_THREADS
-        threadName_a,threadName_q,
-#endif
-        mi_a,mi_q,ds,ofs,stack,sampling );
-    ofs += allocSumSize;
+    if( sgc->allocSumSize<minLeakSize ) continue;
+    printStackGroupFlame( sgc,tc,alloc_a,alloc_idxs,mi_a,mi_q,
+        ds,path_q,sampling,part );
   }
 }
 
-static void printFullStackGroupSvg( appData *ad,stackGroup *sg,textColor *tc,
-    allocation *alloc_a,const int *alloc_idxs,
+static void printFullStackGroupFlame( appData *ad,stackGroup *sg,
+    textColor *tc,allocation *alloc_a,const int *alloc_idxs,
+    modInfo *mi_a,int mi_q,dbgsym *ds,const char *fullName,int sampling )
+{
+  // the trace events are written by printSampleTrace()
+  if( ad->svgFormat==FLAME_TRACE ) return;
+
+  if( ad->svgFormat==FLAME_PPROF )
+  {
+    printFullStackGroupPprof( sg,tc,alloc_a,alloc_idxs,mi_a,mi_q,
+        ds,fullName,sampling );
+    return;
+  }
+
+  int path_q = pushFlameFrame( ds,0,flameFrameIdx(ds,0,NULL,0,fullName) );
+
+  if( ad->svgFormat==FLAME_FOLDED )
+  {
+    printStackGroupFlame( sg,tc,alloc_a,alloc_idxs,mi_a,mi_q,
+        ds,path_q,sampling,0 );
+    return;
+  }
+
+  // a sampled profile, each sample has its weight
+  printf( ad->flameCount++ ? ",\n{" : "{" );
+  printf( "\"type\":\"sampled\",\"name\":\"%s\",\"unit\":\"%s\",\n"
+      "\"startValue\":0,\"endValue\":%U,\n"
+      "\"samples\":[\n",
+      fullName,sampling?"none":"bytes",sg->allocSumSize );
+  ds->flameLeaf_q = 0;
+  printStackGroupFlame( sg,tc,alloc_a,alloc_idxs,mi_a,mi_q,
+      ds,path_q,sampling,1 );
+  printf( "],\n\"weights\":[\n" );
+  ds->flameLeaf_q = 0;
+  printStackGroupFlame( sg,tc,alloc_a,alloc_idxs,mi_a,mi_q,
+      ds,path_q,sampling,2 );
+  printf( "]}" );
+}
+
+static void printTraceEvent( textColor *tc,appData *ad,dbgsym *ds,
+    const char *ph,int tid,DWORD ms,int idx )
+{
+  printf( ad->flameCount++ ? ",\n{" : "{" );
+  printf( "\"ph\":\"%s\",\"pid\":1,\"tid\":%d,\"ts\":%u000,\"name\":\"",
+      ph,tid,ms );
+  printFlameFrameName( tc,ds,idx );
+  printf( "\"}" );
+}
+
+// each thread gets begin and end events for the frames
+// which differ from its previous sample,
+// the frames are already symbolized by cacheSymbolData()
+static void printSampleTrace( appData *ad,textColor *tc,
+    allocation *alloc_a,int alloc_q,
 #ifndef NO_THREADS
     threadInfo *threadName_a,int threadName_q,
 #endif
-    modInfo *mi_a,int mi_q,dbgsym *ds,
-    const char *groupName,const char *groupTypeName,int sampling )
+    modInfo *mi_a,int mi_q,dbgsym *ds )
 {
-  char *fullTypeName = NULL;
-  const char *fullName = groupName;
-  if( groupTypeName )
+  int *idxs = HeapAlloc( ds->heap,0,alloc_q*sizeof(int) );
+  if( !idxs ) return;
+  int i;
+  for( i=0; i<alloc_q; i++ )
+    idxs[i] = i;
+#ifndef NO_THREADS
+  // the samples of each thread stay in time order
+  static const int threadKeys[] = { SK_THREAD_DESC };
+  if( !radix_sort_allocations(alloc_a,idxs,alloc_q,ds->heap,threadKeys,1) )
   {
-    fullTypeName = HeapAlloc( ad->heap,0,
-        lstrlen(groupName)+lstrlen(groupTypeName)+4 );
-    lstrcpy( fullTypeName,groupName );
-    lstrcat( fullTypeName," (" );
-    lstrcat( fullTypeName,groupTypeName );
-    lstrcat( fullTypeName,")" );
-    fullName = fullTypeName;
+    HeapFree( ds->heap,0,idxs );
+    return;
   }
-  locSvg( tc,0,0,sg->allocSumSize,ad->svgSum,1,sampling?0:sg->allocSum,
+#endif
+
+  int interval = ad->opt->samplingInterval;
+  if( interval<0 ) interval = -interval;
+  for( i=0; i<alloc_q; )
+  {
+    int threadNum = 1;
 #ifndef NO_THREADS
-      NULL,0,0,
+    threadNum = alloc_a[idxs[i]].threadNum;
+    printf( ad->flameCount++ ? ",\n{" : "{" );
+    printf( "\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+        "\"name\":\"thread_name\",\"args\":{\"name\":\"",threadNum );
+    svgThreadText( tc,threadName_a,threadName_q,threadNum );
+    printf( "\"}}" );
+#endif
+
+    // the previous stack is kept at the start of flamePath_a,
+    // and the current one is appended
+    int prev_q = 0;
+    DWORD ms = 0;
+    int k;
+    for( ; i<alloc_q; i++ )
+    {
+      allocation *a = alloc_a + idxs[i];
+#ifndef NO_THREADS
+      if( a->threadNum!=threadNum ) break;
 #endif
-      NULL,0,fullName,NULL,0,0 );
-  if( fullTypeName ) HeapFree( ad->heap,0,fullTypeName );
+      ms = counterToMs( ad,a->timestamp );
 
-  printStackGroupSvg( sg,tc,alloc_a,alloc_idxs,
+      int cur_q = pushFlameStack( a->frames,a->frameCount,
+          mi_a,mi_q,ds,a->ft,prev_q ) - prev_q;
+      int *path_a = ds->flamePath_a;
+      int *cur_a = path_a + prev_q;
+      int same;
+      for( same=0; same<prev_q && same<cur_q &&
+          path_a[same]==cur_a[same]; same++ );
+      for( k=prev_q-1; k>=same; k-- )
+        printTraceEvent( tc,ad,ds,"E",threadNum,ms,path_a[k] );
+      for( k=same; k<cur_q; k++ )
+        printTraceEvent( tc,ad,ds,"B",threadNum,ms,cur_a[k] );
+      if( cur_q )
+        RtlMoveMemory( path_a,cur_a,cur_q*sizeof(int) );
+      prev_q = cur_q;
+    }
+
+    // the last sample lasts one interval
+    ms += interval;
+    for( k=prev_q-1; k>=0; k-- )
+      printTraceEvent( tc,ad,ds,"E",threadNum,ms,ds->flamePath_a[k] );
+  }
+
+  HeapFree( ds->heap,0,idxs );
+}
+
+// }}}
+// pprof {{{
+
+// the top-level messages of the profile can be written in any order,
+// only the string table entries have to stay in the order of their index
+static void pprofFlush( textColor *tc,dbgsym *ds )
+{
+  pbBuffer *pb = &ds->pb;
+  if( !pb->failed && pb->q )
+    tc->fWriteText( tc,(const char*)pb->buf,pb->q );
+  pb->q = 0;
+  pb->failed = 0;
+}
+
+// new strings are written directly, so this can be used while
+// a message is being built
+static int pprofString( textColor *tc,dbgsym *ds,const char *str,int len )
+{
+  char *key = svgKeyBuffer( ds,len+1 );
+  if( !key ) return( 0 );
+  key[0] = 's';
+  RtlMoveMemory( key+1,str,len );
+
+  int q = ds->svgStrings.hash_q;
+  int idx;
+  if( !strings_intern(key,len+1,&ds->svgStrings,ds->heap,&idx) )
+    return( 0 );
+  if( ds->svgStrings.hash_q>q )
+  {
+    unsigned char head[11];
+    head[0] = 6<<3|2;
+    int head_q = 1 + pbEncodeVarint( head+1,len );
+    tc->fWriteText( tc,(const char*)head,head_q );
+    if( len ) tc->fWriteText( tc,str,len );
+  }
+  return( idx );
+}
+
+static int pprofStringW( textColor *tc,dbgsym *ds,const wchar_t *str )
+{
+  if( !str || !str[0] ) return( 0 );
+
+  int len = WideCharToMultiByte( CP_UTF8,0,str,-1,NULL,0,NULL,NULL );
+  char *utf8 = len>0 ? HeapAlloc( ds->heap,0,len ) : NULL;
+  if( !utf8 ) return( 0 );
+  WideCharToMultiByte( CP_UTF8,0,str,-1,utf8,len,NULL,NULL );
+  int idx = pprofString( tc,ds,utf8,len-1 );
+  HeapFree( ds->heap,0,utf8 );
+  return( idx );
+}
+
+// id of a mapping, function or location, or 0 on failure
+static int pprofId( dbgsym *ds,const void *key,size_t len,int *isNew )
+{
+  *isNew = 0;
+  int q = ds->pprofIds.hash_q;
+  int idx;
+  if( !strings_intern(key,(DWORD)len,&ds->pprofIds,ds->heap,&idx) )
+    return( 0 );
+  *isNew = ds->pprofIds.hash_q>q;
+  return( idx + 1 );
+}
+
+static void pprofValueType( textColor *tc,dbgsym *ds,int field,
+    const char *type,const char *unit )
+{
+  pbBuffer *pb = &ds->pb;
+  size_t start = pbBegin( pb,field );
+  pbUint( pb,1,pprofString(tc,ds,type,lstrlen(type)) );
+  pbUint( pb,2,pprofString(tc,ds,unit,lstrlen(unit)) );
+  pbEnd( pb,start );
+}
+
+// the sample types are either those of the sampling profiler,
+// or of the allocations
+static void writePprofHeader( textColor *tc,dbgsym *ds )
+{
+  pbBuffer *pb = &ds->pb;
+  pprofString( tc,ds,"",0 );
+
+  int interval = ds->opt->samplingInterval;
+  if( interval<0 ) interval = -interval;
+  if( interval )
+  {
+    pprofValueType( tc,ds,1,"samples","count" );
+    pprofValueType( tc,ds,1,"cpu","nanoseconds" );
+    pprofValueType( tc,ds,11,"cpu","nanoseconds" );
+    pbUint( pb,12,(UINT64)interval*1000000 );
+  }
+  else
+  {
+    pprofValueType( tc,ds,1,"alloc_objects","count" );
+    pprofValueType( tc,ds,1,"alloc_space","bytes" );
+    pprofValueType( tc,ds,1,"inuse_space","bytes" );
+    pbUint( pb,14,pprofString(tc,ds,"inuse_space",11) );
+  }
+
+  const char *comment = "heob " HEOB_VER;
+  pbTag( pb,13,0 );
+  pbVarint( pb,pprofString(tc,ds,comment,lstrlen(comment)) );
+
+  pprofFlush( tc,ds );
+}
+
+static int pprofMapping( textColor *tc,dbgsym *ds,modInfo *mi )
+{
+  char key[1+sizeof(size_t)];
+  key[0] = 'M';
+  RtlMoveMemory( key+1,&mi->base,sizeof(size_t) );
+  int isNew;
+  int id = pprofId( ds,key,sizeof(key),&isNew );
+  if( !isNew ) return( id );
+
+  int filename = pprofStringW( tc,ds,mi->path );
+
+  pbBuffer *pb = &ds->pb;
+  size_t start = pbBegin( pb,3 );
+  pbUint( pb,1,id );
+  pbUint( pb,2,mi->base );
+  pbUint( pb,3,mi->base+mi->size );
+  pbUint( pb,5,filename );
+  pbUint( pb,7,1 );
+  pbUint( pb,8,1 );
+  pbUint( pb,9,1 );
+  pbUint( pb,10,1 );
+  pbEnd( pb,start );
+  pprofFlush( tc,ds );
+  return( id );
+}
+
+static int pprofFunction( textColor *tc,dbgsym *ds,
+    const char *funcname,const wchar_t *filename )
+{
+  int funcLen = lstrlen( funcname );
+  int nameLen = filename ? lstrlenW( filename ) : 0;
+  size_t keyLen = 1 + funcLen + 1 + nameLen*2;
+  char *key = svgKeyBuffer( ds,keyLen );
+  if( !key ) return( 0 );
+  key[0] = 'F';
+  RtlMoveMemory( key+1,funcname,funcLen+1 );
+  if( nameLen ) RtlMoveMemory( key+funcLen+2,filename,nameLen*2 );
+  int isNew;
+  int id = pprofId( ds,key,keyLen,&isNew );
+  if( !isNew ) return( id );
+
+  int name = pprofString( tc,ds,funcname,funcLen );
+  int file = pprofStringW( tc,ds,filename );
+
+  pbBuffer *pb = &ds->pb;
+  size_t start = pbBegin( pb,5 );
+  pbUint( pb,1,id );
+  pbUint( pb,2,name );
+  pbUint( pb,3,name );
+  pbUint( pb,4,file );
+  pbEnd( pb,start );
+  pprofFlush( tc,ds );
+  return( id );
+}
+
+// the functions of the inline chain are written before the location,
+// their ids are kept in flamePath_a after path_q
+static int pprofLocation( textColor *tc,dbgsym *ds,
+    modInfo *mi_a,int mi_q,uintptr_t frame,int path_q )
+{
+  char key[1+sizeof(uintptr_t)];
+  key[0] = 'L';
+  RtlMoveMemory( key+1,&frame,sizeof(uintptr_t) );
+  int isNew;
+  int id = pprofId( ds,key,sizeof(key),&isNew );
+  if( !isNew ) return( id ? id : -1 );
+
+  modInfo *mi = findModule( ds,mi_a,mi_q,frame );
+  int mapping = mi ? pprofMapping( tc,ds,mi ) : 0;
+  stackSourceLocation *s = mi ?
+    findStackSourceLocation( frame,ds->ssl,ds->sslCount ) : NULL;
+
+  // the innermost inlined function first, the caller last
+  int func_q = path_q;
+  sourceLocation *sl;
+  for( sl=s?&s->sl:NULL; sl; sl=sl->inlineLocation )
+  {
+    if( !sl->funcname ) continue;
+    int funcId = pprofFunction( tc,ds,sl->funcname,sl->filename );
+    func_q = pushFlameFrame( ds,func_q,funcId ? funcId : -1 );
+  }
+
+  pbBuffer *pb = &ds->pb;
+  size_t start = pbBegin( pb,4 );
+  pbUint( pb,1,id );
+  pbUint( pb,2,mapping );
+  pbUint( pb,3,frame );
+  int i = path_q;
+  for( sl=s?&s->sl:NULL; sl && i<func_q; sl=sl->inlineLocation )
+  {
+    if( !sl->funcname ) continue;
+    size_t line = pbBegin( pb,4 );
+    pbUint( pb,1,ds->flamePath_a[i++] );
+    pbUint( pb,2,sl->lineno>0 ? sl->lineno : 0 );
+    pbEnd( pb,line );
+  }
+  pbEnd( pb,start );
+  pprofFlush( tc,ds );
+  return( id );
+}
+
+// the allocation function on top of the stack
+static int pprofFuncTypeLocation( textColor *tc,dbgsym *ds,funcType ft )
+{
+  char key[1+sizeof(int)];
+  key[0] = 'f';
+  RtlMoveMemory( key+1,&ft,sizeof(int) );
+  int isNew;
+  int id = pprofId( ds,key,sizeof(key),&isNew );
+  if( !isNew ) return( id ? id : -1 );
+
+  int funcId = pprofFunction( tc,ds,ds->funcnames[ft],NULL );
+
+  pbBuffer *pb = &ds->pb;
+  size_t start = pbBegin( pb,4 );
+  pbUint( pb,1,id );
+  size_t line = pbBegin( pb,4 );
+  pbUint( pb,1,funcId );
+  pbEnd( pb,line );
+  pbEnd( pb,start );
+  pprofFlush( tc,ds );
+  return( id );
+}
+
+// which values a sample has, in the order of the sample types
+enum
+{
+  PPROF_SAMPLES,
+  PPROF_LEAKS,
+  PPROF_ALLOCS,
+  PPROF_INUSE,
+};
+
+static void printPprofSample( textColor *tc,dbgsym *ds,allocation *a,
+    modInfo *mi_a,int mi_q,int kind,int group )
+{
+  // location ids, the leaf first
+  int path_q = 0;
+  if( a->ft<FT_COUNT )
+    path_q = pushFlameFrame( ds,path_q,pprofFuncTypeLocation(tc,ds,a->ft) );
+  int j;
+  for( j=0; j<a->frameCount; j++ )
+    path_q = pushFlameFrame( ds,path_q,pprofLocation(tc,ds,mi_a,mi_q,
+          (uintptr_t)a->frames[j],path_q) );
+
+  int groupKey = pprofString( tc,ds,"group",5 );
 #ifndef NO_THREADS
-      threadName_a,threadName_q,
+  int threadKey = kind==PPROF_SAMPLES ?
+    pprofString( tc,ds,"thread",6 ) : 0;
 #endif
-      mi_a,mi_q,ds,ad->svgSum,2,sampling );
-  ad->svgSum += sg->allocSumSize;
+
+  pbBuffer *pb = &ds->pb;
+  size_t start = pbBegin( pb,2 );
+  size_t packed = pbBegin( pb,1 );
+  for( j=0; j<path_q; j++ )
+    pbVarint( pb,ds->flamePath_a[j] );
+  pbEnd( pb,packed );
+
+  UINT64 count = a->count;
+  UINT64 size = (UINT64)a->size*a->count;
+  packed = pbBegin( pb,2 );
+  switch( kind )
+  {
+    case PPROF_SAMPLES:
+      {
+        int interval = ds->opt->samplingInterval;
+        if( interval<0 ) interval = -interval;
+        pbVarint( pb,count );
+        pbVarint( pb,count*interval*1000000 );
+      }
+      break;
+
+    case PPROF_LEAKS:
+      pbVarint( pb,count );
+      pbVarint( pb,size );
+      pbVarint( pb,size );
+      break;
+
+    case PPROF_ALLOCS:
+      pbVarint( pb,count );
+      pbVarint( pb,size );
+      pbVarint( pb,0 );
+      break;
+
+    case PPROF_INUSE:
+      pbVarint( pb,0 );
+      pbVarint( pb,0 );
+      pbVarint( pb,size );
+      break;
+  }
+  pbEnd( pb,packed );
+
+  size_t label = pbBegin( pb,3 );
+  pbUint( pb,1,groupKey );
+  pbUint( pb,2,group );
+  pbEnd( pb,label );
+#ifndef NO_THREADS
+  if( threadKey )
+  {
+    label = pbBegin( pb,3 );
+    pbUint( pb,1,threadKey );
+    pbUint( pb,3,a->threadNum );
+    pbEnd( pb,label );
+  }
+#endif
+
+  pbEnd( pb,start );
+  pprofFlush( tc,ds );
 }
 
-static void writeSvgFooter( textColor *tc,appData *ad )
+// every allocation is a sample with its full stack
+static void printStackGroupPprof( stackGroup *sg,textColor *tc,
+    allocation *alloc_a,const int *alloc_idxs,modInfo *mi_a,int mi_q,
+    dbgsym *ds,int kind,int group )
 {
-  if( !tc ) return;
+  int i;
+  int allocStart = sg->allocStart;
+  int allocCount = sg->allocCount;
+  size_t minLeakSize = ds->opt->minLeakSize;
+
+  allocation *a = alloc_a + alloc_idxs[allocStart];
+  if( sg->stackStart+sg->stackCount==a->frameCount )
+  {
+    for( i=0; i<allocCount; i++ )
+    {
+      a = alloc_a + alloc_idxs[allocStart+i];
+      if( a->size*a->count<minLeakSize ) continue;
+      printPprofSample( tc,ds,a,mi_a,mi_q,kind,group );
+    }
+  }
+
+  stackGroup *child_a = sg->child_a;
+  int child_q = sg->child_q;
+  for( i=0; i<child_q; i++ )
+  {
+    stackGroup *sgc = child_a + i;
+    if( sgc->allocSumSize<minLeakSize ) continue;
+    printStackGroupPprof( sgc,tc,alloc_a,alloc_idxs,mi_a,mi_q,
+        ds,kind,group );
+  }
+}
 
-  printf( "</svg>\n" );
+static void printFullStackGroupPprof( stackGroup *sg,textColor *tc,
+    allocation *alloc_a,const int *alloc_idxs,modInfo *mi_a,int mi_q,
+    dbgsym *ds,const char *fullName,int sampling )
+{
+  // no profile can have both kinds of sample types
+  if( sampling!=(ds->opt->samplingInterval!=0) ) return;
 
-  CloseHandle( tc->out );
-  HeapFree( ad->heap,0,tc );
+  if( !ds->svgStrings.hash_q )
+    writePprofHeader( tc,ds );
+
+  int kind = PPROF_LEAKS;
+  if( sampling )
+    kind = PPROF_SAMPLES;
+  else if( !lstrcmp(fullName,"allocations") )
+    kind = PPROF_ALLOCS;
+  else if( !lstrcmp(fullName,"heap peak") )
+    kind = PPROF_INUSE;
+  int group = pprofString( tc,ds,fullName,lstrlen(fullName) );
+
+  printStackGroupPprof( sg,tc,alloc_a,alloc_idxs,mi_a,mi_q,ds,kind,group );
 }
 
 // }}}
@@ -6736,6 +10981,7 @@ static int isMinidump( appData *ad,const wchar_t *name )
 
   dbgsym ds;
   dbgsym_init( &ds,ad,tc,ad->opt,NULL,heap,symPath,FALSE,NULL );
+  symCacheOpen( &ds,ad->symCacheName );
   ad->ds = &ds;
 
   if( !ds.swf.fStackWalk64 )
@@ -6936,6 +11182,7 @@ static int isMinidump( appData *ad,const wchar_t *name )
     }
     if( ad->mi_q )
     {
+      dbgsym_sortmodules( &ds,ad->mi_a,ad->mi_q );
       ad->dump_mi_map_a =
         HeapAlloc( heap,HEAP_ZERO_MEMORY,ad->mi_q*sizeof(char*) );
       ad->dump_file_found_a = HeapAlloc( heap,HEAP_ZERO_MEMORY,ad->mi_q );
@@ -7436,6 +11683,14 @@ static void mainLoop( appData *ad,UINT *exitCode )
         waitTime = FLASH_TIMEOUT - flashTime;
     }
     // }}}
+    // write the buffered output while waiting for more data
+    if( WaitForSingleObject(ov.hEvent,0)==WAIT_TIMEOUT )
+    {
+      flushText( tc );
+      flushText( tcXml );
+      flushText( tcSvg );
+    }
+
     DWORD didread;
     DWORD waitRet;
     if( !fMsgWaitForMultipleObjects )
@@ -7639,33 +11894,129 @@ static void mainLoop( appData *ad,UINT *exitCode )
         break;
 
         // }}}
-        // modules {{{
+        // allocation profile {{{
 
-      case WRITE_MODS:
-        if( !readFile(readPipe,&mi_q,sizeof(int),&ov) )
-          mi_q = 0;
-        if( !mi_q ) break;
-        if( mi_a ) HeapFree( heap,0,mi_a );
-        mi_a = HeapAlloc( heap,0,mi_q*sizeof(modInfo) );
-        if( !readFile(readPipe,mi_a,mi_q*sizeof(modInfo),&ov) )
+      case WRITE_HEAP_TIMELINE:
         {
-          mi_q = 0;
-          break;
+          int timeline_q;
+          if( !readFile(readPipe,&timeline_q,sizeof(int),&ov) )
+            break;
+          if( !readFile(readPipe,&ad->timelinePeak,sizeof(int),&ov) )
+            break;
+          if( !timeline_q ) break;
+          ad->timeline_a =
+            HeapAlloc( heap,0,(size_t)timeline_q*sizeof(size_t) );
+          if( !ad->timeline_a ) break;
+          if( !readFile(readPipe,ad->timeline_a,
+                (size_t)timeline_q*sizeof(size_t),&ov) )
+          {
+            HeapFree( heap,0,ad->timeline_a );
+            ad->timeline_a = NULL;
+            break;
+          }
+          ad->timeline_q = timeline_q;
         }
-#ifndef NO_DBGHELP
-        if( ds->fSymGetModuleInfo64 && ds->fSymLoadModule64 )
+        break;
+
+      case WRITE_ALLOC_PROFILE:
         {
-          int m;
-          IMAGEHLP_MODULE64 im;
-          im.SizeOfStruct = sizeof(IMAGEHLP_MODULE64);
-          for( m=0; m<mi_q; m++ )
+          int prof_q;
+          if( !readFile(readPipe,&prof_q,sizeof(int),&ov) )
+            break;
+          allocProfile *prof_a = NULL;
+          if( prof_q )
+          {
+            prof_a = HeapAlloc( heap,0,(size_t)prof_q*sizeof(allocProfile) );
+            if( !readFile(readPipe,prof_a,
+                  (size_t)prof_q*sizeof(allocProfile),&ov) )
+            {
+              HeapFree( heap,0,prof_a );
+              break;
+            }
+          }
+
+          printAllocProfile( prof_a,prof_q,mi_a,mi_q,
+              opt,tc,ds,heap,ad,tcSvg );
+
+          if( prof_a ) HeapFree( heap,0,prof_a );
+          if( ad->timeline_a )
           {
-            if( !ds->fSymGetModuleInfo64(ds->process,mi_a[m].base,&im) )
-              dbgsym_loadmodule( ds,mi_a[m].path,mi_a[m].base,
-                  (DWORD)mi_a[m].size );
+            HeapFree( heap,0,ad->timeline_a );
+            ad->timeline_a = NULL;
           }
         }
+        break;
+
+        // }}}
+        // modules {{{
+
+      case WRITE_MODS:
+        {
+          // modules loaded and unloaded since the last WRITE_MODS,
+          // a negative unload count replaces the whole list
+          int add_q,rem_q;
+          if( !readFile(readPipe,&add_q,sizeof(int),&ov) ||
+              !readFile(readPipe,&rem_q,sizeof(int),&ov) )
+            break;
+
+          size_t *rem_a = NULL;
+          if( rem_q>0 )
+          {
+            rem_a = HeapAlloc( heap,0,rem_q*sizeof(size_t) );
+            if( !readFile(readPipe,rem_a,rem_q*sizeof(size_t),&ov) )
+            {
+              HeapFree( heap,0,rem_a );
+              break;
+            }
+          }
+
+          int m,r;
+          int mi_q_old = mi_q;
+          for( m=0,mi_q=0; m<mi_q_old; m++ )
+          {
+            size_t base = mi_a[m].base;
+            for( r=0; r<rem_q && rem_a[r]!=base; r++ );
+            if( r==rem_q )
+            {
+              if( m!=mi_q ) mi_a[mi_q] = mi_a[m];
+              mi_q++;
+              continue;
+            }
+#ifndef NO_DBGHELP
+            // forget the symbols, a different module
+            // could be loaded at the same address later
+            if( ds->fSymUnloadModule64 )
+              ds->fSymUnloadModule64( ds->process,base );
+#endif
+          }
+          if( rem_a ) HeapFree( heap,0,rem_a );
+
+          if( add_q>0 )
+          {
+            modInfo *mi_n = mi_a ?
+              HeapReAlloc( heap,0,mi_a,(mi_q+add_q)*sizeof(modInfo) ) :
+              HeapAlloc( heap,0,(mi_q+add_q)*sizeof(modInfo) );
+            if( !mi_n ) break;
+            mi_a = mi_n;
+            if( !readFile(readPipe,mi_a+mi_q,add_q*sizeof(modInfo),&ov) )
+              break;
+#ifndef NO_DBGHELP
+            if( ds->fSymGetModuleInfo64 && ds->fSymLoadModule64 )
+            {
+              IMAGEHLP_MODULE64 im;
+              im.SizeOfStruct = sizeof(IMAGEHLP_MODULE64);
+              for( m=mi_q; m<mi_q+add_q; m++ )
+              {
+                if( !ds->fSymGetModuleInfo64(ds->process,mi_a[m].base,&im) )
+                  dbgsym_loadmodule( ds,mi_a[m].path,mi_a[m].base,
+                      (DWORD)mi_a[m].size );
+              }
+            }
 #endif
+            mi_q += add_q;
+          }
+          dbgsym_sortmodules( ds,mi_a,mi_q );
+        }
         break;
 
         // }}}
@@ -7761,15 +12112,8 @@ static void mainLoop( appData *ad,UINT *exitCode )
           modInfo *allocMi = NULL;
           if( !aa[1].ptr && (aa[1].id==2 || aa[1].id==3) )
           {
-            uintptr_t frame = (uintptr_t)aa[1].frames[0];
-            int k;
-            for( k=0; k<mi_q; k++ )
-            {
-              modInfo *mi = mi_a + k;
-              if( frame<mi->base || frame>=mi->base+mi->size ) continue;
-              allocMi = mi;
-              break;
-            }
+            allocMi = findModule( ds,mi_a,mi_q,
+                (uintptr_t)aa[1].frames[0] );
           }
 
           cacheSymbolData( aa,NULL,4,mi_a,mi_q,ds,1 );
@@ -7804,14 +12148,14 @@ static void mainLoop( appData *ad,UINT *exitCode )
             printf( "$I  allocated (size %U) from:\n",aa[1].size );
             if( allocMi )
               locOut( tc,allocMi->base,allocMi->path,
-                  DWST_BASE_ADDR,0,NULL,opt,0 );
+                  DWST_BASE_ADDR,0,NULL,ds,0 );
           }
           else if( aa[1].id==3 )
           {
             printf( "$I  pointing to global area of:\n" );
             if( allocMi )
               locOut( tc,allocMi->base,allocMi->path,
-                  DWST_BASE_ADDR,0,NULL,opt,0 );
+                  DWST_BASE_ADDR,0,NULL,ds,0 );
           }
           // }}}
 
@@ -8245,6 +12589,69 @@ static void mainLoop( appData *ad,UINT *exitCode )
         }
         break;
 
+        // }}}
+        // repeated errors {{{
+
+      case WRITE_ERROR_REPEATS:
+        {
+          int repeat_q,limit;
+          if( !readFile(readPipe,&repeat_q,sizeof(int),&ov) )
+            break;
+          if( !readFile(readPipe,&limit,sizeof(int),&ov) )
+            break;
+
+          errorRepeat *er = HeapAlloc( heap,0,sizeof(errorRepeat) );
+          if( !er ) break;
+          int i;
+          for( i=0; i<repeat_q; i++ )
+          {
+            if( !readFile(readPipe,er,sizeof(errorRepeat),&ov) )
+              break;
+
+            cacheSymbolData( er->aa,NULL,2,mi_a,mi_q,ds,1 );
+
+            const char *error;
+            const char *kind;
+            switch( er->type )
+            {
+              case WRITE_FREE_FAIL:
+                error = "deallocation of invalid pointer";
+                kind = "InvalidFree";
+                break;
+              case WRITE_DOUBLE_FREE:
+                error = "double free";
+                kind = "InvalidFree";
+                break;
+              case WRITE_SLACK:
+                error = "write access violation";
+                kind = "InvalidWrite";
+                break;
+              default:
+                error = "mismatching allocation/release method";
+                kind = "MismatchedFree";
+                break;
+            }
+            int repeats = er->count - limit;
+            printf( "\n$W%s repeated %d more time%s\n",
+                error,repeats,repeats>1?"s":"" );
+            printf( "$S  called on:" );
+            printThreadName( er->aa[0].threadNum );
+            printStackCount( er->aa[0].frames,er->aa[0].frameCount,
+                mi_a,mi_q,ds,er->aa[0].ft,0 );
+            if( er->aa[1].ptr )
+              printAllocatedFreed( &er->aa[1],0,mi_a,mi_q,ds );
+
+            // unique ids from the top, so they don't collide with
+            // the allocation ids of the leaks
+            writeXmlErrorRepeat( tcXml,ds,er,kind,error,repeats,
+                (size_t)-1-i,mi_a,mi_q );
+
+            error_q += repeats;
+          }
+          HeapFree( heap,0,er );
+        }
+        break;
+
         // }}}
     }
 
@@ -8375,7 +12782,11 @@ static void showHelpText( appData *ad,options *defopt,int fullhelp )
   printf( "\n" );
   if( fullhelp )
   {
+    printf( "    $I-W$BX$N    "
+        "minimum flame graph node width in 1/10000 [$I%d$N]\n",
+        defopt->svgMinWidth );
     printf( "    $I-y$BX$N    symbol path\n" );
+    printf( "    $I-K$BX$N    symbol cache file\n" );
     printf( "    $I-Y$BX$N    check dll dependencies\n" );
     if( fullhelp>1 )
     {
@@ -8472,6 +12883,10 @@ static void showHelpText( appData *ad,options *defopt,int fullhelp )
     printf( "              $I2$N = on,"
         " mismatching allocation/release method\n" );
   }
+  if( fullhelp )
+    printf( "    $I-Q$BX$N    "
+        "report identical errors only X times ($I0$N = all) [$I%d$N]\n",
+        defopt->errorLimit );
   printf( "    $I-D$BX$N    show exception details [$I%d$N]\n",
       defopt->exceptionDetails );
   if( fullhelp>1 )
@@ -8514,6 +12929,7 @@ static void showHelpText( appData *ad,options *defopt,int fullhelp )
     printf( "              $I1$N = on\n" );
     printf( "              $I2$N = on, merge common stack frames\n" );
     printf( "              $I3$N = sort by thread and time\n" );
+    printf( "              $I4$N = sort by allocation time\n" );
   }
   printf( "    $I-F$BX$N    show full path [$I%d$N]\n",
       defopt->fullPath );
@@ -8530,8 +12946,16 @@ static void showHelpText( appData *ad,options *defopt,int fullhelp )
         " fuzzy detect leak types (show reachable)\n" );
   }
   if( fullhelp )
+  {
     printf( "    $I-z$BX$N    minimum leak size [$I%U$N]\n",
         defopt->minLeakSize );
+    printf( "    $I-j$BX$N    "
+        "show only leaks allocated after X seconds [$I%d$N]\n",
+        defopt->leakAfter );
+    printf( "    $I-N$BX$N    "
+        "show only the X biggest leak groups [$I%d$N]\n",
+        defopt->topGroups );
+  }
   printf( "    $I-k$BX$N    control leak recording [$I%d$N]\n",
       defopt->leakRecording );
   if( fullhelp>1 )
@@ -8569,6 +12993,13 @@ static void showHelpText( appData *ad,options *defopt,int fullhelp )
     printf( "              $I2$N = on,"
         " only keep output files with leaks or errors\n" );
   }
+  printf( "    $I-u$BX$N    allocation profiler [$I%d$N]\n",
+      defopt->allocProfile );
+  printf( "    $I-U$BX$N    "
+      "short-lived allocation lifetime in microseconds [$I%d$N]\n",
+      defopt->shortLifetime );
+  printf( "    $I-t$BX$N    heap timeline interval in milliseconds [$I%d$N]\n",
+      defopt->heapTimeline );
 #if USE_STACKWALK
   printf( "    $I-I$BX$N    sampling profiler interval [$I%d$N]\n",
       defopt->samplingInterval );
@@ -8700,6 +13131,13 @@ CODE_SEG(".text$7") void mainCRTStartup( void )
 #endif
     0,                              // forward startup info and inheritables
     0,                              // disable parallel dll loading
+    0,                              // allocation profiler
+    0,                              // short-lived allocation lifetime
+    0,                              // heap timeline interval
+    0,                              // show leaks allocated after seconds
+    0,                              // show only the biggest leak groups
+    1,                              // minimum flame graph node width
+    0,                              // report limit of identical errors
   };
   // }}}
   options opt = defopt;
@@ -8757,6 +13195,11 @@ CODE_SEG(".text$7") void mainCRTStartup( void )
         checkDllDependencies = wtoi( args+2 );
         break;
 
+      case 'K':
+        if( ad->symCacheName ) break;
+        ad->symCacheName = getStringOption( args+2,heap );
+        break;
+
 #ifndef NO_DBGHELP
       case '#':
         {
@@ -8946,7 +13389,7 @@ CODE_SEG(".text$7") void mainCRTStartup( void )
       ad->outName[0]<='2' && !ad->outName[1] )
     outNameNum = ad->outName[0] - '0';
   HANDLE out = GetStdHandle( STD_OUTPUT_HANDLE );
-  ad->tcOut = HeapAlloc( heap,0,sizeof(textColor) );
+  ad->tcOut = HeapAlloc( heap,HEAP_ZERO_MEMORY,sizeof(textColor) );
   textColor *tc = ad->tcOut;
   checkOutputVariant( tc,out,NULL );
 
@@ -9362,18 +13805,19 @@ CODE_SEG(".text$7") void mainCRTStartup( void )
     if( out!=tc->out )
     {
       ad->tcOutOrig = ad->tcOut;
-      tc = ad->tcOut = HeapAlloc( heap,0,sizeof(textColor) );
+      tc = ad->tcOut = HeapAlloc( heap,HEAP_ZERO_MEMORY,sizeof(textColor) );
       checkOutputVariant( tc,out,ad->exePathW );
     }
   }
   else if( ad->xmlName || ad->svgName )
   {
+    freeTextBuffer( tc );
     out = tc->out = NULL;
     tc->fTextColor = NULL;
   }
   if( !tc->out && !ad->tcOutOrig && opt.attached )
   {
-    ad->tcOutOrig = HeapAlloc( heap,0,sizeof(textColor) );
+    ad->tcOutOrig = HeapAlloc( heap,HEAP_ZERO_MEMORY,sizeof(textColor) );
     checkOutputVariant( ad->tcOutOrig,GetStdHandle(STD_OUTPUT_HANDLE),NULL );
   }
   if( !out )
@@ -9464,6 +13908,7 @@ CODE_SEG(".text$7") void mainCRTStartup( void )
     dbgsym_init( &ds,ad->pi.hProcess,tc,&opt,funcnames,heap,symPath,TRUE,
         RETURN_ADDRESS() );
     ds.threadInitAddr += ad->kernel32offset;
+    symCacheOpen( &ds,ad->symCacheName );
     ad->ds = &ds;
     if( delim ) delim[0] = '\\';
     if( symPathBuf ) HeapFree( heap,0,symPathBuf );
@@ -9522,6 +13967,10 @@ CODE_SEG(".text$7") void mainCRTStartup( void )
 
     if( opt.pid )
     {
+      flushText( tc );
+      // not compressed like the -o file
+      gzipStream *gz = tc->gz;
+      tc->gz = NULL;
       tc->out = ad->err;
       printf( "\n-------------------- PID %u --------------------\n",
           ad->pi.dwProcessId );
@@ -9530,7 +13979,9 @@ CODE_SEG(".text$7") void mainCRTStartup( void )
       waitForKey( tc,ad->in );
 
       printf( " done\n\n" );
+      flushText( tc );
       tc->out = out;
+      tc->gz = gz;
     }
 
     if( ad->in && !opt.leakRecording && tc->fTextColor!=&TextColorConsole &&
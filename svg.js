@@ -5,9 +5,12 @@
 //          http://www.boost.org/LICENSE_1_0.txt)
 
 const SHOW_SUM_COUNT = 100;
+const MIN_DRAW_WIDTH = 0.25;
+const MIN_TEXT_WIDTH = 10;
 
 var headerHeight = 50;
 var footerHeight = 90;
+var timelineHeight = 100;
 var spacer = 10;
 
 var maxStack = 0;
@@ -29,16 +32,54 @@ var mapType;
 var suppressStacks = 0;
 var searchRe;
 
-var addrCountMap = new Map();
-var sourceCountMap = new Map();
-var funcCountMap = new Map();
+// all attribute values, every string is stored only once
+var strs = new Array();
+var strMap = new Map();
+var colors = new Array();
+
+// the nodes of the flame graph, one entry per svg element of the file,
+// string attributes are indices of strs (-1 if missing)
+var nodeStart = 1;
+var nodeCount = 0;
+var nodeOfs;
+var nodeStack;
+var nodeSum;
+var nodeAllocs;
+var nodeType;
+var nodeAddr;
+var nodeSource;
+var nodeFunc;
+var nodeMod;
+var nodeThread;
+var nodeBlocked;
+var nodeId;
+var nodeLabel;
+var nodeColor;
+var nodeFound;
+var allText = '';
+
+// position of the nodes in the current zoom,
+// rows contain the indices of the drawn nodes, sorted by x
+var nodeX;
+var nodeWidth;
+var nodeOpacity;
+var rows = new Array();
+var canvas;
+var canvasWidth = 0;
+var hoverNode = -1;
+var highlighter;
+var drawPending = false;
+
+var addrCountMap;
+var sourceCountMap;
+var funcCountMap;
 var addrCountArr;
 var sourceCountArr;
 var funcCountArr;
 var maxCount;
 var showMap;
 var showArr;
-var showKey;
+var showCol;
 
 var threadMap = new Map();
 var threadArray = new Array();
@@ -53,13 +94,15 @@ function heobInit()
 
   svgs[0].onmousedown = function (e) { if (e.button === 1) return false; };
 
+  parseNodes(svgs);
+
   maxStack = -1;
-  let bottom, zoomSvg;
-  let firstSvg;
+  let zoomNode = -1;
   let minStack = 0;
   let sumSamples = 0;
   let sumAllocs = 0;
   let colorMapSource = new Map();
+  let colorMapSourceInlined = new Map();
   let colorMapFunc = new Map();
   let colorMapAddr = new Map();
   let colorMapBlocked = new Map();
@@ -68,18 +111,15 @@ function heobInit()
 
   let sumAll = 0;
   let thread1Ofs = 0;
-  for (let i = 0; i < svgs.length; i++)
+  for (let i = 1; i < nodeCount; i++)
   {
-    let svg = svgs[i];
-    if (svg.attributes['heobSum'] === undefined) continue;
-
-    let samples = parseInt(svg.attributes['heobSum'].value);
-    let svgType = svg.attributes['heobAllocs'] === undefined;
+    let samples = nodeSum[i];
+    let svgType = nodeType[i] !== 0;
 
-    if (svgType && svg.attributes['heobThread'] !== undefined)
+    if (svgType && nodeThread[i] >= 0)
     {
-      let thread = parseInt(svg.attributes['heobThread'].value.substring(7));
-      let ofs = parseInt(svg.attributes['heobOfs'].value);
+      let thread = parseInt(strs[nodeThread[i]].substring(7));
+      let ofs = nodeOfs[i];
       if (thread === 1 && ofs + 0.1 >= thread1Ofs)
       {
         sampleTimes += samples;
@@ -87,39 +127,32 @@ function heobInit()
       }
     }
 
-    let stack = parseInt(svg.attributes['heobStack'].value);
-    if (stack !== 1) continue;
+    if (nodeStack[i] !== 1) continue;
 
     sumAll += samples;
   }
   if (sumAll > 0)
   {
-    let allSvg = document.createElementNS(svgNs, 'svg');
-    allSvg.setAttribute('heobSum', sumAll);
-    allSvg.setAttribute('heobOfs', 0);
-    allSvg.setAttribute('heobStack', 0);
-    allSvg.setAttribute('heobFunc', 'all');
-    svgs[0].appendChild(allSvg);
+    // node 0 is the bottom of everything
+    nodeStart = 0;
+    nodeSum[0] = sumAll;
+    nodeFunc[0] = internStr('all');
   }
 
-  for (let i = 0; i < svgs.length; i++)
+  addrCountMap = createCountMap(strs.length);
+  sourceCountMap = createCountMap(strs.length);
+  funcCountMap = createCountMap(strs.length);
+
+  for (let i = 1; i < nodeCount; i++)
   {
-    let svg = svgs[i];
-    if (svg.attributes['heobSum'] === undefined) continue;
-
-    let ofs = parseInt(svg.attributes['heobOfs'].value);
-    let stack = parseInt(svg.attributes['heobStack'].value);
-    let samples = parseInt(svg.attributes['heobSum'].value);
-    let allocs = 0;
-    let svgType = svg.attributes['heobAllocs'] === undefined;
-    if (!svgType)
-      allocs = parseInt(svg.attributes['heobAllocs'].value);
+    let ofs = nodeOfs[i];
+    let stack = nodeStack[i];
+    let samples = nodeSum[i];
+    let allocs = nodeAllocs[i];
+    let svgType = nodeType[i] !== 0;
     if (mapType === undefined)
       mapType = svgType;
 
-    if (firstSvg === undefined && stack > 0)
-      firstSvg = svg;
-
     if (stack === 1)
     {
       if (svgType)
@@ -127,112 +160,76 @@ function heobInit()
       sumAllocs += allocs;
     }
 
-    if (stack === 1 && zoomSvg === undefined)
-      zoomSvg = svg;
-    else if (stack === 0)
-    {
-      bottom = svg;
-      if (samples > parseInt(zoomSvg.attributes['heobSum'].value) + 0.1)
-        zoomSvg = svg;
-      else
-        minStack = 1;
-
-      svg.setAttribute('heobText',
-          sumText(sumSamples, samples - sumSamples, sumAllocs));
-    }
+    if (stack === 1 && zoomNode < 0)
+      zoomNode = i;
 
     if (stack > maxStack) maxStack = stack;
 
     if (stack > 1)
     {
-      if (svg.attributes['heobAddr'] !== undefined &&
-          svg.attributes['heobMod'] !== undefined)
-      {
-        let addrKey = svg.attributes['heobAddr'].value;
-        addToCountMap(addrKey, addrCountMap, ofs, samples, svg);
-      }
-      if (svg.attributes['heobSource'] !== undefined)
-      {
-        let sourceKey = svg.attributes['heobSource'].value;
-        addToCountMap(sourceKey, sourceCountMap, ofs, samples, svg);
-      }
-      if (svg.attributes['heobFunc'] !== undefined)
-      {
-        let funcKey = svg.attributes['heobFunc'].value;
-        addToCountMap(funcKey, funcCountMap, ofs, samples, svg);
-      }
+      if (nodeAddr[i] >= 0 && nodeMod[i] >= 0)
+        addToCountMap(nodeAddr[i], addrCountMap, ofs, samples, i);
+      if (nodeSource[i] >= 0)
+        addToCountMap(nodeSource[i], sourceCountMap, ofs, samples, i);
+      if (nodeFunc[i] >= 0)
+        addToCountMap(nodeFunc[i], funcCountMap, ofs, samples, i);
     }
 
     let color;
     if (stack <= 1)
-      color = createBaseColor();
-    else if (svg.attributes['heobSource'] !== undefined)
+      color = getColorOfMap(-1, undefined, createBaseColor);
+    else if (nodeSource[i] >= 0)
     {
-      color = getColorOfMap(svg,
-          colorMapSource, 'heobFunc', createSourceColor);
-      if (svg.attributes['heobAddr'] === undefined)
-        color = '#' +
-          (parseInt(color.substring(1), 16) + 0x004000).toString(16);
+      color = getColorOfMap(nodeFunc[i], colorMapSource, createSourceColor);
+      if (nodeAddr[i] < 0)
+        color = getColorOfMap(color, colorMapSourceInlined,
+          function ()
+          {
+            return '#' +
+              (parseInt(colors[color].substring(1), 16) + 0x004000)
+              .toString(16);
+          });
     }
-    else if (svg.attributes['heobFunc'] !== undefined)
-      color = getColorOfMap(svg,
-          colorMapFunc, 'heobFunc', createFuncColor);
-    else if (svg.attributes['heobAddr'] !== undefined)
-      color = getColorOfMap(svg,
-          colorMapAddr, 'heobAddr', createAddrColor);
-    else if (svg.attributes['heobBlocked'] !== undefined)
-      color = getColorOfMap(svg,
-          colorMapBlocked, 'heobThread', createBlockedColor);
+    else if (nodeFunc[i] >= 0)
+      color = getColorOfMap(nodeFunc[i], colorMapFunc, createFuncColor);
+    else if (nodeAddr[i] >= 0)
+      color = getColorOfMap(nodeAddr[i], colorMapAddr, createAddrColor);
+    else if (nodeBlocked[i])
+      color = getColorOfMap(nodeThread[i], colorMapBlocked,
+          createBlockedColor);
     else
-      color = getColorOfMap(svg,
-          colorMapThread, 'heobThread', createThreadColor);
-
-    svg.setAttribute('class', 'sample');
-    svg.setAttribute('onmouseover', 'infoSet(this)');
-    svg.setAttribute('onmouseout', 'infoClear()');
-    svg.setAttribute('onclick', 'zoom(evt, this)');
-    svg.setAttribute('heobColor', color);
-    svg.setAttribute('onmousedown', 'delZoom(evt, this)');
-
-    addTitle(svg, svgNs, '');
-
-    addRectBg(svg, svgNs, rect0);
-
-    addRect(svg, svgNs, color);
+      color = getColorOfMap(nodeThread[i], colorMapThread,
+          createThreadColor);
+    nodeColor[i] = color;
 
     let t;
-    if (svg.attributes['heobFunc'] !== undefined)
-      t = svg.attributes['heobFunc'].value;
-    else if (svg.attributes['heobSource'] !== undefined)
-      t = svg.attributes['heobSource'].value;
-    else if (svg.attributes['heobMod'] !== undefined)
-    {
-      t = svg.attributes['heobMod'].value;
-      let delim = t.lastIndexOf('\\');
-      if (delim >= 0)
-        t = t.substr(delim + 1);
-    }
-    else if (svg.attributes['heobAddr'] !== undefined)
-      t = svg.attributes['heobAddr'].value;
-    else if (svg.attributes['heobThread'] !== undefined)
-      t = svg.attributes['heobThread'].value;
+    if (nodeFunc[i] >= 0)
+      t = nodeFunc[i];
+    else if (nodeSource[i] >= 0)
+      t = nodeSource[i];
+    else if (nodeMod[i] >= 0)
+      t = internStr(attributeToText(nodeMod[i], true));
+    else if (nodeAddr[i] >= 0)
+      t = nodeAddr[i];
+    else if (nodeThread[i] >= 0)
+      t = nodeThread[i];
     else
       continue;
-    addText(svg, svgNs, t);
+    nodeLabel[i] = t;
 
-    if (svg.attributes['heobBlocked'] !== undefined)
+    if (nodeBlocked[i])
       blockedCount++;
 
-    if (svg.attributes['heobThread'] !== undefined)
+    if (nodeThread[i] >= 0)
     {
-      let thread = svg.attributes['heobThread'].value;
+      let thread = nodeThread[i];
       let mapEntry = threadMap.get(thread);
       if (mapEntry === undefined)
       {
         mapEntry = new Array(5);
         mapEntry[0] = 0;           // sum of samples
         mapEntry[1] = 0;           // maximum extention
-        mapEntry[2] = svg;         // data reference
+        mapEntry[2] = i;           // data reference
         mapEntry[3] = 0;           // sum of allocation count
         mapEntry[4] = undefined;   // color
         threadMap.set(thread, mapEntry);
@@ -240,45 +237,36 @@ function heobInit()
       if (ofs + 0.1 >= mapEntry[1] && mapType === svgType)
       {
         if (mapEntry[0] && mapEntry[4] === undefined)
-          mapEntry[4] = getColorOfMap(svg,
-              colorMapThread, 'heobThread', createThreadColor);
+          mapEntry[4] = getColorOfMap(thread,
+              colorMapThread, createThreadColor);
         mapEntry[0] += samples;
         mapEntry[1] = ofs + samples;
         mapEntry[3] += allocs;
       }
     }
   }
-  maxStack++;
-  if (minStack > 0)
+  if (nodeStart === 0)
   {
-    svgs[0].removeChild(bottom);
-    bottom = undefined;
-    for (let i = 0; i < svgs.length; i++)
-    {
-      let svg = svgs[i];
-      if (svg.attributes['heobStack'] === undefined) continue;
+    nodeColor[0] = getColorOfMap(-1, undefined, createBaseColor);
+    nodeLabel[0] = nodeFunc[0];
+    allText = sumText(sumSamples, sumAll - sumSamples, sumAllocs);
 
-      svg.setAttribute('heobStack',
-          parseInt(svg.attributes['heobStack'].value) - 1);
-    }
-    maxStack--;
+    if (sumAll > nodeSum[zoomNode] + 0.1)
+      zoomNode = 0;
+    else
+      minStack = 1;
   }
-  for (let i = 0; i < svgs.length; i++)
+  maxStack++;
+  if (minStack > 0)
   {
-    let svg = svgs[i];
-    if (svg.attributes['heobSum'] === undefined) continue;
-
-    let t = withNL(funcAttribute(svg)) + withNL(sourceAttribute(svg, true)) +
-      withNL(addrModAttribute(svg, true)) + withNL(sumAttribute(svg)) +
-      withNL(threadAttribute(svg)) + withNL(idAttribute(svg));
-    svg.getElementsByTagName('title')[0].textContent = t;
+    nodeStart = 1;
+    for (let i = 1; i < nodeCount; i++)
+      nodeStack[i]--;
+    maxStack--;
   }
 
   let svg = svgs[0];
 
-  if (firstSvg !== undefined && bottom !== undefined)
-    svg.insertBefore(bottom, firstSvg);
-
   let svgWidth = parseInt(svg.width.baseVal.value);
   fullWidth = svgWidth - 2 * spacer;
   let fullHeight = headerHeight + maxStack * 16 + footerHeight;
@@ -306,13 +294,18 @@ function heobInit()
     svgHeight += 40;
   if (extraCount > 0)
     svgHeight += extraCount * 16;
+  let timeline = document.getElementById('heapTimeline');
+  let timelineY = svgHeight;
+  if (timeline !== null)
+    svgHeight += timelineHeight + spacer;
   svg.setAttribute('height', svgHeight);
   svg.setAttribute('viewBox', '0 0 ' + svgWidth + ' ' + svgHeight);
 
+  addCanvas(svg, svgNs, svgWidth, maxStack * 16);
+
   halfWidth = fullWidth;
   if (maxCount > 0 && threadArray.length > 0)
     halfWidth = (fullWidth - spacer) / 2;
-
   let plusMinusY = headerHeight + (maxStack - 2) * 16 + 3.5;
   addPlusMinus(svg, svgNs, 1, plusMinusY, 0);
   addPlusMinus(svg, svgNs, 1, plusMinusY, -1);
@@ -380,13 +373,16 @@ function heobInit()
   cmdText.setAttribute('onclick', 'alert(this.attributes["heobCmd"].value)');
   addTitle(cmdText, svgNs, cmdText.attributes['heobCmd'].value);
 
+  if (timeline !== null)
+    addTimeline(svg, svgNs, timeline, timelineY);
+
   showType(0, 0);
 
-  if (zoomSvg !== undefined)
+  if (zoomNode >= 0)
   {
     // fake left mouse button
     let e = { button: 0 };
-    zoom(e, zoomSvg);
+    zoom(e, zoomNode);
   }
   infoClear();
 
@@ -401,6 +397,257 @@ function heobInit()
       });
 }
 
+function internStr(s)
+{
+  let idx = strMap.get(s);
+  if (idx === undefined)
+  {
+    idx = strs.length;
+    strs.push(s);
+    strMap.set(s, idx);
+  }
+  return idx;
+}
+
+function nodeAttribute(svg, attr, refAttr, strIdx)
+{
+  let v;
+  if (refAttr !== undefined)
+  {
+    v = svg.getAttribute(refAttr);
+    if (v !== null)
+      return strIdx[parseInt(v)];
+  }
+  v = svg.getAttribute(attr);
+  if (v === null)
+    return -1;
+  return internStr(v);
+}
+
+function parseNodes(svgs)
+{
+  // heobS/heobF/heobM/heobT are indices of heobStr elements
+  let strElems = Array.from(document.getElementsByTagName('heobStr'));
+  let strIdx = new Array(strElems.length);
+  for (let i = 0; i < strElems.length; i++)
+  {
+    strIdx[i] = internStr(strElems[i].getAttribute('v'));
+    strElems[i].parentNode.removeChild(strElems[i]);
+  }
+
+  let nodeSvgs = new Array();
+  for (let i = 0; i < svgs.length; i++)
+  {
+    if (svgs[i].hasAttribute('heobSum'))
+      nodeSvgs.push(svgs[i]);
+  }
+
+  // index 0 is reserved for the bottom node
+  let n = nodeSvgs.length + 1;
+  nodeOfs = new Float64Array(n);
+  nodeStack = new Int32Array(n);
+  nodeSum = new Float64Array(n);
+  nodeAllocs = new Int32Array(n);
+  nodeType = new Uint8Array(n);
+  nodeAddr = new Int32Array(n).fill(-1);
+  nodeSource = new Int32Array(n).fill(-1);
+  nodeFunc = new Int32Array(n).fill(-1);
+  nodeMod = new Int32Array(n).fill(-1);
+  nodeThread = new Int32Array(n).fill(-1);
+  nodeBlocked = new Uint8Array(n);
+  nodeId = new Float64Array(n);
+  nodeLabel = new Int32Array(n).fill(-1);
+  nodeColor = new Int32Array(n);
+  nodeFound = new Uint8Array(n);
+  nodeX = new Float64Array(n);
+  nodeWidth = new Float64Array(n);
+  nodeOpacity = new Float32Array(n);
+  nodeType[0] = 1;
+
+  for (let i = 1; i < n; i++)
+  {
+    let svg = nodeSvgs[i - 1];
+
+    nodeOfs[i] = parseInt(svg.getAttribute('heobOfs'));
+    nodeStack[i] = parseInt(svg.getAttribute('heobStack'));
+    nodeSum[i] = parseInt(svg.getAttribute('heobSum'));
+    let allocs = svg.getAttribute('heobAllocs');
+    if (allocs !== null)
+      nodeAllocs[i] = parseInt(allocs);
+    else
+      nodeType[i] = 1;
+    nodeAddr[i] = nodeAttribute(svg, 'heobAddr');
+    nodeSource[i] = nodeAttribute(svg, 'heobSource', 'heobS', strIdx);
+    nodeFunc[i] = nodeAttribute(svg, 'heobFunc', 'heobF', strIdx);
+    nodeMod[i] = nodeAttribute(svg, 'heobMod', 'heobM', strIdx);
+    nodeThread[i] = nodeAttribute(svg, 'heobThread', 'heobT', strIdx);
+    if (svg.hasAttribute('heobBlocked'))
+      nodeBlocked[i] = 1;
+    let id = svg.getAttribute('heobId');
+    if (id !== null)
+      nodeId[i] = parseInt(id.substring(1));
+
+    // the element is no longer needed, everything is drawn on the canvas
+    svg.parentNode.removeChild(svg);
+  }
+  nodeCount = n;
+}
+
+function addCanvas(par, svgNs, width, height)
+{
+  canvasWidth = width;
+  for (let i = 0; i < maxStack; i++)
+    rows.push(new Array());
+
+  let fo = document.createElementNS(svgNs, 'foreignObject');
+  fo.setAttribute('x', 0);
+  fo.setAttribute('y', headerHeight);
+  fo.setAttribute('width', width);
+  fo.setAttribute('height', height);
+
+  let ratio = window.devicePixelRatio || 1;
+  canvas = document.createElementNS('http://www.w3.org/1999/xhtml', 'canvas');
+  canvas.width = Math.ceil(width * ratio);
+  canvas.height = Math.ceil(height * ratio);
+  canvas.style['width'] = width + 'px';
+  canvas.style['height'] = height + 'px';
+  canvas.style['display'] = 'block';
+  canvas.onmousemove = function (e) { hoverSet(nodeAt(e)); };
+  canvas.onmouseout = function (e) { hoverSet(-1); };
+  canvas.onclick =
+    function (e)
+    {
+      let i = nodeAt(e);
+      if (i >= 0) zoom(e, i);
+    };
+  canvas.onmousedown =
+    function (e)
+    {
+      let i = nodeAt(e);
+      if (i >= 0) delZoom(e, i);
+    };
+
+  fo.appendChild(canvas);
+  par.appendChild(fo);
+}
+
+function nodeAt(e)
+{
+  let r = canvas.getBoundingClientRect();
+  if (r.width <= 0 || r.height <= 0) return -1;
+
+  let x = (e.clientX - r.left) * canvasWidth / r.width;
+  let row = Math.floor((e.clientY - r.top) * rows.length / r.height);
+  if (row < 0 || row >= rows.length) return -1;
+
+  // last node of the row which starts left of x
+  let arr = rows[row];
+  let lo = 0;
+  let hi = arr.length;
+  while (lo < hi)
+  {
+    let mid = (lo + hi) >> 1;
+    if (nodeX[arr[mid]] <= x)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo === 0) return -1;
+
+  let i = arr[lo - 1];
+  if (x >= nodeX[i] + nodeWidth[i]) return -1;
+  return i;
+}
+
+function hoverSet(i)
+{
+  if (i === hoverNode) return;
+  hoverNode = i;
+
+  if (i >= 0)
+  {
+    infoSet(i);
+    canvas.setAttribute('title', nodeTitle(i));
+    canvas.style['cursor'] = 'pointer';
+  }
+  else
+  {
+    infoClear();
+    canvas.removeAttribute('title');
+    canvas.style['cursor'] = 'default';
+  }
+  drawRequest();
+}
+
+function drawRequest()
+{
+  if (drawPending) return;
+  drawPending = true;
+  window.requestAnimationFrame(drawNodes);
+}
+
+function drawNodes()
+{
+  drawPending = false;
+
+  let ctx = canvas.getContext('2d');
+  let ratio = canvas.width / canvasWidth;
+  ctx.setTransform(ratio, 0, 0, ratio, 0, 0);
+  ctx.clearRect(0, 0, canvasWidth, rows.length * 16);
+  ctx.font = '12px Verdana';
+  ctx.lineWidth = 0.5;
+  ctx.strokeStyle = 'black';
+
+  for (let r = 0; r < rows.length; r++)
+  {
+    let arr = rows[r];
+    let y = r * 16;
+    for (let j = 0; j < arr.length; j++)
+    {
+      let i = arr[j];
+      drawNode(ctx, i, y, i === hoverNode);
+    }
+  }
+  ctx.globalAlpha = 1;
+}
+
+function drawNode(ctx, i, y, hover)
+{
+  let x = nodeX[i];
+  let width = nodeWidth[i];
+
+  let opacity = nodeOpacity[i];
+  if (highlighter !== undefined)
+    opacity = highlighter(i) ? 1 : opacity * 0.25;
+  ctx.globalAlpha = opacity;
+
+  ctx.fillStyle = nodeFound[i] ? '#ffffff' : colors[nodeColor[i]];
+  ctx.beginPath();
+  if (width > 6 && ctx.roundRect !== undefined)
+    ctx.roundRect(x, y, width, 15, 3);
+  else
+    ctx.rect(x, y, width, 15);
+  ctx.fill();
+  if (hover)
+  {
+    ctx.stroke();
+    ctx.strokeRect(x, y, width, 16);
+  }
+
+  if (width < MIN_TEXT_WIDTH || nodeLabel[i] < 0) return;
+
+  // the text is cut off at the end of the node
+  ctx.save();
+  ctx.beginPath();
+  ctx.rect(x, y, width, 16);
+  ctx.clip();
+  ctx.fillStyle = 'black';
+  ctx.fillText(strs[nodeLabel[i]], x + 2, y + 10.5);
+  if (hover)
+    ctx.strokeText(strs[nodeLabel[i]], x + 2, y + 10.5);
+  ctx.restore();
+}
+
 function threadSort()
 {
   threadArray.sort(
@@ -410,7 +657,7 @@ function threadSort()
       let sumSamplesB = threadMap.get(b)[0];
       if (sumSamplesA !== sumSamplesB)
         return sumSamplesB - sumSamplesA;
-      return a.localeCompare(b, undefined, {numeric: true});
+      return strs[a].localeCompare(strs[b], undefined, {numeric: true});
     });
 }
 
@@ -440,6 +687,50 @@ function addDistSvgs(svgNs, par, count, name, xOfs, fullHeight, rect0)
   }
 }
 
+function addTimeline(par, svgNs, timeline, y)
+{
+  let values = timeline.attributes['heobTimeline'].value.split(' ');
+  let interval = parseInt(timeline.attributes['heobInterval'].value);
+  let peak = parseInt(timeline.attributes['heobPeak'].value);
+  let max = 0;
+  for (let i = 0; i < values.length; i++)
+  {
+    values[i] = parseInt(values[i]);
+    if (values[i] > max)
+      max = values[i];
+  }
+
+  let bg = addRectPara(svgNs, fullWidth, timelineHeight, '#eeeeee');
+  bg.setAttribute('x', spacer);
+  bg.setAttribute('y', y);
+  par.appendChild(bg);
+
+  let points = '';
+  let count = values.length;
+  for (let i = 0; i < count; i++)
+  {
+    let x = spacer;
+    if (count > 1)
+      x += fullWidth * i / (count - 1);
+    let h = 0;
+    if (max > 0)
+      h = values[i] * (timelineHeight - 20) / max;
+    points += x + ',' + (y + timelineHeight - h) + ' ';
+  }
+  let line = document.createElementNS(svgNs, 'polyline');
+  line.setAttribute('points', points);
+  line.setAttribute('fill', 'none');
+  line.setAttribute('stroke', '#c03030');
+  par.appendChild(line);
+
+  timeline.setAttribute('x', spacer + 2);
+  timeline.setAttribute('y', y + 12);
+  timeline.setAttribute('font-size', '12');
+  timeline.setAttribute('font-family', 'Verdana');
+  timeline.textContent = 'heap peak: ' + sumText(0, max, 0) + ' after ' +
+    ((peak + 1) * interval / 1000).toFixed(1) + 's';
+}
+
 function searchFunction()
 {
   if (searchRe !== undefined)
@@ -451,26 +742,27 @@ function searchFunction()
       searchRe = new RegExp(str, 'i');
   }
 
-  let svgs = document.getElementsByTagName('svg');
+  // each function name is only searched once
+  let matches = new Uint8Array(strs.length);
   let found = false;
-  for (let i = 0; i < svgs.length; i++)
+  for (let i = 0; i < nodeCount; i++)
   {
-    let svg = svgs[i];
-    if (svg.attributes['heobFunc'] === undefined) continue;
-    let rect = svg.getElementsByTagName('rect')[1];
-    if (searchRe === undefined ||
-        svg.attributes['heobFunc'].value.search(searchRe) < 0)
-    {
-      rect.setAttribute('fill', svg.attributes['heobColor'].value);
-      continue;
-    }
-    rect.setAttribute('fill', '#ffffff');
+    let func = nodeFunc[i];
+    nodeFound[i] = 0;
+    if (func < 0 || searchRe === undefined) continue;
+
+    if (!matches[func])
+      matches[func] = strs[func].search(searchRe) < 0 ? 1 : 2;
+    if (matches[func] === 1) continue;
+
+    nodeFound[i] = 1;
     found = true;
   }
 
   if (!found) searchRe = undefined;
 
   showTypeData();
+  drawRequest();
 }
 
 function createGradient(svg, svgNs, name, grad1, grad2)
@@ -490,89 +782,96 @@ function createGradient(svg, svgNs, name, grad1, grad2)
   svg.appendChild(newDefs);
 }
 
-function getColorOfMap(svg, map, attr, colorFunction)
+function getColorOfMap(key, map, colorFunction)
 {
   let color;
-  if (svg.attributes[attr] !== undefined)
-    color = map.get(svg.attributes[attr].value);
+  if (key >= 0)
+    color = map.get(key);
   if (color === undefined)
   {
-    color = colorFunction();
-    if (svg.attributes[attr] !== undefined)
-      map.set(svg.attributes[attr].value, color);
+    color = colors.length;
+    colors.push(colorFunction());
+    if (key >= 0)
+      map.set(key, color);
   }
   return color;
 }
 
-function addToCountMap(key, map, ofs, samples, svg)
+function createCountMap(n)
 {
-  let val = map.get(key);
-  if (val === undefined)
-  {
-    val = new Array(7);
-    val[0] = 0;   // count
-    val[1] = 0;   // maximum extention
-    val[2] = 0;   // sum of samples
-    val[3] = 0;   // sum of allocation count
-    val[4] = svg; // data reference
-    val[5] = 0;   // use source of data reference
-    val[6] = 0;   // use address of data reference
-    map.set(key, val);
-  }
-  if (ofs + 0.1 >= val[1])
+  // indexed by the key string
+  let map = new Object();
+  map.count = new Int32Array(n);        // count
+  map.ext = new Float64Array(n);        // maximum extention
+  map.sum = new Float64Array(n);        // sum of samples
+  map.allocs = new Float64Array(n);     // sum of allocation count
+  map.ref = new Int32Array(n).fill(-1); // data reference
+  map.useSource = new Uint8Array(n);    // use source of data reference
+  map.useAddr = new Uint8Array(n);      // use address of data reference
+  return map;
+}
+
+function addToCountMap(key, map, ofs, samples, node)
+{
+  if (map.ref[key] < 0)
+    map.ref[key] = node;
+  if (ofs + 0.1 >= map.ext[key])
   {
-    val[0]++;
-    val[1] = ofs + samples;
-    val[2] += samples;
+    map.count[key]++;
+    map.ext[key] = ofs + samples;
+    map.sum[key] += samples;
   }
 }
 
 function arrayFromCountMap(map)
 {
+  // only these keys are updated from now on
   let arr = new Array();
-  map.forEach(
-    function (val, key, map)
+  for (let key = 0; key < map.ref.length; key++)
+  {
+    if (map.ref[key] < 0) continue;
+    if (map.sum[key] > 0 && map.count[key] >= 2)
+      arr.push(key);
+    else
+      map.ref[key] = -1;
+  }
+  // in the order of their first appearance
+  arr.sort(
+    function (a, b)
     {
-      if (val[2] > 0 && val[0] >= 2)
-        arr.push(key);
+      return map.ref[a] - map.ref[b];
     });
   return arr;
 }
 
-function resetCountMap(map)
+function resetCountMap(map, arr)
 {
-  map.forEach(
-    function (val, key, map)
-    {
-      val[0] = 0;
-      val[1] = 0;
-      val[2] = 0;
-      val[3] = 0;
-      val[5] = val[4].attributes['heobSource'] !== undefined ? 1 : 0;
-      val[6] = val[4].attributes['heobAddr'] !== undefined ? 1 : 0;
-    });
+  for (let i = 0; i < arr.length; i++)
+  {
+    let key = arr[i];
+    let ref = map.ref[key];
+    map.count[key] = 0;
+    map.ext[key] = 0;
+    map.sum[key] = 0;
+    map.allocs[key] = 0;
+    map.useSource[key] = nodeSource[ref] >= 0 ? 1 : 0;
+    map.useAddr[key] = nodeAddr[ref] >= 0 ? 1 : 0;
+  }
 }
 
-function updateCountMap(map, svg, keyName, ofs, samples, shownSamples, allocs)
-{
-  if (svg.attributes[keyName] === undefined) return;
-  let key = svg.attributes[keyName].value;
-  let val = map.get(key);
-  if (val === undefined || ofs + 0.1 < val[1]) return;
-  val[0]++;
-  val[1] = ofs + samples;
-  val[2] += shownSamples;
-  val[3] += allocs;
-  if (val[5] &&
-      (svg.attributes['heobSource'] === undefined ||
-       svg.attributes['heobSource'].value !==
-       val[4].attributes['heobSource'].value))
-    val[5] = 0;
-  if (val[6] &&
-      (svg.attributes['heobAddr'] === undefined ||
-       svg.attributes['heobAddr'].value !==
-       val[4].attributes['heobAddr'].value))
-    val[6] = 0;
+function updateCountMap(map, key, node, ofs, samples, shownSamples, allocs)
+{
+  if (key < 0) return;
+  let ref = map.ref[key];
+  if (ref < 0 || ofs + 0.1 < map.ext[key]) return;
+  map.count[key]++;
+  map.ext[key] = ofs + samples;
+  map.sum[key] += shownSamples;
+  map.allocs[key] += allocs;
+  if (map.useSource[key] && nodeSource[node] !== nodeSource[ref])
+    map.useSource[key] = 0;
+  if (map.useAddr[key] && nodeAddr[node] !== nodeAddr[ref])
+    map.useAddr[key] = 0;
 }
 
 function sortCountMap(map, arr)
@@ -580,22 +879,14 @@ function sortCountMap(map, arr)
   arr.sort(
     function (a, b)
     {
-      let valueA = map.get(a);
-      let valueB = map.get(b);
-      if ((valueA[0] >= 2) === (valueB[0] >= 2))
-        return valueB[2] - valueA[2];
-      return valueA[0] >= 2 ? -1 : 1;
+      let countA = map.count[a];
+      let countB = map.count[b];
+      if ((countA >= 2) === (countB >= 2))
+        return map.sum[b] - map.sum[a];
+      return countA >= 2 ? -1 : 1;
     });
 }
 
-function getShowKey(svg)
-{
-  let key;
-  if (svg.attributes[showKey] !== undefined)
-    key = svg.attributes[showKey].value;
-  return key;
-}
-
 function createColor(colorFactor, colorOfs, colorSummand)
 {
   let colorNum =
@@ -743,11 +1034,11 @@ function plusMinus(stack)
   zoomArr(lastZoomers);
 }
 
-function attributeToText(svg, attr, noPath)
+function attributeToText(idx, noPath)
 {
-  if (svg.attributes[attr] !== undefined)
+  if (idx >= 0)
   {
-    let t = svg.attributes[attr].value;
+    let t = strs[idx];
     if (noPath === true)
     {
       let delim = t.lastIndexOf('\\');
@@ -760,20 +1051,20 @@ function attributeToText(svg, attr, noPath)
     return '';
 }
 
-function funcAttribute(svg)
+function funcAttribute(i)
 {
-  return attributeToText(svg, 'heobFunc');
+  return attributeToText(nodeFunc[i]);
 }
 
-function sourceAttribute(svg, noPath)
+function sourceAttribute(i, noPath)
 {
-  return attributeToText(svg, 'heobSource', noPath);
+  return attributeToText(nodeSource[i], noPath);
 }
 
-function addrModAttribute(svg, noPath)
+function addrModAttribute(i, noPath)
 {
-  let tAddr = attributeToText(svg, 'heobAddr');
-  let tMod = attributeToText(svg, 'heobMod', noPath);
+  let tAddr = attributeToText(nodeAddr[i]);
+  let tMod = attributeToText(nodeMod[i], noPath);
   if (tAddr.length === 0 && tMod.length > 0)
     tAddr = 'inlined';
   if (tAddr.length > 0 && tMod.length > 0)
@@ -805,26 +1096,28 @@ function sumText(samples, bytes, allocs)
   return t;
 }
 
-function sumAttribute(svg)
+function sumAttribute(i)
 {
-  if (svg.attributes['heobText'] !== undefined)
-    return svg.attributes['heobText'].value;
+  if (i === 0)
+    return allText;
 
-  let sum = parseInt(svg.attributes['heobSum'].value);
-  if (svg.attributes['heobAllocs'] !== undefined)
-    return sumText(0, sum, parseInt(svg.attributes['heobAllocs'].value));
+  let sum = nodeSum[i];
+  if (!nodeType[i])
+    return sumText(0, sum, nodeAllocs[i]);
   else
     return sumText(sum, 0, 0);
 }
 
-function threadAttribute(svg)
+function threadAttribute(i)
 {
-  return attributeToText(svg, 'heobThread');
+  return attributeToText(nodeThread[i]);
 }
 
-function idAttribute(svg)
+function idAttribute(i)
 {
-  return attributeToText(svg, 'heobId');
+  if (!nodeId[i])
+    return '';
+  return '#' + nodeId[i];
 }
 
 function withNL(t)
@@ -834,13 +1127,20 @@ function withNL(t)
   return t + '\n';
 }
 
-function infoSet(svg)
+function nodeTitle(i)
+{
+  return withNL(funcAttribute(i)) + withNL(sourceAttribute(i, true)) +
+    withNL(addrModAttribute(i, true)) + withNL(sumAttribute(i)) +
+    withNL(threadAttribute(i)) + withNL(idAttribute(i));
+}
+
+function infoSet(i)
 {
-  functionText.textContent = funcAttribute(svg);
-  sourceText.textContent = sourceAttribute(svg);
-  addressText.textContent = addrModAttribute(svg);
-  infoText.textContent = sumAttribute(svg);
-  threadText.textContent = threadAttribute(svg);
+  functionText.textContent = funcAttribute(i);
+  sourceText.textContent = sourceAttribute(i);
+  addressText.textContent = addrModAttribute(i);
+  infoText.textContent = sumAttribute(i);
+  threadText.textContent = threadAttribute(i);
 }
 
 function infoClear()
@@ -852,108 +1152,77 @@ function infoClear()
   threadText.textContent = threadTextReset;
 }
 
-function opacitySetter(setter)
+function highlightSet(selector)
 {
-  let svgs = document.getElementsByTagName('svg');
-  for (let i = 0; i < svgs.length; i++)
-  {
-    let svgEntry = svgs[i];
-    if (svgEntry.attributes['heobSum'] === undefined) continue;
-    if (svgEntry.style['display'] === 'none') continue;
-
-    let opacity = parseFloat(svgEntry.attributes['heobOpacity'].value);
-    if (setter !== undefined)
-      opacity = setter(svgEntry, opacity);
-    svgEntry.style['opacity'] = opacity;
-  }
+  // nodes not selected are drawn more transparent
+  highlighter = selector;
+  drawRequest();
 }
 
 function addrInfoSet(svg)
 {
-  let key = svg.attributes['heobKey'].value;
-  opacitySetter(
-    function (svgEntry, opacity)
+  let key = parseInt(svg.attributes['heobKey'].value);
+  highlightSet(
+    function (i)
     {
-      let entryKey = getShowKey(svgEntry);
-      if (entryKey === undefined || entryKey !== key)
-        opacity *= 0.25;
-      else
-        opacity = 1;
-      return opacity;
+      return showCol[i] === key;
     });
 }
 
 function addrInfoClear()
 {
-  opacitySetter();
+  highlightSet();
 }
 
 function threadInfoSet(svg)
 {
-  let key = svg.attributes['heobKey'].value;
-  opacitySetter(
-    function (svgEntry, opacity)
+  let key = parseInt(svg.attributes['heobKey'].value);
+  highlightSet(
+    function (i)
     {
-      if (svgEntry.attributes['heobThread'] === undefined ||
-        svgEntry.attributes['heobThread'].value !== key)
-        opacity *= 0.25;
-      else
-        opacity = 1;
-      return opacity;
+      return nodeThread[i] === key;
     });
 }
 
 function blockedInfoSet()
 {
-  opacitySetter(
-    function (svgEntry, opacity)
+  highlightSet(
+    function (i)
     {
-      if (svgEntry.attributes['heobBlocked'] === undefined)
-        opacity *= 0.25;
-      else
-        opacity = 1;
-      return opacity;
+      return nodeBlocked[i] !== 0;
     });
 }
 
-function getZoomers(svg)
+function getZoomers(i)
 {
-  let ofs = parseInt(svg.attributes['heobOfs'].value);
-  let stack = parseInt(svg.attributes['heobStack'].value);
-  let samples = parseInt(svg.attributes['heobSum'].value);
-
   let zoomers = new Array(1);
   let zoomer = new Array(3);
-  zoomer[0] = ofs;
-  zoomer[1] = stack;
-  zoomer[2] = samples;
+  zoomer[0] = nodeOfs[i];
+  zoomer[1] = nodeStack[i];
+  zoomer[2] = nodeSum[i];
   zoomers[0] = zoomer;
   return zoomers;
 }
 
 function getSelZoomers(selector)
 {
-  let svgs = document.getElementsByTagName('svg');
   let zoomers = new Array();
   let maxExtention = 0;
-  let foundSvg;
-  for (let i = 0; i < svgs.length; i++)
+  let foundNode = -1;
+  for (let i = nodeStart; i < nodeCount; i++)
   {
-    let svg = svgs[i];
-    if (svg.attributes['heobSum'] === undefined) continue;
-
-    if (!selector(svg))
+    if (!selector(i))
       continue;
 
-    let ofs = parseInt(svg.attributes['heobOfs'].value);
+    let ofs = nodeOfs[i];
     if (ofs + 0.1 < maxExtention)
       continue;
 
-    if (foundSvg === undefined)
-      foundSvg = svg;
+    if (foundNode < 0)
+      foundNode = i;
 
-    let stack = parseInt(svg.attributes['heobStack'].value);
-    let samples = parseInt(svg.attributes['heobSum'].value);
+    let stack = nodeStack[i];
+    let samples = nodeSum[i];
 
     maxExtention = ofs + samples;
 
@@ -963,34 +1232,33 @@ function getSelZoomers(selector)
     zoomer[2] = samples;
     zoomers.push(zoomer);
   }
-  return [zoomers, foundSvg];
+  return [zoomers, foundNode];
 }
 
 function getAddrZoomers(key)
 {
   return getSelZoomers(
-    function (svg)
+    function (i)
     {
-      return getShowKey(svg) === key;
+      return showCol[i] === key;
     });
 }
 
 function getThreadZoomers(key)
 {
   return getSelZoomers(
-    function (svg)
+    function (i)
     {
-      return svg.attributes['heobThread'] !== undefined &&
-        svg.attributes['heobThread'].value === key;
+      return nodeThread[i] === key;
     })[0];
 }
 
 function getBlockedZoomers()
 {
   return getSelZoomers(
-    function (svg)
+    function (i)
     {
-      return svg.attributes['heobBlocked'] !== undefined;
+      return nodeBlocked[i] !== 0;
     })[0];
 }
 
@@ -1121,9 +1389,9 @@ function zoomArr(zoomers)
   }
   if (suppressStacks > 0) minStack = suppressStacks;
 
-  resetCountMap(addrCountMap);
-  resetCountMap(sourceCountMap);
-  resetCountMap(funcCountMap);
+  resetCountMap(addrCountMap, addrCountArr);
+  resetCountMap(sourceCountMap, sourceCountArr);
+  resetCountMap(funcCountMap, funcCountArr);
 
   threadMap.forEach(
     function (value, key, map)
@@ -1133,7 +1401,9 @@ function zoomArr(zoomers)
       value[3] = 0;
     });
 
-  let svgs = document.getElementsByTagName('svg');
+  for (let r = 0; r < rows.length; r++)
+    rows[r].length = 0;
+
   let zidx = 0;
   let pos = 0;
   let cidx = 0;
@@ -1153,18 +1423,13 @@ function zoomArr(zoomers)
   let stackShowMin = minStack > 3 ? minStack - 1 : 0;
   let stackShowDiff = stackShowMin ? stackShowMin - 2 : 0;
   let visibleStack = 0;
-  for (let i = 0; i < svgs.length; i++)
+  for (let i = nodeStart; i < nodeCount; i++)
   {
-    let svg = svgs[i];
-    if (svg.attributes['heobSum'] === undefined) continue;
-
-    let ofs = parseInt(svg.attributes['heobOfs'].value);
-    let stack = parseInt(svg.attributes['heobStack'].value);
-    let samples = parseInt(svg.attributes['heobSum'].value);
-    let allocs = 0;
-    let svgType = svg.attributes['heobAllocs'] === undefined;
-    if (!svgType)
-      allocs = parseInt(svg.attributes['heobAllocs'].value);
+    let ofs = nodeOfs[i];
+    let stack = nodeStack[i];
+    let samples = nodeSum[i];
+    let allocs = nodeAllocs[i];
+    let svgType = nodeType[i] !== 0;
 
     if (zidx < zoomers.length &&
         ofs + 0.1 >= zoomers[zidx][0] + zoomers[zidx][2])
@@ -1173,21 +1438,15 @@ function zoomArr(zoomers)
       zidx++;
     }
     if (zidx >= zoomers.length || ofs + samples - 0.1 <= zoomers[zidx][0])
-    {
-      svg.style['display'] = 'none';
       continue;
-    }
 
     if (stack > 0 && stack < stackShowMin)
-    {
-      svg.style['display'] = 'none';
       continue;
-    }
 
     if (stack > visibleStack)
       visibleStack = stack;
 
-    if (svg.attributes['heobBlocked'] !== undefined)
+    if (nodeBlocked[i])
       blockedCount++;
 
     let x1 = pos;
@@ -1205,19 +1464,16 @@ function zoomArr(zoomers)
 
     if (mapType === svgType)
     {
-      updateCountMap(addrCountMap, svg, 'heobAddr',
+      updateCountMap(addrCountMap, nodeAddr[i], i,
           ofs, samples, shownSamples, allocs);
-      updateCountMap(sourceCountMap, svg, 'heobSource',
+      updateCountMap(sourceCountMap, nodeSource[i], i,
           ofs, samples, shownSamples, allocs);
-      updateCountMap(funcCountMap, svg, 'heobFunc',
+      updateCountMap(funcCountMap, nodeFunc[i], i,
           ofs, samples, shownSamples, allocs);
 
-      let thread;
-      if (svg.attributes['heobThread'] !== undefined)
-        thread = svg.attributes['heobThread'].value;
       let mapEntry;
-      if (thread !== undefined)
-        mapEntry = threadMap.get(thread);
+      if (nodeThread[i] >= 0)
+        mapEntry = threadMap.get(nodeThread[i]);
       if (mapEntry !== undefined && ofs + 0.1 >= mapEntry[1])
       {
         mapEntry[0] += shownSamples;
@@ -1227,25 +1483,18 @@ function zoomArr(zoomers)
     }
 
     let x = spacer + x1 * fullWidth / zoomSamples;
-    let y = headerHeight + (maxStack - stack - 1) * 16;
+    let row = maxStack - stack - 1;
     let width = shownSamples * fullWidth / zoomSamples;
-    let height = 16;
     let opacity = stack >= zoomers[zidx][1] ? 1 : 0.5;
 
     if (stack > 1)
-      y += stackShowDiff * 16;
-
-    svg.setAttribute('x', x);
-    svg.setAttribute('y', y);
-    svg.setAttribute('width', width);
-    svg.setAttribute('height', height);
-    svg.style['display'] = 'block';
-    svg.style['opacity'] = opacity;
-    svg.setAttribute('heobOpacity', opacity);
+      row += stackShowDiff;
 
-    let rects = svg.getElementsByTagName('rect');
-    for (let j = 0; j < 2; j++)
-      rects[j].setAttribute('width', width);
+    nodeX[i] = x;
+    nodeWidth[i] = width;
+    nodeOpacity[i] = opacity;
+    if (width >= MIN_DRAW_WIDTH && row >= 0 && row < rows.length)
+      rows[row].push(i);
 
     if (ofs + 0.1 > maxExtention && stack > 0)
     {
@@ -1270,6 +1519,21 @@ function zoomArr(zoomers)
       }
     }
   }
+  for (let r = 0; r < rows.length; r++)
+  {
+    rows[r].sort(
+      function (a, b)
+      {
+        return nodeX[a] - nodeX[b];
+      });
+  }
+  if (hoverNode >= 0)
+  {
+    hoverNode = -1;
+    canvas.removeAttribute('title');
+  }
+  drawRequest();
+
   let blockedSvg = document.getElementById('blocked');
   setButtonVisible(blockedSvg, blockedCount);
 
@@ -1299,8 +1563,8 @@ function zoomArr(zoomers)
     let arr = showArrs[i];
     let l = arr.length;
     if (l === 0) continue;
-    let map0 = showMaps[i].get(arr[0]);
-    if (map0[2] === 0 || map0[0] < 2) l = 0;
+    let map = showMaps[i];
+    if (map.sum[arr[0]] === 0 || map.count[arr[0]] < 2) l = 0;
     if (l > showCount) showCount = l;
   }
 
@@ -1339,18 +1603,18 @@ function zoomArr(zoomers)
     if (maxThreadSamples === 0)
       maxThreadSamples = sum;
 
-    let refSvg = value[2];
+    let refNode = value[2];
 
     let width = Math.max(sum * halfWidth / maxThreadSamples, 2);
     let x = spacer + fullWidth - width;
     let color = value[4];
     if (color === undefined)
-      color = refSvg.attributes['heobColor'].value;
+      color = nodeColor[refNode];
 
-    let t = withNL(key) +
+    let t = withNL(strs[key]) +
       sumText(mapType ? sum : 0, mapType ? 0 : sum, value[3]);
 
-    setCommonSvgData(svg, t, key, width, color, key);
+    setCommonSvgData(svg, t, key, width, colors[color], strs[key]);
 
     svg.setAttribute('x', x);
   }
@@ -1374,10 +1638,9 @@ function showTypeData(maxShowSamples)
     }
 
     let key = showArr[i];
-    let value = showMap.get(key);
 
-    let sum = value[2];
-    if (sum === 0 || value[0] < 2)
+    let sum = showMap.sum[key];
+    if (sum === 0 || showMap.count[key] < 2)
     {
       svg.style['display'] = 'none';
       continue;
@@ -1386,20 +1649,20 @@ function showTypeData(maxShowSamples)
     if (maxShowSamples === undefined)
       maxShowSamples = sum;
 
-    let refSvg = value[4];
+    let refNode = showMap.ref[key];
 
     let width = Math.max(sum * halfWidth / maxShowSamples, 2);
     if (width > halfWidth) width = halfWidth;
-    let color = refSvg.attributes['heobColor'].value;
+    let color = colors[nodeColor[refNode]];
 
-    let textContent = refSvg.getElementsByTagName('text')[0].textContent;
+    let textContent = attributeToText(nodeLabel[refNode]);
     if (searchRe !== undefined && textContent.search(searchRe) >= 0)
       color = '#ffffff';
 
-    let t = withNL(funcAttribute(refSvg));
-    if (value[5]) t += withNL(sourceAttribute(refSvg, true));
-    if (value[6]) t += withNL(addrModAttribute(refSvg, true));
-    t += sumText(mapType ? sum : 0, mapType ? 0 : sum, value[4]);
+    let t = withNL(funcAttribute(refNode));
+    if (showMap.useSource[key]) t += withNL(sourceAttribute(refNode, true));
+    if (showMap.useAddr[key]) t += withNL(addrModAttribute(refNode, true));
+    t += sumText(mapType ? sum : 0, mapType ? 0 : sum, showMap.allocs[key]);
 
     setCommonSvgData(svg, t, key, width, color, textContent);
   }
@@ -1433,19 +1696,19 @@ function showType(t, refresh)
   {
     showMap = funcCountMap;
     showArr = funcCountArr;
-    showKey = 'heobFunc';
+    showCol = nodeFunc;
   }
   else if (t === 1)
   {
     showMap = sourceCountMap;
     showArr = sourceCountArr;
-    showKey = 'heobSource';
+    showCol = nodeSource;
   }
   else
   {
     showMap = addrCountMap;
     showArr = addrCountArr;
-    showKey = 'heobAddr';
+    showCol = nodeAddr;
   }
 
   for (let i = 0; i < 3; i++)
@@ -1458,23 +1721,23 @@ function showType(t, refresh)
     showTypeData();
 }
 
-function zoom(e, svg)
+function zoom(e, i)
 {
   if (e.button !== 0) return;
 
-  functionTextReset = funcAttribute(svg);
-  sourceTextReset = sourceAttribute(svg);
-  addressTextReset = addrModAttribute(svg);
-  threadTextReset = threadAttribute(svg);
+  functionTextReset = funcAttribute(i);
+  sourceTextReset = sourceAttribute(i);
+  addressTextReset = addrModAttribute(i);
+  threadTextReset = threadAttribute(i);
 
-  zoomArr(getZoomers(svg));
+  zoomArr(getZoomers(i));
 }
 
-function delZoom(e, svg)
+function delZoom(e, i)
 {
   if (e.button !== 1) return;
 
-  let zoomers = getZoomers(svg);
+  let zoomers = getZoomers(i);
   zoomers = zoomersAndNot(zoomers, e.ctrlKey);
   zoomArr(zoomers);
   infoClear();
@@ -1484,25 +1747,24 @@ function addrZoom(e, svg)
 {
   if (e.button !== 0) return;
 
-  let key = svg.attributes['heobKey'].value;
+  let key = parseInt(svg.attributes['heobKey'].value);
 
   if (e.ctrlKey)
   {
-    let value = showMap.get(key);
-    let sum = value[2];
+    let sum = showMap.sum[key];
     showTypeData(sum);
     return;
   }
 
   let zoomersRet = getAddrZoomers(key);
   let zoomers = zoomersRet[0];
-  let foundSvg = zoomersRet[1];
+  let foundNode = zoomersRet[1];
 
   zoomArr(zoomers);
 
-  functionTextReset = funcAttribute(foundSvg);
-  sourceTextReset = sourceAttribute(foundSvg);
-  addressTextReset = addrModAttribute(foundSvg);
+  functionTextReset = funcAttribute(foundNode);
+  sourceTextReset = sourceAttribute(foundNode);
+  addressTextReset = addrModAttribute(foundNode);
   threadTextReset = '';
   infoClear();
 }
@@ -1511,10 +1773,9 @@ function addrDelZoom(e, svg)
 {
   if (e.button !== 1) return;
 
-  let key = svg.attributes['heobKey'].value;
+  let key = parseInt(svg.attributes['heobKey'].value);
   let zoomersRet = getAddrZoomers(key);
   let zoomers = zoomersRet[0];
-  let foundSvg = zoomersRet[1];
 
   zoomers = zoomersAndNot(zoomers, e.ctrlKey);
   zoomArr(zoomers);
@@ -1525,11 +1786,11 @@ function threadZoom(e, svg)
 {
   if (e.button !== 0) return;
 
-  let key = svg.attributes['heobKey'].value;
+  let key = parseInt(svg.attributes['heobKey'].value);
   let zoomers = getThreadZoomers(key);
   zoomArr(zoomers);
 
-  functionTextReset = key;
+  functionTextReset = strs[key];
   sourceTextReset = '';
   addressTextReset = '';
   threadTextReset = '';
@@ -1540,7 +1801,7 @@ function threadDelZoom(e, svg)
 {
   if (e.button !== 1) return;
 
-  let key = svg.attributes['heobKey'].value;
+  let key = parseInt(svg.attributes['heobKey'].value);
   let zoomers = getThreadZoomers(key);
   zoomers = zoomersAndNot(zoomers, e.ctrlKey);
   zoomArr(zoomers);